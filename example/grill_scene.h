@@ -0,0 +1,40 @@
+#pragma once
+
+#include "bgi2.h"
+
+// The scene of the grill simulator, shared by the example and the
+// benchmarks.
+namespace grill
+{
+    enum class DoorAnim
+    {
+        None,
+        Open,
+        Close,
+    };
+
+    enum class MoveAnim
+    {
+        None,
+        Left,
+        Right,
+    };
+
+    struct GrillState
+    {
+        int x_pos = 0;
+        int door_open_pct = 0;
+        int left_gas_knob_angle = 0;
+        int right_gas_knob_angle = 0;
+        float lid_heat_c = 20;
+        bool open = false;
+        DoorAnim door_anim = DoorAnim::None;
+        MoveAnim move_anim = MoveAnim::None;
+        bool paused = false;
+    };
+
+    void DrawGrill(bgi::Drawer global_drawer, const GrillState &state);
+    void HandleKeyPress(GrillState &state, int scancode, bool shift);
+    // Advances the animations by one frame.
+    void Animate(GrillState &state);
+} // namespace grill
@@ -2,10 +2,24 @@
 
 #include <SDL.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
 #include <cstdint>
 #include <cmath>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 #include <string>
 #include <sstream>
@@ -37,8 +51,8 @@ namespace bgi
 
     struct Point
     {
-        Point() {}
-        Point(int x, int y) : x(x), y(y) {}
+        constexpr Point() {}
+        constexpr Point(int x, int y) : x(x), y(y) {}
         explicit Point(const SDL_Point &sdl) : Point(sdl.x, sdl.y) {}
         SDL_Point sdl() { return SDL_Point{x, y}; }
 
@@ -59,25 +73,208 @@ namespace bgi
         int h = 0;
     };
 
-    // TODO: maybe a fast allocator?
-    using Polygon = std::vector<Point>;
+    class PolygonArena;
+
+    // A list of points with the interface of a std::vector<Point>. Up to
+    // kInlineSize points are stored in place, without allocating. More are
+    // stored in the PolygonArena that was active on the thread when the
+    // polygon was created, or in the heap if there was none.
+    //
+    // Beware: this includes copies. A copy made while a
+    // PolygonArena::Scope is active (or a polygon moved from one stored in
+    // place, once it grows) lives in that arena, whatever the storage of
+    // the original, and must not outlive the Scope. To keep a polygon,
+    // assign it to one created outside of the Scope.
+    //
+    // For code written when polygons were vectors, a Polygon converts to and
+    // from a std::vector<Point> (copying the points). It cannot bind to a
+    // non-const std::vector<Point> &, though.
+    class Polygon
+    {
+    public:
+        static constexpr size_t kInlineSize = 16;
+
+        using value_type = Point;
+        using size_type = size_t;
+        using difference_type = ptrdiff_t;
+        using reference = Point &;
+        using const_reference = const Point &;
+        using pointer = Point *;
+        using const_pointer = const Point *;
+        using iterator = Point *;
+        using const_iterator = const Point *;
+
+        Polygon();
+        explicit Polygon(size_t size, const Point &value = Point());
+        Polygon(std::initializer_list<Point> points);
+        template <typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+        Polygon(InputIt first, InputIt last) : Polygon()
+        {
+            insert(end(), first, last);
+        }
+        Polygon(const Polygon &other);
+        Polygon(Polygon &&other) noexcept;
+        Polygon(const std::vector<Point> &points) : Polygon(points.begin(), points.end()) {}
+        // Assigning keeps the storage of this polygon (so a polygon does not
+        // end up in the arena of another one).
+        Polygon &operator=(const Polygon &other);
+        Polygon &operator=(Polygon &&other);
+        Polygon &operator=(std::initializer_list<Point> points);
+        ~Polygon();
+
+        operator std::vector<Point>() const { return std::vector<Point>(begin(), end()); }
+
+        iterator begin() { return data_; }
+        iterator end() { return data_ + size_; }
+        const_iterator begin() const { return data_; }
+        const_iterator end() const { return data_ + size_; }
+        const_iterator cbegin() const { return data_; }
+        const_iterator cend() const { return data_ + size_; }
+
+        Point *data() { return data_; }
+        const Point *data() const { return data_; }
+        size_t size() const { return size_; }
+        size_t capacity() const { return capacity_; }
+        bool empty() const { return size_ == 0; }
+
+        Point &operator[](size_t i) { return data_[i]; }
+        const Point &operator[](size_t i) const { return data_[i]; }
+        Point &at(size_t i);
+        const Point &at(size_t i) const;
+        Point &front() { return data_[0]; }
+        const Point &front() const { return data_[0]; }
+        Point &back() { return data_[size_ - 1]; }
+        const Point &back() const { return data_[size_ - 1]; }
+
+        void reserve(size_t capacity);
+        void resize(size_t size, const Point &value = Point());
+        void clear() { size_ = 0; }
+        void push_back(const Point &point)
+        {
+            // `point` may be in this polygon, which Grow() frees.
+            const Point copy = point;
+            if (size_ == capacity_)
+            {
+                Grow(size_ + 1);
+            }
+            data_[size_++] = copy;
+        }
+        template <typename... Args>
+        Point &emplace_back(Args &&...args)
+        {
+            // Made before Grow(), as the args may be in this polygon.
+            const Point point(std::forward<Args>(args)...);
+            if (size_ == capacity_)
+            {
+                Grow(size_ + 1);
+            }
+            return data_[size_++] = point;
+        }
+        void pop_back() { size_--; }
+        iterator insert(const_iterator pos, const Point &point);
+        template <typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+        iterator insert(const_iterator pos, InputIt first, InputIt last)
+        {
+            const size_t index = pos - data_;
+            const size_t old_size = size_;
+            for (; first != last; ++first)
+            {
+                push_back(*first);
+            }
+            std::rotate(data_ + index, data_ + old_size, data_ + size_);
+            return data_ + index;
+        }
+        iterator erase(const_iterator first, const_iterator last);
+        iterator erase(const_iterator pos) { return erase(pos, pos + 1); }
+
+        friend bool operator==(const Polygon &a, const Polygon &b);
+        friend bool operator!=(const Polygon &a, const Polygon &b) { return !(a == b); }
+
+    private:
+        // Makes room for at least `capacity` points.
+        void Grow(size_t capacity);
+        bool is_inline() const { return data_ == reinterpret_cast<const Point *>(inline_); }
+
+        Point *data_;
+        uint32_t size_ = 0;
+        uint32_t capacity_ = kInlineSize;
+        // Where data_ comes from, if it is not inline_: an arena, or the heap
+        // if null.
+        PolygonArena *arena_ = nullptr;
+        alignas(Point) unsigned char inline_[kInlineSize * sizeof(Point)];
+    };
+
+    // A polygon with a fixed number of points, which can be made at compile
+    // time and kept in read-only data:
+    //
+    //     static constexpr auto triangle = MakeStaticPolygon(0, 0, 10, 0, 5, 8);
+    template <size_t N>
+    struct StaticPolygon
+    {
+        std::array<Point, N> points;
+
+        constexpr size_t size() const { return N; }
+        constexpr Point *data() { return points.data(); }
+        constexpr const Point *data() const { return points.data(); }
+        constexpr const Point *begin() const { return points.data(); }
+        constexpr const Point *end() const { return points.data() + N; }
+        constexpr Point &operator[](size_t i) { return points[i]; }
+        constexpr const Point &operator[](size_t i) const { return points[i]; }
+    };
+
+    // The points of a Polygon, a StaticPolygon or an array, which the
+    // Drawer methods take without copying them.
+    class PolygonView
+    {
+    public:
+        constexpr PolygonView() {}
+        constexpr PolygonView(const Point *points, size_t size) : data_(points), size_(size) {}
+        PolygonView(const Polygon &polygon) : PolygonView(polygon.data(), polygon.size()) {}
+        PolygonView(const std::vector<Point> &points) : PolygonView(points.data(), points.size()) {}
+        template <size_t N>
+        constexpr PolygonView(const StaticPolygon<N> &polygon) : PolygonView(polygon.data(), N) {}
+        template <size_t N>
+        constexpr PolygonView(const std::array<Point, N> &points) : PolygonView(points.data(), N) {}
+        // For passing a braced list of points to a call. The view must not
+        // outlive the call.
+        constexpr PolygonView(std::initializer_list<Point> points) : PolygonView(points.begin(), points.size()) {}
+
+        constexpr const Point *data() const { return data_; }
+        constexpr size_t size() const { return size_; }
+        constexpr bool empty() const { return size_ == 0; }
+        constexpr const Point *begin() const { return data_; }
+        constexpr const Point *end() const { return data_ + size_; }
+        constexpr const Point &operator[](size_t i) const { return data_[i]; }
+        constexpr const Point &front() const { return data_[0]; }
+        constexpr const Point &back() const { return data_[size_ - 1]; }
+
+    private:
+        const Point *data_ = nullptr;
+        size_t size_ = 0;
+    };
 
     template <typename... Int>
-    constexpr Polygon MakePolygon(Int... ints)
+    constexpr StaticPolygon<sizeof...(Int) / 2> MakeStaticPolygon(Int... ints)
     {
         constexpr size_t num_ints = sizeof...(ints);
         static_assert(num_ints % 2 == 0,
                       "The number of parameters must be even (x0, y0, x1, y1, x2, y2, ...).");
-        std::array<int, num_ints> int_array{ints...};
-        Polygon polygon;
-        polygon.reserve(num_ints / 2);
+        const std::array<int, num_ints> int_array{static_cast<int>(ints)...};
+        StaticPolygon<num_ints / 2> polygon{};
         for (size_t i = 0; i < num_ints / 2; i++)
         {
-            polygon.emplace_back(int_array[i * 2], int_array[i * 2 + 1]);
+            polygon[i] = Point(int_array[i * 2], int_array[i * 2 + 1]);
         }
         return polygon;
     }
 
+    template <typename... Int>
+    Polygon MakePolygon(Int... ints)
+    {
+        const auto points = MakeStaticPolygon(ints...);
+        return Polygon(points.begin(), points.end());
+    }
+
     struct TransformType
     {
         float cw_rot_deg = 0;
@@ -87,6 +284,121 @@ namespace bgi
         int translate_y = 0;
     };
 
+    // An affine transformation, which moves (x, y) to
+    // (a * x + b * y + tx, c * x + d * y + ty), rounded to integers.
+    struct Affine
+    {
+        float a = 1;
+        float b = 0;
+        float c = 0;
+        float d = 1;
+        float tx = 0;
+        float ty = 0;
+
+        static Affine Translate(float x, float y);
+        static Affine Scale(float x, float y);
+        // Rotates clockwise (as y points down) by `cw_rot_deg` degrees.
+        static Affine Rotate(float cw_rot_deg);
+        // Like Transform(polygon, transform): rotates, scales and then
+        // translates. Points may end up a pixel off from Transform(), which
+        // rounds before translating.
+        static Affine FromTransform(const TransformType &transform);
+        // Like MirrorHoriz() and MirrorVert().
+        static Affine MirrorHoriz(int mirror_x);
+        static Affine MirrorVert(int mirror_y);
+
+        // Returns the inverse transformation. Warns and returns the identity
+        // if there is none (the determinant is 0).
+        Affine Inverse() const;
+
+        Point Apply(const Point &point) const;
+        // Transforms `n` points from `src` to `dst`, which may be the same.
+        void Apply(const Point *src, size_t n, Point *dst) const;
+        // Transforms the points of `polygon` in place.
+        void Apply(Polygon &polygon) const;
+    };
+
+    // Composes two transformations: the result applies `second` after
+    // `first`, like the matrix product second * first.
+    Affine operator*(const Affine &second, const Affine &first);
+
+    // The spans of pixels that a filled shape covers, computed once and
+    // filled many times with Drawer::FillShape(), which skips the edge work.
+    // Copies share the spans.
+    class RasterizedShape
+    {
+    public:
+        // A run of n pixels from (x, y).
+        struct Span
+        {
+            int x;
+            int y;
+            int n;
+        };
+
+        // Like Drawer::FillPoly(polygon, transform), FillEllipse and
+        // FillRoundedRect, in drawer coordinates. Shapes are only
+        // rasterized within +-2^29.
+        static RasterizedShape FromPolygon(PolygonView polygon, const Affine &transform = Affine());
+        static RasterizedShape FromEllipse(int x, int y, int rx, int ry, int angle1 = 0, int angle2 = 360);
+        static RasterizedShape FromRoundedRect(int x, int y, int w, int h, int rx, int ry);
+
+        bool empty() const { return !spans_ || spans_->empty(); }
+        // Sorted by y, then x, and not overlapping.
+        const std::vector<Span> &spans() const;
+        // The bounding box of the spans.
+        const Rect &bounds() const { return bounds_; }
+
+    private:
+        explicit RasterizedShape(std::vector<Span> spans);
+
+        std::shared_ptr<const std::vector<Span>> spans_;
+        Rect bounds_;
+    };
+
+    // Rasterized shapes by their geometry, so that drawing a shape that did
+    // not change skips the edge work:
+    //
+    //     d.FillShape(cache.GetPolygon(shape, transform));
+    //
+    // When it holds `max_shapes` shapes, the cache is cleared. Not thread
+    // safe.
+    class ShapeCache
+    {
+    public:
+        explicit ShapeCache(size_t max_shapes = 1024) : max_shapes_(max_shapes) {}
+
+        RasterizedShape GetPolygon(PolygonView polygon, const Affine &transform = Affine());
+        RasterizedShape GetEllipse(int x, int y, int rx, int ry, int angle1 = 0, int angle2 = 360);
+        RasterizedShape GetRoundedRect(int x, int y, int w, int h, int rx, int ry);
+
+        void Clear() { shapes_.clear(); }
+        size_t size() const { return shapes_.size(); }
+        int64_t hits() const { return hits_; }
+        int64_t misses() const { return misses_; }
+
+    private:
+        // The kind of a shape and its parameters, floats as their bits.
+        using Key = std::vector<int32_t>;
+        struct Entry
+        {
+            Key key;
+            RasterizedShape shape;
+        };
+
+        // Looks up key_.
+        template <typename Rasterize>
+        RasterizedShape Get(const Rasterize &rasterize);
+
+        size_t max_shapes_;
+        // The key being looked up, reused so that lookups don't allocate.
+        Key key_;
+        // By the hash of their keys.
+        std::unordered_multimap<size_t, Entry> shapes_;
+        int64_t hits_ = 0;
+        int64_t misses_ = 0;
+    };
+
     struct Padding
     {
         int left;
@@ -103,14 +415,116 @@ namespace bgi
         int bottom;
     };
 
+    // A few rectangles covering the pixels changed since the last Clear().
+    //
+    // Overlapping or touching rectangles are merged, and when there are more
+    // than kMaxRects, the two whose union adds the least area are merged.
+    class DamageList
+    {
+    public:
+        static constexpr int kMaxRects = 8;
+
+        DamageList() : generation_(NextGeneration()) {}
+        // Copies get a generation of their own.
+        DamageList(const DamageList &other) : rects_(other.rects_), generation_(NextGeneration()) {}
+        DamageList &operator=(const DamageList &other)
+        {
+            rects_ = other.rects_;
+            generation_ = NextGeneration();
+            return *this;
+        }
+
+        void Add(const Rect &rect);
+        void Clear()
+        {
+            rects_.clear();
+            generation_ = NextGeneration();
+        }
+
+        bool empty() const { return rects_.empty(); }
+        const std::vector<Rect> &rects() const { return rects_; }
+        // Changes on every Clear(), and is different for every list. While it
+        // stays the same, the rects cover all changes since it was read.
+        uint64_t generation() const { return generation_; }
+
+    private:
+        static uint64_t NextGeneration();
+
+        std::vector<Rect> rects_;
+        uint64_t generation_;
+    };
+
+    // Allocates memory aligned to `Alignment` bytes.
+    template <typename T, size_t Alignment>
+    struct AlignedAllocator
+    {
+        using value_type = T;
+        template <typename U>
+        struct rebind
+        {
+            using other = AlignedAllocator<U, Alignment>;
+        };
+
+        AlignedAllocator() {}
+        template <typename U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+        T *allocate(size_t n)
+        {
+            return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+        }
+        void deallocate(T *p, size_t)
+        {
+            ::operator delete(p, std::align_val_t(Alignment));
+        }
+
+        template <typename U>
+        bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+        template <typename U>
+        bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+    };
+
+    // Pixels owned by someone else, for example a locked Window texture, a
+    // memory-mapped file or a part of a Surface. Rows start `stride` colors
+    // apart.
+    struct SurfaceView
+    {
+        SurfaceView()
+        {
+        }
+
+        SurfaceView(Color *pixels, int w, int h, int stride, DamageList *damage = nullptr)
+            : pixels(pixels), w(w), h(h), stride(stride), damage(damage)
+        {
+        }
+
+        Color *row(int y) const { return pixels + static_cast<ptrdiff_t>(y) * stride; }
+
+        // Returns the part of this view inside `rect`, sharing the pixels.
+        SurfaceView Sub(const Rect &rect) const;
+
+        Color *pixels = nullptr;
+        int w = 0;
+        int h = 0;
+        int stride = 0;
+        // Where Drawer records the changed regions, if not null.
+        DamageList *damage = nullptr;
+        // The position of this view in the coordinates of `damage`.
+        Point origin;
+    };
+
     struct Surface
     {
+        // Every row starts at a multiple of this many bytes.
+        static constexpr int kRowAlignment = 64;
+        using Pixels = std::vector<Color, AlignedAllocator<Color, kRowAlignment>>;
+
         Surface()
         {
         }
 
         Surface(int w, int h)
-            : pixels(w * h), w(w), h(h)
+            : pixels(static_cast<size_t>(AlignedStride(w)) * h), w(w), h(h), stride(AlignedStride(w))
         {
         }
 
@@ -119,16 +533,55 @@ namespace bgi
         {
         }
 
-        std::vector<Color> pixels;
+        // Returns the smallest stride at least `w` colors long that keeps the
+        // rows aligned.
+        static constexpr int AlignedStride(int w)
+        {
+            constexpr int colors = kRowAlignment / sizeof(Color);
+            return (w + colors - 1) / colors * colors;
+        }
+
+        Color *row(int y) { return pixels.data() + static_cast<ptrdiff_t>(y) * stride; }
+        const Color *row(int y) const { return pixels.data() + static_cast<ptrdiff_t>(y) * stride; }
+
+        operator SurfaceView() { return SurfaceView(pixels.data(), w, h, stride, &damage); }
+
+        // `stride` * `h` colors, the padding at the end of the rows included.
+        Pixels pixels;
         int w = 0;
         int h = 0;
+        int stride = 0;
+        // The regions changed by Drawer since the last Window::Update. Add
+        // to it when changing `pixels` directly.
+        DamageList damage;
+    };
+
+    class ThreadPool;
+    class TileRenderer;
+    class DisplayList;
+
+    // How Drawer combines the colors it draws with the surface.
+    enum class BlendMode
+    {
+        // Stores the colors, alpha included.
+        kCopy,
+        // Draws the colors over the surface by their alpha, treating the
+        // surface as premultiplied (which opaque colors are). Opaque colors
+        // are stored as in kCopy, fully transparent ones draw nothing.
+        kSourceOver,
     };
 
     class Drawer final
     {
     public:
-        explicit Drawer(Surface &surface);
-        Drawer(Surface &surface, const Rect &viewport);
+        explicit Drawer(const SurfaceView &surface);
+        Drawer(const SurfaceView &surface, const Rect &viewport);
+        // Draws into the surface of `renderer`, in deferred mode: the calls
+        // are only queued, and TileRenderer::Flush() draws them.
+        explicit Drawer(TileRenderer &renderer);
+        // Records the calls into `list`, which is drawn as the surface, in
+        // recording mode. GetPixel() returns Black.
+        explicit Drawer(DisplayList &list);
         ~Drawer();
 
         Drawer Viewport(int x, int y, int w, int h);
@@ -143,22 +596,43 @@ namespace bgi
         void FillRoundedRect(int x, int y, int w, int h, int rx, int ry);
         // TODO:
         // PointPair GetEllipticalArcEndpoints(int x, int y, int rx, int ry, int angle1 = 0, int angle2 = 360);
+        // Arcs and pie sectors go counter-clockwise from angle1 to angle2 (in
+        // degrees); they wrap around if angle2 < angle1.
         void DrawEllipse(int x, int y, int rx, int ry, int angle1 = 0, int angle2 = 360);
         void FillEllipse(int x, int y, int rx, int ry, int angle1 = 0, int angle2 = 360);
         void DrawLine(int x1, int y1, int x2, int y2);
-        void DrawOpenPoly(const Polygon &polygon);
-        void DrawPoly(const Polygon &polygon);
-        void FillPoly(const Polygon &polygon);
+        void DrawOpenPoly(PolygonView polygon);
+        void DrawPoly(PolygonView polygon);
+        void FillPoly(PolygonView polygon);
+        // Draw `polygon` moved by `transform`. The points are transformed
+        // into a thread_local std::vector<Point>, which is reused, so only
+        // the first calls with that many points allocate.
+        void DrawPoly(PolygonView polygon, const Affine &transform);
+        void FillPoly(PolygonView polygon, const Affine &transform);
+        // Fills the spans of `shape` with the fill style.
+        void FillShape(const RasterizedShape &shape);
+        // Copies the `src` rect of `surface` to (x, y), a row at a time. The
+        // rect is clipped to `surface`, and the copy to the clip rect. The
+        // blend mode doesn't apply. In deferred mode `surface` must not
+        // change until TileRenderer::Flush(), unless it is the surface drawn
+        // to: then the queued calls are drawn and the rect is copied first.
+        void Blit(const Surface &surface, const Rect &src, int x, int y);
+        // Like Blit(), but skips the pixels of color `key`.
+        void BlitKeyed(const Surface &surface, const Rect &src, int x, int y, Color key);
+        // Like Blit(), but draws the pixels over the surface by their alpha,
+        // as in BlendMode::kSourceOver. `surface` must be premultiplied, like
+        // one drawn in kSourceOver over transparent black.
+        void BlitBlended(const Surface &surface, const Rect &src, int x, int y);
 
-        template <typename... Int>
+        template <typename... Int, typename = std::enable_if_t<(std::is_integral_v<Int> && ...)>>
         void FillPoly(Int... ints)
         {
-            FillPoly(MakePolygon(ints...));
+            FillPoly(MakeStaticPolygon(ints...));
         }
-        template <typename... Int>
+        template <typename... Int, typename = std::enable_if_t<(std::is_integral_v<Int> && ...)>>
         void DrawPoly(Int... ints)
         {
-            DrawPoly(MakePolygon(ints...));
+            DrawPoly(MakeStaticPolygon(ints...));
         }
 
         Rect GetTextRect(int x, int y, std::string_view text);
@@ -169,22 +643,61 @@ namespace bgi
         void SetFillStyle(Color c);
         void SetFillStyle(FillPattern pattern, Color bg, Color fg);
         void SetWriteStyle(Color c, int scale_x = 1, int scale_y = 1);
+        // Applies to fills, lines, text and SetPixel(), but not to Clear(),
+        // which always stores the color. Each call blends a pixel once, also
+        // where the lines of DrawRect(), DrawRoundedRect() and the polys
+        // meet; separate calls that overlap blend it again.
+        void SetBlendMode(BlendMode mode) { blend_mode_ = mode; }
+        // Splits large Clear() and FillRect() calls into row ranges drawn on
+        // the threads of `pool`. nullptr (the default) draws on the calling
+        // thread.
+        void SetThreadPool(ThreadPool *pool) { thread_pool_ = pool; }
 
         int width() const { return viewport_.w; }
         int height() const { return viewport_.h; }
         Size size() const { return {viewport_.w, viewport_.h}; }
 
     private:
-        // Draws an 8x8 bitmap character.
-        void DrawBitmapChar(int x, int y, char c);
+        class SpanFiller;
+        class PixelWriter;
+        friend class TileRenderer;
+        friend class DisplayList;
+
+        enum class BlitMode : uint8_t
+        {
+            kCopy,
+            kKeyed,
+            kBlended,
+        };
+
         Color *GetPixelPtr(int x, int y) const;
+        // Returns a span filler for the current fill style.
+        SpanFiller GetSpanFiller() const;
+        // Returns a pixel writer for `c` with the blend mode.
+        PixelWriter GetPixelWriter(Color c) const;
         void SetPixelWithFillPattern(int x, int y);
+        // Blit(), BlitKeyed() or BlitBlended(); `key` is for kKeyed.
+        void BlitWithMode(const Surface &surface, const Rect &src, int x, int y, BlitMode mode, Color key);
+        void AddDamage(const Rect &rect);
+        // Queues `draw` on the tiles that `bounds` overlaps, in deferred mode.
+        void Defer(const Rect &bounds, std::function<void(Drawer &)> draw) const;
+        // Draws an outline made of lines or arcs that meet at shared pixels,
+        // blending each pixel once: rasterize(draw_pixel) reports the pixels
+        // within `bounds`, and redraw(drawer) draws the outline again on a
+        // tile in deferred mode. Returns the number of pixels drawn.
+        template <typename Rasterize, typename Redraw>
+        int64_t BlendOutline(const Rect &bounds, const Rasterize &rasterize, const Redraw &redraw);
 
         static std::array<FillPattern, 256> bitmap_font_;
 
-        Surface *surface_ = nullptr;
+        SurfaceView surface_;
         Rect viewport_ = {};
         Rect clip_ = {};
+        // Not null in deferred mode.
+        TileRenderer *tiles_ = nullptr;
+        // Not null in recording mode.
+        DisplayList *list_ = nullptr;
+        ThreadPool *thread_pool_ = nullptr;
 
         // Drawing state.
         Color draw_color_ = basic_colors::White;
@@ -194,13 +707,18 @@ namespace bgi
         Color write_color_ = basic_colors::White;
         int write_scale_x_ = 1;
         int write_scale_y_ = 1;
+        BlendMode blend_mode_ = BlendMode::kCopy;
     };
 
     // Helper functions:
 
-    inline int Round(float f)
+    // Rounds halfway cases away from zero, like std::round(), which is not
+    // constexpr.
+    inline constexpr int Round(float f)
     {
-        return static_cast<int>(std::round(f));
+        const int truncated = static_cast<int>(f);
+        const float fraction = f - static_cast<float>(truncated);
+        return fraction >= 0.5f ? truncated + 1 : fraction <= -0.5f ? truncated - 1 : truncated;
     }
 
     inline float Float(int i)
@@ -308,11 +826,154 @@ namespace bgi
 
     Polygon Transform(const Polygon &polygon, float cw_rot_deg = 0, float scale_x = 1, float scale_y = 1, int translate_x = 0, int translate_y = 0);
     Polygon Transform(const Polygon &polygon, const TransformType &transform);
+    Polygon Transform(const Polygon &polygon, const Affine &transform);
     Polygon MirrorHoriz(const Polygon &polygon, int mirror_x);
     Polygon MirrorHorizConcat(const Polygon &polygon, int mirror_x);
     Polygon MirrorVert(const Polygon &polygon, int mirror_y);
     Polygon MakeEllipticalArc(int x, int y, int rx, int ry, int angle1 = 0, int angle2 = 360);
 
+    // Transforms `n` points in place, like Transform(). Can run at compile
+    // time, except with a rotation (std::cos and std::sin are not constexpr).
+    constexpr void TransformPoints(Point *points, size_t n, const TransformType &transform)
+    {
+        const float cw_rot_deg = transform.cw_rot_deg;
+        const float scale_x = transform.scale_x;
+        const float scale_y = transform.scale_y;
+        const int translate_x = transform.translate_x;
+        const int translate_y = transform.translate_y;
+        if (cw_rot_deg != 0.0f)
+        {
+            const float rad = 0.01745329252f * cw_rot_deg;
+            const float cosine = std::cos(rad);
+            const float sine = std::sin(rad);
+            for (size_t i = 0; i < n; i++)
+            {
+                const Point p = points[i];
+                points[i] = {Round((p.x * cosine - p.y * sine) * scale_x) + translate_x,
+                             Round((p.x * sine + p.y * cosine) * scale_y) + translate_y};
+            }
+        }
+        else if (scale_x != 1.0f || scale_y != 1.0f)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                const Point p = points[i];
+                points[i] = {Round(p.x * scale_x) + translate_x,
+                             Round(p.y * scale_y) + translate_y};
+            }
+        }
+        else if (translate_x != 0 || translate_y != 0)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                points[i] = {points[i].x + translate_x, points[i].y + translate_y};
+            }
+        }
+    }
+
+    // Compile-time versions of the functions above, for StaticPolygon.
+
+    template <size_t N>
+    constexpr StaticPolygon<N> Transform(const StaticPolygon<N> &polygon, const TransformType &transform)
+    {
+        StaticPolygon<N> result = polygon;
+        TransformPoints(result.data(), N, transform);
+        return result;
+    }
+
+    template <size_t N>
+    constexpr StaticPolygon<N> MirrorHoriz(const StaticPolygon<N> &polygon, int mirror_x)
+    {
+        return Transform(polygon, TransformType{0, -1, 1, 2 * mirror_x, 0});
+    }
+
+    template <size_t N>
+    constexpr StaticPolygon<N> MirrorVert(const StaticPolygon<N> &polygon, int mirror_y)
+    {
+        return Transform(polygon, TransformType{0, 1, -1, 0, 2 * mirror_y});
+    }
+
+    template <size_t N>
+    constexpr StaticPolygon<2 * N> MirrorHorizConcat(const StaticPolygon<N> &polygon, int mirror_x)
+    {
+        const StaticPolygon<N> mirrored = MirrorHoriz(polygon, mirror_x);
+        StaticPolygon<2 * N> result{};
+        for (size_t i = 0; i < N; i++)
+        {
+            result[i] = polygon[i];
+            result[2 * N - 1 - i] = mirrored[i];
+        }
+        return result;
+    }
+
+    // Instrumentation:
+    //
+    // If the library is built with BGI_INSTRUMENTATION defined, every Drawer
+    // call and every frame presented to a window is measured. Otherwise the
+    // measuring code is compiled out and the statistics stay zero.
+
+    // The Drawer methods that are measured.
+    enum class Primitive
+    {
+        kSetPixel,
+        kClear,
+        kDrawRect,
+        kFillRect,
+        kDrawRoundedRect,
+        kFillRoundedRect,
+        kDrawEllipse,
+        kFillEllipse,
+        kDrawLine,
+        kDrawOpenPoly,
+        kDrawPoly,
+        kFillPoly,
+        kWrite,
+        kWriteEx,
+        kFillShape,
+        kBlit,
+        kCount,
+    };
+
+    const char *GetPrimitiveName(Primitive primitive);
+
+    struct PrimitiveStats
+    {
+        int64_t calls = 0;
+        // The pixels visited by the rasterizer: spans of fills and text,
+        // points of lines and outlines.
+        int64_t pixels_written = 0;
+        // The area of the bounding boxes cut off by clipping.
+        int64_t pixels_clipped = 0;
+        // The time spent in the calls, summed over threads. Includes the time
+        // of the calls a composite call (like DrawRect or WriteEx) makes,
+        // which are also counted separately.
+        std::chrono::nanoseconds time{0};
+    };
+
+    struct Stats
+    {
+        const PrimitiveStats &operator[](Primitive primitive) const { return primitives[static_cast<int>(primitive)]; }
+
+        std::array<PrimitiveStats, static_cast<int>(Primitive::kCount)> primitives;
+
+        // Frames presented by Window and OffscreenWindow.
+        int64_t frames = 0;
+        // Copying the surfaces to the windows, summed over the frames and in
+        // the last frame.
+        std::chrono::nanoseconds upload_time{0};
+        std::chrono::nanoseconds last_upload_time{0};
+        // Presenting the frames.
+        std::chrono::nanoseconds present_time{0};
+        std::chrono::nanoseconds last_present_time{0};
+    };
+
+    // Whether the library is built with BGI_INSTRUMENTATION.
+    bool IsInstrumented();
+    // Returns the statistics collected since the start or since the last
+    // ResetStats().
+    Stats GetStats();
+    void ResetStats();
+
     // Classes:
 
     class NonCopyable
@@ -324,6 +985,256 @@ namespace bgi
         NonCopyable &operator=(const NonCopyable &) = delete;
     };
 
+    // Memory for short-lived polygons, such as the ones drawn in one frame,
+    // which is all freed at once:
+    //
+    //     PolygonArena arena;
+    //     for (;;)
+    //     {
+    //         PolygonArena::Scope scope(arena);
+    //         d.FillPoly(Transform(shape, transform));
+    //         ...
+    //     }
+    //
+    // While a Scope is alive, the polygons created on its thread that do not
+    // fit in place take their memory from the arena, and the end of the
+    // Scope frees it. So these polygons must not outlive the Scope, in a
+    // static variable for example. The copies that Drawer keeps (in a
+    // TileRenderer) never use the arena.
+    class PolygonArena : private NonCopyable
+    {
+    public:
+        // Allocates blocks of `block_size` bytes (or more, for large
+        // polygons), which are kept for reuse until the arena is destroyed.
+        explicit PolygonArena(size_t block_size = 64 * 1024);
+
+        // Makes `arena` the active arena of this thread until the Scope is
+        // destroyed. Then the previous arena becomes active again, and
+        // `arena` is reset.
+        class Scope : private NonCopyable
+        {
+        public:
+            explicit Scope(PolygonArena &arena);
+            ~Scope() override;
+
+        private:
+            PolygonArena &arena_;
+            PolygonArena *previous_;
+        };
+
+        // The active arena of this thread, or null.
+        static PolygonArena *active();
+
+        // Returns `bytes` bytes aligned for a Point.
+        void *Allocate(size_t bytes);
+        // Frees everything allocated since the last Reset().
+        void Reset();
+
+        size_t bytes_allocated() const { return bytes_allocated_; }
+
+    private:
+        struct Block
+        {
+            std::unique_ptr<unsigned char[]> memory;
+            size_t size = 0;
+        };
+
+        size_t block_size_;
+        std::vector<Block> blocks_;
+        // The block being allocated from, and its used bytes.
+        size_t block_ = 0;
+        size_t offset_ = 0;
+        size_t bytes_allocated_ = 0;
+    };
+
+    // A fixed set of worker threads for running loops in parallel.
+    class ThreadPool : private NonCopyable
+    {
+    public:
+        // Uses `threads` threads, the calling thread included, or one per
+        // hardware thread if `threads` is 0.
+        explicit ThreadPool(int threads = 0);
+        ~ThreadPool() override;
+
+        int size() const { return static_cast<int>(workers_.size()) + 1; }
+
+        // Calls f(i) for each 0 <= i < n on the threads of the pool, and
+        // returns when all the calls have returned. Must not be called from
+        // several threads at the same time.
+        void ParallelFor(int n, const std::function<void(int)> &f);
+
+    private:
+        void Work();
+        void RunJob();
+
+        std::vector<std::thread> workers_;
+        std::mutex mutex_;
+        std::condition_variable start_;
+        std::condition_variable done_;
+        // The current job, guarded by mutex_.
+        const std::function<void(int)> *job_ = nullptr;
+        int job_size_ = 0;
+        int generation_ = 0;
+        int running_ = 0;
+        bool quit_ = false;
+        std::atomic<int> next_{0};
+    };
+
+    // Draws in parallel on several threads.
+    //
+    // The calls of a Drawer created from a TileRenderer are only queued, on
+    // the kTileSize x kTileSize tiles of the surface that their bounding
+    // boxes overlap. Flush() then draws each tile on one thread, clipped to
+    // the tile, in the order of the calls. The result is the same as drawing
+    // right away. GetPixel() returns the pixels as of the last Flush().
+    class TileRenderer : private NonCopyable
+    {
+    public:
+        static constexpr int kTileSize = 128;
+
+        // Uses `threads` threads (the one calling Flush() included), or one
+        // per hardware thread if `threads` is 0.
+        explicit TileRenderer(const SurfaceView &surface, int threads = 0);
+        // Flushes.
+        ~TileRenderer() override;
+
+        // Draws the queued calls and returns when they are done.
+        void Flush();
+
+        const SurfaceView &surface() const { return surface_; }
+
+    private:
+        friend class Drawer;
+
+        struct Command
+        {
+            Drawer drawer;
+            std::function<void(Drawer &)> draw;
+        };
+
+        SurfaceView surface_;
+        int tiles_x_ = 0;
+        int tiles_y_ = 0;
+        std::vector<Command> commands_;
+        // The indices of the commands that overlap each tile.
+        std::vector<std::vector<uint32_t>> bins_;
+        std::unique_ptr<ThreadPool> pool_;
+    };
+
+    // A sequence of Drawer calls recorded in a compact binary form, to be
+    // drawn many times:
+    //
+    //     DisplayList list(200, 100);
+    //     Drawer recorder(list);
+    //     recorder.SetFillStyle(Blue);
+    //     recorder.FillRect(10, 10, 50, 20);
+    //     list.Optimize();
+    //     list.Replay(d, 300, 200);
+    //
+    // The calls are replayed with the styles, viewports and clip rects that
+    // they were recorded with, so they look the same in any drawer.
+    class DisplayList
+    {
+    public:
+        DisplayList(int w, int h);
+        explicit DisplayList(const Size &size);
+
+        // Draws the calls with `drawer`, moved by (dx, dy) in its viewport.
+        // They are clipped to the size of the list and to the clip rect of
+        // `drawer`, and also to `clip` (in the coordinates of `drawer`) if
+        // given.
+        void Replay(Drawer drawer, int dx = 0, int dy = 0) const;
+        void Replay(Drawer drawer, int dx, int dy, const Rect &clip) const;
+
+        // Merges adjacent FillRect() calls, and drops the calls that a later
+        // opaque Clear() or FillRect(), or a Blit(), covers. Replaying draws
+        // the same.
+        void Optimize();
+
+        void Clear();
+        bool empty() const { return calls_ == 0; }
+        // The number of recorded calls.
+        size_t size() const { return calls_; }
+        // The size of the encoded calls.
+        size_t bytes() const { return words_.size() * sizeof(uint32_t); }
+        int width() const { return size_.w; }
+        int height() const { return size_.h; }
+
+    private:
+        friend class Drawer;
+
+        enum class Op : uint8_t
+        {
+            // Changes of the state of the drawer.
+            kDrawStyle,
+            kFillStyle,
+            kWriteStyle,
+            kViewport,
+            kBlendMode,
+            // Calls.
+            kSetPixel,
+            kClear,
+            kDrawRect,
+            kFillRect,
+            kDrawRoundedRect,
+            kFillRoundedRect,
+            kDrawEllipse,
+            kFillEllipse,
+            kDrawLine,
+            kDrawOpenPoly,
+            kDrawPoly,
+            kFillPoly,
+            kDrawPolyAffine,
+            kFillPolyAffine,
+            kFillShape,
+            kBlit,
+            kWrite,
+            kWriteEx,
+        };
+
+        // The state of a drawer that the calls depend on. The viewport and
+        // clip rect are relative to the list.
+        struct State
+        {
+            Color draw_color = basic_colors::White;
+            Color fill_bg_color = basic_colors::White;
+            Color fill_fg_color = basic_colors::White;
+            FillPattern fill_pattern = basic_fill_patterns::SolidBg;
+            Color write_color = basic_colors::White;
+            int write_scale_x = 1;
+            int write_scale_y = 1;
+            BlendMode blend_mode = BlendMode::kCopy;
+            Rect viewport;
+            Rect clip;
+        };
+
+        // Appends a call of `drawer`, after the changes of its state since
+        // the last call. `args`, `points` and `text` are stored in this
+        // order.
+        void Record(const Drawer &drawer, Op op, std::initializer_list<int> args,
+                    PolygonView points = PolygonView(), std::string_view text = std::string_view());
+        // Returns the argument of a kFillShape call.
+        int AddShape(const RasterizedShape &shape);
+        // Returns the image argument of a kBlit call.
+        int AddImage(Surface image);
+        // Appends the changes from state_ to `state`, and sets state_.
+        void RecordState(const State &state);
+        void Append(Op op, std::initializer_list<uint32_t> args);
+        // Applies the command if it changes the state.
+        static bool ApplyState(State &state, Op op, const uint32_t *args);
+
+        Size size_;
+        // Each command is a word with its Op in the low 8 bits and the number
+        // of words of its arguments above, then the arguments.
+        std::vector<uint32_t> words_;
+        std::vector<RasterizedShape> shapes_;
+        // The blitted rects, copied when recorded.
+        std::vector<Surface> images_;
+        // The state after the recorded commands.
+        State state_;
+        size_t calls_ = 0;
+    };
+
     struct KeyPress
     {
         bool should_quit = false;
@@ -335,6 +1246,16 @@ namespace bgi
         SDL_Scancode scancode = SDL_SCANCODE_UNKNOWN;
     };
 
+    enum class AppMode
+    {
+        // Uses SDL video, so Windows and key presses work.
+        kWindowed,
+        // Does not use SDL video, so it works without a display. Surfaces,
+        // Drawers and OffscreenWindows work, Windows do not, and there are
+        // no key presses.
+        kHeadless,
+    };
+
     class App : private NonCopyable
     {
     public:
@@ -342,8 +1263,12 @@ namespace bgi
         // int main(int argc, char *argv[])
         App();
         explicit App(int random_seed);
+        explicit App(AppMode mode);
+        App(AppMode mode, int random_seed);
         ~App() override;
 
+        bool headless() const { return mode_ == AppMode::kHeadless; }
+
         int Random(int exclusive_upper_limit);
         // TODO: maybe remove
         Color RandomRgbColor();
@@ -352,17 +1277,40 @@ namespace bgi
         // TODO: better
         KeyPress WaitKeyPress(bool auto_quit = true);
         bool PollKeyPress(KeyPress &key_press, bool auto_quit = true);
+
+        // A pool with one thread per hardware thread, created on first use.
+        ThreadPool &thread_pool();
+
+    private:
+        AppMode mode_;
+        std::unique_ptr<ThreadPool> thread_pool_;
     };
 
     class Window : private NonCopyable
     {
     public:
-        Window(std::string_view title, int w = 800, int h = 600);
+        // With `vsync`, presenting waits for the display's vertical sync,
+        // which caps the frame rate at its refresh rate.
+        Window(std::string_view title, int w = 800, int h = 600, bool vsync = true);
         ~Window() override;
 
+        // Uploads the damaged regions of `surface` and presents the window.
+        // All of it is uploaded when the window last showed another surface,
+        // or when something else cleared the damage since. Clears the damage.
         // TODO: show only after update?
+        void Update(Surface &surface);
+        // Like Update(Surface &), but keeps the damage, so the next update of
+        // the same surface uploads it again.
         void Update(const Surface &surface);
 
+        // Locks the window's texture and returns a view of it, so that a
+        // Drawer can render straight into it without going through a
+        // Surface. The previous contents are not kept: draw the whole frame,
+        // then call Present().
+        SurfaceView Lock();
+        // Unlocks the texture locked by Lock() and presents it.
+        void Present();
+
         int width() const { return size().w; }
         int height() const { return size().h; }
         Size size() const
@@ -376,12 +1324,220 @@ namespace bgi
             return SDL_GetWindowFlags(window_) & SDL_WINDOW_FULLSCREEN_DESKTOP;
         }
         void set_fullscreen(bool full_screen);
+        bool vsync() const { return vsync_; }
 
     private:
+        void Render();
+
         // TODO: Try unique_ptr with custom deleter?
         SDL_Window *window_ = nullptr;
         SDL_Renderer *renderer_ = nullptr;
         SDL_Texture *texture_ = nullptr;
+        // The surface uploaded last and the generation of its damage then,
+        // or nullptr if the texture doesn't hold a surface.
+        const Surface *last_surface_ = nullptr;
+        uint64_t last_generation_ = 0;
+        bool locked_ = false;
+        bool vsync_ = true;
+    };
+
+    // A window that is never shown, for servers without a display and for
+    // benchmarks. It works like a Window, but keeps the frames in memory and
+    // records how long they took instead of presenting them.
+    class OffscreenWindow : private NonCopyable
+    {
+    public:
+        explicit OffscreenWindow(int w = 800, int h = 600);
+
+        // Copies the damaged regions of `surface` to frame(), like
+        // Window::Update(), but skips the frame if there is nothing to copy.
+        void Update(Surface &surface);
+        void Update(const Surface &surface);
+        // Like Window::Lock() and Window::Present(), drawing straight into
+        // frame().
+        SurfaceView Lock();
+        void Present();
+
+        int width() const { return frame_.w; }
+        int height() const { return frame_.h; }
+        Size size() const { return {frame_.w, frame_.h}; }
+
+        // The last frame.
+        const Surface &frame() const { return frame_; }
+        // The time between consecutive frames. The first one is measured
+        // from the construction of the window.
+        const std::vector<std::chrono::nanoseconds> &frame_times() const { return frame_times_; }
+
+    private:
+        void EndFrame();
+
+        Surface frame_;
+        // As in Window.
+        const Surface *last_surface_ = nullptr;
+        uint64_t last_generation_ = 0;
+        bool locked_ = false;
+        std::chrono::steady_clock::time_point last_frame_time_;
+        std::vector<std::chrono::nanoseconds> frame_times_;
+    };
+
+    // Overlaps drawing the next frame with uploading and presenting (and
+    // waiting for the vsync of) the previous ones, on two threads. Either
+    // the frames are presented on a thread of the chain:
+    //
+    //     SwapChain chain(offscreen_window);
+    //     for (;;)
+    //     {
+    //         Drawer d(chain.Acquire());
+    //         Draw(d);
+    //         chain.Submit();
+    //     }
+    //
+    // or, for a Window, whose SDL renderer belongs to the thread that
+    // created it, they are drawn on a thread of the chain and presented on
+    // the window's thread:
+    //
+    //     SwapChain chain(window, [&](Surface &surface)
+    //                     { Drawer d(surface); Draw(d); });
+    //     for (;;)
+    //     {
+    //         chain.Present();
+    //     }
+    //
+    // The frames are drawn into `buffers` surfaces in turn. Like with
+    // Window::Lock(), a surface does not hold the previous frame, so every
+    // frame has to be drawn whole.
+    class SwapChain : private NonCopyable
+    {
+    public:
+        using PresentFunction = std::function<void(Surface &)>;
+        using DrawFunction = std::function<void(Surface &)>;
+
+        // Calls `present` on the presenter thread for each frame. Acquire()
+        // waits for a buffer that is not submitted or being presented, and
+        // while more than `max_latency` frames are (at most, and by default,
+        // buffers - 1, so that 2 buffers draw one frame while the previous
+        // one is presented).
+        SwapChain(Size size, PresentFunction present, int buffers = 2, int max_latency = 0);
+        // Presents with window.Update() on the presenter thread.
+        explicit SwapChain(OffscreenWindow &window, int buffers = 2, int max_latency = 0);
+        // Calls `draw` for each frame on the drawing thread, which waits for
+        // buffers like Acquire(), and `present` in Present().
+        SwapChain(Size size, PresentFunction present, DrawFunction draw, int buffers = 2, int max_latency = 0);
+        // Presents with window.Update() in Present().
+        SwapChain(Window &window, DrawFunction draw, int buffers = 2, int max_latency = 0);
+        // Presents the submitted frames, or stops drawing.
+        ~SwapChain() override;
+
+        // Without a draw function: waits until a buffer is free and returns
+        // it.
+        Surface &Acquire();
+        // Queues the buffer returned by Acquire() for presenting.
+        void Submit();
+        // Waits until the submitted frames are presented.
+        void Wait();
+        // With a draw function: waits for the next frame drawn and presents
+        // it on the calling thread.
+        void Present();
+
+        int buffers() const { return static_cast<int>(surfaces_.size()); }
+        int max_latency() const { return max_latency_; }
+        int64_t frames_presented() const;
+
+    private:
+        // Whether the next buffer may be drawn into. The buffers are used in
+        // turn, and the ones in flight are the last ones submitted, so the
+        // next one is free once fewer than buffers() frames are in flight.
+        // Separately, at most max_latency_ frames may wait while it is drawn.
+        bool CanAcquire() const { return in_flight_ < buffers() && in_flight_ <= max_latency_; }
+        // Queues the next buffer, with the mutex locked.
+        void Enqueue();
+        void PresentLoop();
+        void DrawLoop();
+
+        PresentFunction present_;
+        DrawFunction draw_;
+        std::vector<std::unique_ptr<Surface>> surfaces_;
+        int max_latency_ = 1;
+        bool acquired_ = false;
+
+        mutable std::mutex mutex_;
+        std::condition_variable condition_;
+        // The buffers submitted and not presented yet, oldest first.
+        std::vector<int> queue_;
+        // Frames submitted and not presented yet (including the one being
+        // presented).
+        int in_flight_ = 0;
+        int64_t frames_submitted_ = 0;
+        int64_t frames_presented_ = 0;
+        bool stopping_ = false;
+        // Runs PresentLoop(), or DrawLoop() with a draw function.
+        std::thread thread_;
+    };
+
+    // Runs the simulation of a game loop in fixed steps, whatever the frame
+    // rate, and paces the frames:
+    //
+    //     FrameLoop loop(FrameLoop::kDefaultStep, 60);
+    //     for (;;)
+    //     {
+    //         for (int i = loop.BeginFrame(); i > 0; i--)
+    //             Animate(state);
+    //         Draw(drawer, state);
+    //         window.Update(surface);
+    //         loop.EndFrame();
+    //     }
+    class FrameLoop
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        static constexpr std::chrono::nanoseconds kDefaultStep{1'000'000'000 / 60};
+        // A frame simulates at most this many steps and drops the rest of
+        // the time, so that a slow frame does not make the next ones slower.
+        static constexpr int kMaxStepsPerFrame = 8;
+        // Waiting for a frame sleeps, except for this last part, which spins
+        // since sleeping can overshoot by about that much.
+        static constexpr std::chrono::nanoseconds kSpinTime{1'000'000};
+        // The number of frames that FrameTimePercentile() looks at.
+        static constexpr int kFrameTimeHistory = 1024;
+
+        // Simulates in steps of `step` and shows at most `max_fps` frames per
+        // second, or as many as possible (or as the vsync allows) if it is 0.
+        explicit FrameLoop(std::chrono::nanoseconds step = kDefaultStep, double max_fps = 0);
+
+        // Waits until the next frame is due and returns how many steps to
+        // simulate before drawing it.
+        int BeginFrame();
+        // Records the time since the end of the previous frame.
+        void EndFrame();
+
+        std::chrono::nanoseconds step() const { return step_; }
+        double max_fps() const { return max_fps_; }
+        void set_max_fps(double max_fps);
+
+        // The part of a step that is due but not simulated yet, from 0 to 1,
+        // for drawing between the last two steps.
+        double alpha() const { return static_cast<double>(pending_.count()) / step_.count(); }
+        // The simulated time: the number of steps times the step.
+        std::chrono::nanoseconds simulated_time() const { return simulated_time_; }
+        int64_t frames() const { return frames_; }
+
+        // Returns the `percentile` (from 0 to 100) of the durations of the
+        // last kFrameTimeHistory frames, or 0 if there were none.
+        std::chrono::nanoseconds FrameTimePercentile(double percentile) const;
+
+    private:
+        std::chrono::nanoseconds step_;
+        double max_fps_ = 0;
+        std::chrono::nanoseconds frame_period_{0};
+        Clock::time_point next_frame_;
+        Clock::time_point last_step_;
+        Clock::time_point last_frame_end_;
+        std::chrono::nanoseconds pending_{0};
+        std::chrono::nanoseconds simulated_time_{0};
+        int64_t frames_ = 0;
+        // A ring of the last frame times.
+        std::vector<std::chrono::nanoseconds> frame_times_;
     };
 
     // Original BGI colors.
@@ -1,7 +1,15 @@
 #include "bgi2.h"
+#include "bgi2_spans.h"
 
 #include <algorithm>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
@@ -41,203 +49,642 @@ namespace bgi
 {
     namespace
     {
-        void Crop(int &x, int &y, int &w, int &h, int sw, int sh)
+        // Returns the intersection of `a` and `b`, which is empty (0 x 0) if
+        // they do not overlap.
+        Rect Intersect(const Rect &a, const Rect &b)
         {
-            if (x < 0)
+            const int x1 = std::max(a.x, b.x);
+            const int y1 = std::max(a.y, b.y);
+            const int64_t x2 = std::min(int64_t{a.x} + a.w, int64_t{b.x} + b.w);
+            const int64_t y2 = std::min(int64_t{a.y} + a.h, int64_t{b.y} + b.h);
+            if (x2 <= x1 || y2 <= y1)
             {
-                w += x;
-                x = 0;
+                return Rect();
             }
-            if (y < 0)
-            {
-                h += y;
-                y = 0;
-            }
-            if (x + w > sw)
+            return Rect(x1, y1, Int(x2 - x1), Int(y2 - y1));
+        }
+
+        // The box [x1, x2] x [y1, y2], in 64 bits so that the bounds of
+        // shapes near the int limits do not overflow.
+        struct Box
+        {
+            int64_t x1;
+            int64_t y1;
+            int64_t x2;
+            int64_t y2;
+        };
+
+        bool IsOutside(const Box &box, const Rect &clip)
+        {
+            return box.x2 < clip.x || box.y2 < clip.y || box.x1 >= int64_t{clip.x} + clip.w || box.y1 >= int64_t{clip.y} + clip.h;
+        }
+
+        // Returns the part of `box` in `clip`, which is empty (0 x 0) if there
+        // is none.
+        Rect Intersect(const Box &box, const Rect &clip)
+        {
+            if (box.x1 > box.x2 || box.y1 > box.y2 || IsOutside(box, clip))
             {
-                w = sw - x;
+                return Rect();
             }
-            if (y + h > sh)
+            const int x1 = Int(std::max<int64_t>(box.x1, clip.x));
+            const int y1 = Int(std::max<int64_t>(box.y1, clip.y));
+            const int64_t x2 = std::min(box.x2 + 1, int64_t{clip.x} + clip.w);
+            const int64_t y2 = std::min(box.y2 + 1, int64_t{clip.y} + clip.h);
+            return Rect(x1, y1, Int(x2 - x1), Int(y2 - y1));
+        }
+
+        // Returns the bounding box of the `n` > 0 `points`, moved by (dx, dy).
+        Box BoundingBox(const Point *points, size_t n, int dx, int dy)
+        {
+            int xmin = points[0].x;
+            int xmax = points[0].x;
+            int ymin = points[0].y;
+            int ymax = points[0].y;
+            for (size_t i = 1; i < n; i++)
             {
-                h = sh - y;
+                xmin = std::min(xmin, points[i].x);
+                xmax = std::max(xmax, points[i].x);
+                ymin = std::min(ymin, points[i].y);
+                ymax = std::max(ymax, points[i].y);
             }
-            if (w <= 0 || h <= 0)
+            return {int64_t{xmin} + dx, int64_t{ymin} + dy, int64_t{xmax} + dx, int64_t{ymax} + dy};
+        }
+
+        Box BoundingBox(PolygonView polygon, int dx, int dy)
+        {
+            return BoundingBox(polygon.data(), polygon.size(), dx, dy);
+        }
+
+        // Returns the box of the rect (x, y, w, h).
+        Box RectBox(int x, int y, int w, int h)
+        {
+            return {x, y, int64_t{x} + w - 1, int64_t{y} + h - 1};
+        }
+
+        // Returns the bounding box of an ellipse. The midpoint rows can stick
+        // out of the radii by a pixel.
+        Box EllipseBox(int cx, int cy, int xradius, int yradius)
+        {
+            return {int64_t{cx} - xradius - 1, int64_t{cy} - yradius - 1,
+                    int64_t{cx} + xradius + 1, int64_t{cy} + yradius + 1};
+        }
+
+        // Rect fills of at least this many pixels are split across the
+        // thread pool of the drawer, if any. Smaller ones are not worth the
+        // synchronization.
+        constexpr int64_t kParallelFillPixels = 1 << 18;
+        // Solid rect fills of at least this many pixels (64 MiB) would flush
+        // the caches anyway, so they are done with non-temporal stores.
+        constexpr int64_t kStreamFillPixels = 1 << 24;
+
+        Box LineBox(int x1, int y1, int x2, int y2)
+        {
+            return {std::min(x1, x2), std::min(y1, y2), std::max(x1, x2), std::max(y1, y2)};
+        }
+
+        // The bits of `f`, for storing it in a DisplayList.
+        int FloatBits(float f)
+        {
+            int bits;
+            std::memcpy(&bits, &f, sizeof(bits));
+            return bits;
+        }
+
+        float BitsFloat(uint32_t bits)
+        {
+            float f;
+            std::memcpy(&f, &bits, sizeof(f));
+            return f;
+        }
+
+        // Returns the range of steps k in [0, n] for which c + s * k is in
+        // [lo, hi], where s is 1 or -1. The range is empty if first > last.
+        std::pair<int64_t, int64_t> StepRange(int64_t c, int s, int64_t lo, int64_t hi, int64_t n)
+        {
+            if (s < 0)
             {
-                w = 0;
-                h = 0;
+                return {std::max<int64_t>(c - hi, 0), std::min(c - lo, n)};
             }
+            return {std::max<int64_t>(lo - c, 0), std::min(hi - c, n)};
         }
 
-        // void draw_pixel(int x, int y, int i, int counter);
+        // Draws the line from (x1, y1) to (x2, y2), both ends included,
+        // clipped to `clip`.
+        //
+        // The pixels are those of the classic Bresenham loop. After k steps
+        // along the major axis (length D, with d the length of the minor
+        // axis) the minor axis has moved ceil((k * d - D / 2) / D) steps, so
+        // the visible part of the line is found in closed form and only
+        // visible pixels are visited.
+        //
+        // void draw_pixel(int x, int y);
         template <typename F>
-        void DrawLineTempl(int x1, int y1, int x2, int y2, int surface_w, int surface_h, F draw_pixel)
+        void DrawLineTempl(int x1, int y1, int x2, int y2, const Rect &clip, const F &draw_pixel)
         {
-            int counter = 0;
-            int dx = std::abs(x2 - x1);
-            int sx = x1 < x2 ? 1 : -1;
-            int dy = std::abs(y2 - y1);
-            int sy = y1 < y2 ? 1 : -1;
-            int err = (dx > dy ? dx : -dy) / 2;
+            if (clip.w <= 0 || clip.h <= 0)
+            {
+                return;
+            }
+
+            const int64_t dx = std::abs(int64_t{x2} - x1);
+            const int64_t dy = std::abs(int64_t{y2} - y1);
+            const int sx = x1 < x2 ? 1 : -1;
+            const int sy = y1 < y2 ? 1 : -1;
+            const bool x_major = dx > dy;
+            const int64_t D = x_major ? dx : dy;
+            const int64_t d = x_major ? dy : dx;
+            const int64_t half = D / 2;
 
-            for (;;)
+            const int64_t clip_x2 = int64_t{clip.x} + clip.w - 1;
+            const int64_t clip_y2 = int64_t{clip.y} + clip.h - 1;
+            auto [k0, k1] = x_major ? StepRange(x1, sx, clip.x, clip_x2, D) : StepRange(y1, sy, clip.y, clip_y2, D);
+            const auto [j0, j1] = x_major ? StepRange(y1, sy, clip.y, clip_y2, d) : StepRange(x1, sx, clip.x, clip_x2, d);
+            if (k0 > k1 || j0 > j1)
             {
-                if (x1 >= 0 && x1 < surface_w && y1 >= 0 && y1 < surface_h)
-                    draw_pixel(x1, y1, y1 * surface_w + x1, counter++);
+                return;
+            }
 
-                if (x1 == x2 && y1 == y2)
-                {
-                    break;
-                }
+            // Restrict k so that the minor step count is in [j0, j1]. The
+            // products fit in uint64_t, as all the factors are below 2^32.
+            if (j0 > 0)
+            {
+                k0 = std::max(k0, int64_t((uint64_t(j0 - 1) * D + half) / d + 1));
+            }
+            if (j1 < d)
+            {
+                k1 = std::min(k1, int64_t((uint64_t(j1) * D + half) / d));
+            }
+            if (k0 > k1)
+            {
+                return;
+            }
 
-                int last_err = err;
-                if (last_err > -dx)
-                {
-                    err -= dy;
-                    x1 += sx;
-                }
-                if (last_err < dy)
+            // The minor step count j and the error term e = j * D + half - k * d,
+            // which stays in [0, D), at k = k0.
+            const uint64_t kd = uint64_t(k0) * d;
+            const int64_t j = kd <= uint64_t(half) ? 0 : int64_t((kd - half + D - 1) / D);
+            int64_t e = int64_t(uint64_t(j) * D + half - kd);
+
+            int x = Int(x1 + sx * (x_major ? k0 : j));
+            int y = Int(y1 + sy * (x_major ? j : k0));
+            const int major_x = x_major ? sx : 0;
+            const int major_y = x_major ? 0 : sy;
+            const int minor_x = x_major ? 0 : sx;
+            const int minor_y = x_major ? sy : 0;
+            for (int64_t k = k0; k <= k1; k++)
+            {
+                draw_pixel(x, y);
+                x += major_x;
+                y += major_y;
+                e -= d;
+                if (e < 0)
                 {
-                    err += dx;
-                    y1 += sy;
+                    e += D;
+                    x += minor_x;
+                    y += minor_y;
                 }
             }
         }
 
-        // void draw_pixel(int x, int y, int i);
+        // Draws the lines between consecutive points of `points`, and from
+        // the last one to the first, moved by (dx, dy).
+        //
+        // void draw_pixel(int x, int y);
+        template <typename F>
+        void DrawClosedPolyTempl(const Point *points, size_t n, int dx, int dy, const Rect &clip, const F &draw_pixel)
+        {
+            Point p = points[n - 1];
+            for (size_t i = 0; i < n; i++)
+            {
+                const Point q = points[i];
+                DrawLineTempl(p.x + dx, p.y + dy, q.x + dx, q.y + dy, clip, draw_pixel);
+                p = q;
+            }
+        }
+
+        // Fills the pixels in [x1, x2) x {y}, clipped to `clip`.
+        //
+        // void fill_span(int x, int y, int n);
         template <typename F>
-        void DrawHorizLineTempl(int x1, int x2, int y, int surface_w, int surface_h, F draw_pixel)
+        void DrawHorizLineTempl(int x1, int x2, int y, const Rect &clip, const F &fill_span)
         {
-            if (y < 0 || y >= surface_h)
+            if (y < clip.y || y >= clip.y + clip.h)
                 return;
 
             if (x2 < x1)
                 std::swap(x1, x2);
 
-            if (x2 < 0 || x1 >= surface_w)
+            if (x2 < clip.x || x1 >= clip.x + clip.w)
                 return;
 
-            if (x1 < 0)
-                x1 = 0;
+            if (x1 < clip.x)
+                x1 = clip.x;
 
-            if (x2 >= surface_w)
-                x2 = surface_w - 1;
+            if (x2 > clip.x + clip.w)
+                x2 = clip.x + clip.w;
 
-            for (int x = x1; x < x2; x++)
-                draw_pixel(x, y, y * surface_w + x);
+            if (x1 < x2)
+                fill_span(x1, y, x2 - x1);
         }
 
-        // void draw_pixel(int x, int y, int i);
+        // void fill_span(int x, int y, int n);
         template <typename F>
-        void FillRectTempl(int x, int y, int w, int h, int surface_w, int surface_h, F draw_pixel)
+        void FillRectTempl(int x, int y, int w, int h, const Rect &clip, const F &fill_span)
+        {
+            const Rect r = Intersect(Rect(x, y, w, h), clip);
+            for (int row = r.y; row < r.y + r.h; row++)
+            {
+                fill_span(r.x, row, r.w);
+            }
+        }
+
+        int64_t FloorDiv(int64_t a, int64_t b)
+        {
+            int64_t q = a / b;
+            return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+        }
+
+        // The x coordinate where the edge p-q crosses row y, computed exactly
+        // like the original floating point polygon filler did.
+        int FloatEdgeX(Point p, Point q, int pixel_y)
+        {
+            float y = Float(pixel_y);
+            float x1 = Float(p.x);
+            float y1 = Float(p.y);
+            float x2 = Float(q.x);
+            float y2 = Float(q.y);
+            return Int(x1 + (y - y1) / (y2 - y1) * (x2 - x1));
+        }
+
+        // A non-horizontal edge of a polygon, for FillPolygonTempl.
+        //
+        // The edge crosses the rows (y_top, y_bottom]. On the current row it
+        // crosses at exactly x + r / dy (0 <= r < dy), which is stepped from
+        // row to row with integer increments.
+        struct PolygonEdge
         {
-            Crop(x, y, w, h, surface_w, surface_h);
-            for (int row = y; row < y + h; row++)
+            // Starts the edge at `first_row`, which must be below y_top.
+            PolygonEdge(Point p, Point q, int first_row)
+                : p(p), q(q)
+            {
+                Point top = p.y < q.y ? p : q;
+                Point bottom = p.y < q.y ? q : p;
+                int dx = bottom.x - top.x;
+                y_top = top.y;
+                y_bottom = bottom.y;
+                y_first = first_row;
+                dy = bottom.y - top.y;
+                step_x = Int(FloorDiv(dx, dy));
+                step_r = dx - step_x * dy;
+
+                int64_t offset = int64_t{first_row - top.y} * dx;
+                int64_t offset_x = FloorDiv(offset, dy);
+                x = top.x + Int(offset_x);
+                r = Int(offset - offset_x * dy);
+
+                // The float expression is off by at most (|x1| + |dx|) * 2^-22
+                // pixels, so it can only round differently from the exact value
+                // if that is closer to an integer than this.
+                int64_t magnitude = std::abs(int64_t{p.x}) + std::abs(int64_t{dx});
+                float_window = Int(((magnitude * dy) >> 22) + 1);
+                exact_at_integers = std::abs(dx) <= 1;
+            }
+
+            // Returns the crossing on the current row (y), truncated towards
+            // zero. Near integers it falls back to the float expression, so the
+            // result is bit-identical to the original filler.
+            int NodeX(int y) const
             {
-                int i = row * surface_w + x;
-                for (int col = x; col < x + w; col++, i++)
+                if (std::min(r, dy - r) < float_window && !(r == 0 && exact_at_integers))
                 {
-                    draw_pixel(col, row, i);
+                    return FloatEdgeX(p, q, y);
+                }
+                return (r != 0 && x < 0) ? x + 1 : x;
+            }
+
+            void Step()
+            {
+                x += step_x;
+                r += step_r;
+                if (r >= dy)
+                {
+                    r -= dy;
+                    x++;
                 }
             }
-        }
 
-        // void draw_pixel(int x, int y, int i);
+            Point p;
+            Point q;
+            int y_top = 0;
+            int y_bottom = 0;
+            int y_first = 0;
+            int dy = 0;
+            int step_x = 0;
+            int step_r = 0;
+            int x = 0;
+            int r = 0;
+            int node_x = 0;
+            int float_window = 0;
+            bool exact_at_integers = false;
+        };
+
+        // Fills a polygon with the even-odd rule, clipped to `clip`.
+        //
+        // Only the rows and edges inside the clip rectangle are set up. Edges
+        // completely left or right of it are replaced by vertical edges just
+        // outside of it: they still count for the even-odd rule, but they are
+        // not stepped. The edges are sorted once by their first row, and only
+        // the edges crossing the current row are kept in the active edge list,
+        // sorted by x with an insertion sort (they rarely change order).
+        //
+        // The polygon of the `n` `points` is moved by (dx, dy).
+        //
+        // void fill_span(int x, int y, int n);
         template <typename F>
-        void FillPolygonTempl(const Polygon &polygon, int surface_w, int surface_h, F draw_pixel)
+        void FillPolygonTempl(const Point *points, size_t n, int dx, int dy, const Rect &clip, const F &fill_span)
         {
-            if (polygon.size() < 3)
+            if (n < 3)
+            {
+                BGI_WARN("Warning: Polygon size: %d < 3", Int(n));
+                return;
+            }
+
+            const Box box = BoundingBox(points, n, dx, dy);
+            const int xmin = Int(box.x1);
+            const int xmax = Int(box.x2);
+            const int ymin = Int(box.y1);
+            const int ymax = Int(box.y2);
+            const int clip_x2 = clip.x + clip.w;
+            const int row_begin = std::max(ymin, clip.y);
+            const int row_end = std::min(ymax, clip.y + clip.h - 1);
+            if (row_begin > row_end || xmax < clip.x || xmin >= clip_x2)
             {
-                BGI_WARN("Warning: Polygon size: %d < 3", Int(polygon.size()));
                 return;
             }
 
-            // find Y maxima
-            int ymin = polygon.back().y;
-            int ymax = polygon.back().y;
-            for (const Point &p : polygon)
+            // Reused from call to call, to not allocate every time.
+            thread_local std::vector<PolygonEdge> edges;
+            thread_local std::vector<PolygonEdge *> active;
+            edges.clear();
+            active.clear();
+            edges.reserve(n);
+            Point p(points[n - 1].x + dx, points[n - 1].y + dy);
+            for (size_t i = 0; i < n; i++)
             {
-                if (p.y < ymin)
-                    ymin = p.y;
-                else if (p.y > ymax)
-                    ymax = p.y;
+                Point q = points[i];
+                q.x += dx;
+                q.y += dy;
+                const int y_top = std::min(p.y, q.y);
+                const int y_bottom = std::max(p.y, q.y);
+                if (y_bottom < row_begin || y_top > row_end)
+                {
+                    // Outside of the clipped rows.
+                }
+                else if (p.y == q.y)
+                {
+                    DrawHorizLineTempl(p.x, q.x, p.y, clip, fill_span);
+                }
+                else if (std::max(p.x, q.x) < clip.x)
+                {
+                    edges.emplace_back(Point(clip.x - 1, p.y), Point(clip.x - 1, q.y), std::max(y_top + 1, row_begin));
+                }
+                else if (std::min(p.x, q.x) >= clip_x2)
+                {
+                    edges.emplace_back(Point(clip_x2, p.y), Point(clip_x2, q.y), std::max(y_top + 1, row_begin));
+                }
+                else
+                {
+                    // Edges start with their top vertex only.
+                    Point top = p.y < q.y ? p : q;
+                    if (top.x >= clip.x && top.x < clip_x2 && top.y >= row_begin)
+                    {
+                        fill_span(top.x, top.y, 1);
+                    }
+                    edges.emplace_back(p, q, std::max(y_top + 1, row_begin));
+                }
+                p = q;
             }
+            std::sort(edges.begin(), edges.end(),
+                      [](const PolygonEdge &a, const PolygonEdge &b)
+                      { return a.y_first < b.y_first; });
 
-            std::vector<int> nodeX;
-            nodeX.reserve(polygon.size());
-            for (int pixelY = ymin; pixelY <= ymax; pixelY++)
+            active.reserve(edges.size());
+            size_t next_edge = 0;
+            for (int y = row_begin; y <= row_end; y++)
             {
-                //  Build a list of nodes.
-                nodeX.clear();
-                Point p = polygon.back();
-                for (Point q : polygon)
+                active.erase(std::remove_if(active.begin(), active.end(),
+                                            [y](const PolygonEdge *e)
+                                            { return e->y_bottom < y; }),
+                             active.end());
+                for (; next_edge < edges.size() && edges[next_edge].y_first == y; next_edge++)
+                {
+                    active.push_back(&edges[next_edge]);
+                }
+
+                for (PolygonEdge *e : active)
                 {
-                    float y = Float(pixelY);
-                    float x1 = Float(p.x);
-                    float y1 = Float(p.y);
-                    float x2 = Float(q.x);
-                    float y2 = Float(q.y);
+                    e->node_x = e->NodeX(y);
+                }
+                for (size_t i = 1; i < active.size(); i++)
+                {
+                    PolygonEdge *e = active[i];
+                    size_t j = i;
+                    for (; j > 0 && active[j - 1]->node_x > e->node_x; j--)
+                    {
+                        active[j] = active[j - 1];
+                    }
+                    active[j] = e;
+                }
+
+                // fill the pixels between node pairs.
+                for (size_t i = 0; i + 1 < active.size(); i += 2)
+                {
+                    DrawHorizLineTempl(active[i]->node_x, active[i + 1]->node_x, y, clip, fill_span);
+                }
+
+                for (PolygonEdge *e : active)
+                {
+                    e->Step();
+                }
+            }
+        }
+
+        // The angles from `angle1` counter-clockwise to `angle2` (in degrees),
+        // on an ellipse with radii `rx` and `ry`.
+        //
+        // Angles are parametric, as in (rx * cos(a), ry * sin(a)), so a point
+        // (px, py) relative to the center (with py pointing down) is on the
+        // arc if the vector (px * ry, -py * rx) lies between the two boundary
+        // directions. The boundary directions are computed once, in fixed
+        // point; testing a point needs two cross products and no trig. Zero
+        // radii count as 1, so that flat ellipses still have angles.
+        class EllipseArc
+        {
+        public:
+            enum Coverage
+            {
+                kEmpty,
+                kPartial,
+                kFull,
+            };
 
-                    if ((y1 < y && y2 >= y) || (y2 < y && y1 >= y))
+            EllipseArc(int rx, int ry, int angle1, int angle2)
+                : rx_(std::max(rx, 1)), ry_(std::max(ry, 1))
+            {
+                const int64_t sweep = int64_t{angle2} - angle1;
+                if (sweep >= 360)
+                {
+                    quadrants_.fill(kFull);
+                    return;
+                }
+                const int64_t a1 = (angle1 % 360 + 360) % 360;
+                const int64_t a2 = a1 + (sweep % 360 + 360) % 360;
+                convex_ = a2 - a1 <= 180;
+                for (int q = 0; q < 4; q++)
+                {
+                    quadrants_[q] = kEmpty;
+                    if (a1 == a2)
                     {
-                        nodeX.push_back(Int(x1 + (y - y1) / (y2 - y1) * (x2 - x1)));
+                        continue;
                     }
-                    else if ((y1 == y && y2 > y) || (y2 == y && y1 > y))
+                    for (int64_t lo = 90 * q; lo < 720; lo += 360)
                     {
-                        float x = (x1 + (y - y1) / (y2 - y1) * (x2 - x1));
-                        if (x >= 0 && x < surface_w && y >= 0 && y < surface_h)
+                        if (lo >= a1 && lo + 90 <= a2)
+                        {
+                            quadrants_[q] = kFull;
+                        }
+                        else if (lo < a2 && lo + 90 > a1 && quadrants_[q] == kEmpty)
                         {
-                            draw_pixel(x, y, y * surface_w + x);
+                            quadrants_[q] = kPartial;
                         }
                     }
-                    else if (y1 == y && y2 == y)
+                }
+
+                constexpr double kDegToRad = 3.14159265358979323846 / 180;
+                b1x_ = std::lround(std::cos(a1 * kDegToRad) * kOne);
+                b1y_ = std::lround(std::sin(a1 * kDegToRad) * kOne);
+                b2x_ = std::lround(std::cos(a2 * kDegToRad) * kOne);
+                b2y_ = std::lround(std::sin(a2 * kDegToRad) * kOne);
+            }
+
+            bool full() const
+            {
+                return quadrants_ == std::array<Coverage, 4>{kFull, kFull, kFull, kFull};
+            }
+
+            // A zero sweep covers nothing.
+            bool empty() const
+            {
+                return quadrants_ == std::array<Coverage, 4>{kEmpty, kEmpty, kEmpty, kEmpty};
+            }
+
+            // Quadrant 0 is right and up from the center, then counter-clockwise.
+            Coverage quadrant(int q) const
+            {
+                return quadrants_[q];
+            }
+
+            bool Contains(int px, int py) const
+            {
+                const int64_t vx = int64_t{px} * ry_;
+                const int64_t vy = -int64_t{py} * rx_;
+                const bool after_begin = b1x_ * vy - b1y_ * vx >= 0;
+                const bool before_end = vx * b2y_ - vy * b2x_ >= 0;
+                return convex_ ? after_begin && before_end : after_begin || before_end;
+            }
+
+            // Calls `span(x1, x2)` for the parts of [x1, x2] x {py} on the arc's
+            // pie sector.
+            template <typename F>
+            void ClipRow(int x1, int x2, int py, const F &span) const
+            {
+                // Both boundary tests are linear in px: a * px + b >= 0.
+                const auto [lo1, hi1] = HalfLine(-b1y_ * ry_, -b1x_ * rx_ * py, x1, x2);
+                const auto [lo2, hi2] = HalfLine(b2y_ * ry_, b2x_ * rx_ * py, x1, x2);
+                if (convex_)
+                {
+                    const int64_t lo = std::max(lo1, lo2);
+                    const int64_t hi = std::min(hi1, hi2);
+                    if (lo <= hi)
+                    {
+                        span(Int(lo), Int(hi));
+                    }
+                }
+                else if (lo1 > hi1 || lo2 > hi2 || std::max(lo1, lo2) > std::min(hi1, hi2) + 1)
+                {
+                    if (lo1 <= hi1)
+                    {
+                        span(Int(lo1), Int(hi1));
+                    }
+                    if (lo2 <= hi2)
                     {
-                        DrawHorizLineTempl(Int(x1), Int(x2), Int(y), surface_w, surface_h, draw_pixel);
+                        span(Int(lo2), Int(hi2));
                     }
-                    p = q;
                 }
-                std::sort(nodeX.begin(), nodeX.end());
+                else
+                {
+                    span(Int(std::min(lo1, lo2)), Int(std::max(hi1, hi2)));
+                }
+            }
 
-                // fill the pixels between node pairs.
-                if (nodeX.size() % 2 != 0)
+        private:
+            static constexpr int64_t kOne = 1 << 14;
+
+            // Returns the px in [x1, x2] where a * px + b >= 0, as [lo, hi].
+            static std::pair<int64_t, int64_t> HalfLine(int64_t a, int64_t b, int x1, int x2)
+            {
+                if (a > 0)
                 {
-                    BGI_DIE("Nodes not even: %d", Int(nodeX.size()));
+                    return {std::max<int64_t>(x1, -FloorDiv(b, a)), x2};
                 }
-                for (int i = 0; i < Int(nodeX.size()); i += 2)
+                if (a < 0)
                 {
-                    DrawHorizLineTempl(nodeX.at(i), nodeX.at(i + 1), pixelY, surface_w, surface_h, draw_pixel);
+                    return {x1, std::min<int64_t>(x2, FloorDiv(b, -a))};
                 }
+                return b >= 0 ? std::pair<int64_t, int64_t>(x1, x2) : std::pair<int64_t, int64_t>(x2 + 1, x2);
             }
-        }
 
-        // Fills an ellipse centered at (cx, cy), with axes given by
-        // xradius and yradius.
+            int64_t rx_;
+            int64_t ry_;
+            bool convex_ = true;
+            std::array<Coverage, 4> quadrants_;
+            int64_t b1x_ = 0;
+            int64_t b1y_ = 0;
+            int64_t b2x_ = 0;
+            int64_t b2y_ = 0;
+        };
+
+        // Calls `row(x, y)` for the rows of an ellipse with axes given by
+        // xradius and yradius, centered at the origin: rows -y and y span
+        // [-x, x). A row may be reported several times, with increasing x.
         //
         // From "A Fast Bresenham Type Algorithm For Drawing Ellipses"
         // by John Kennedy.
         //
-        // void draw_pixel(int x, int y, int i);
+        // void row(int x, int y);
         template <typename F>
-        void FillEllipseTempl(int cx, int cy, int xradius, int yradius, int surface_w, int surface_h, F draw_pixel)
+        void EllipseRowsTempl(int xradius, int yradius, const F &row)
         {
             if (xradius == 0 && yradius == 0)
                 return;
 
-            const int TwoASquare = 2 * xradius * xradius;
-            const int TwoBSquare = 2 * yradius * yradius;
+            // 64-bit, as the squared radii overflow int for radii above 2^15.
+            const int64_t TwoASquare = 2 * int64_t{xradius} * xradius;
+            const int64_t TwoBSquare = 2 * int64_t{yradius} * yradius;
 
             int x = xradius;
             int y = 0;
-            int xchange = yradius * yradius * (1 - 2 * xradius);
-            int ychange = xradius * xradius;
-            int ellipseerror = 0;
-            int StoppingX = TwoBSquare * xradius;
-            int StoppingY = 0;
+            int64_t xchange = int64_t{yradius} * yradius * (1 - 2 * int64_t{xradius});
+            int64_t ychange = int64_t{xradius} * xradius;
+            int64_t ellipseerror = 0;
+            int64_t StoppingX = TwoBSquare * xradius;
+            int64_t StoppingY = 0;
 
             while (StoppingX >= StoppingY)
             {
                 // 1st set of points, y' > -1
-                DrawHorizLineTempl(cx - x, cx + x, cy - y, surface_w, surface_h, draw_pixel);
-                DrawHorizLineTempl(cx - x, cx + x, cy + y, surface_w, surface_h, draw_pixel);
+                row(x, y);
 
                 y++;
                 StoppingY += TwoASquare;
@@ -256,8 +703,8 @@ namespace bgi
             // 1st point set is done; start the 2nd set of points
             x = 0;
             y = yradius;
-            xchange = yradius * yradius;
-            ychange = xradius * xradius * (1 - 2 * yradius);
+            xchange = int64_t{yradius} * yradius;
+            ychange = int64_t{xradius} * xradius * (1 - 2 * int64_t{yradius});
             ellipseerror = 0;
             StoppingX = 0;
             StoppingY = TwoASquare * yradius;
@@ -265,8 +712,7 @@ namespace bgi
             while (StoppingX <= StoppingY)
             {
                 // 2nd set of points, y' < -1
-                DrawHorizLineTempl(cx - x, cx + x, cy - y, surface_w, surface_h, draw_pixel);
-                DrawHorizLineTempl(cx - x, cx + x, cy + y, surface_w, surface_h, draw_pixel);
+                row(x, y);
 
                 x++;
                 StoppingX += TwoBSquare;
@@ -283,25 +729,196 @@ namespace bgi
             }
         }
 
+        // Fills an ellipse centered at (cx, cy), with axes given by
+        // xradius and yradius.
+        //
+        // Only the pie sector of `arc` is filled.
+        //
+        // void fill_span(int x, int y, int n);
+        template <typename F>
+        void FillEllipseTempl(int cx, int cy, int xradius, int yradius, const EllipseArc &arc, const Rect &clip, const F &fill_span)
+        {
+            if (arc.empty() || IsOutside(EllipseBox(cx, cy, xradius, yradius), clip))
+                return;
+
+            const bool full = arc.full();
+            EllipseRowsTempl(xradius, yradius, [&](int x, int y)
+                             {
+                if (full)
+                {
+                    DrawHorizLineTempl(cx - x, cx + x, cy - y, clip, fill_span);
+                    DrawHorizLineTempl(cx - x, cx + x, cy + y, clip, fill_span);
+                    return;
+                }
+                for (int py : {-y, y})
+                {
+                    arc.ClipRow(-x, x - 1, py, [&](int x1, int x2)
+                                { DrawHorizLineTempl(cx + x1, cx + x2 + 1, cy + py, clip, fill_span); });
+                } });
+        }
+
+        // Fills a rectangle with corners rounded by ellipses with axes rx
+        // and ry: the pixels of the rectangle covered by the four corner
+        // ellipses and the three rectangles between them. The extent of each
+        // row is found once, so every pixel is written exactly once.
+        //
+        // void fill_span(int x, int y, int n);
+        template <typename F>
+        void FillRoundedRectTempl(int x, int y, int w, int h, int rx, int ry, const Rect &clip, const F &fill_span)
+        {
+            if (w <= 0 || h <= 0 || IsOutside(Box{x, y, int64_t{x} + w - 1, int64_t{y} + h - 1}, clip))
+                return;
+
+            // The corner ellipses are centered at (left, top), (right, top)
+            // and so on.
+            const int left = x + rx;
+            const int right = x + w - 1 - rx;
+            const int top = y + ry;
+            const int bottom = y + h - 1 - ry;
+
+            // Reused from call to call.
+            thread_local std::vector<int> half_widths;
+            half_widths.assign(ry + 1, 0);
+            EllipseRowsTempl(rx, ry, [&](int row_x, int row_y)
+                             { half_widths[row_y] = std::max(half_widths[row_y], row_x); });
+
+            const int row_begin = std::max(y, clip.y);
+            const int row_end = std::min(int64_t{y} + h, int64_t{clip.y} + clip.h);
+            for (int row = row_begin; row < row_end; row++)
+            {
+                int64_t x1 = x;
+                int64_t x2 = int64_t{x} + w - 1;
+                if (row < top || row > bottom)
+                {
+                    // The rectangle between the corners, and the corner
+                    // ellipses' spans [center - hw, center + hw). Both the
+                    // top and the bottom ellipses reach this row if h = 2 * ry.
+                    int hw = 0;
+                    for (int d : {std::abs(top - row), std::abs(row - bottom)})
+                    {
+                        if (d <= ry)
+                            hw = std::max(hw, half_widths[d]);
+                    }
+                    x1 = left;
+                    x2 = right;
+                    if (hw > 0)
+                    {
+                        x1 = std::min(left, right) - hw;
+                        x2 = std::max(std::max(left, right) + hw - 1, right);
+                    }
+                }
+                // The midpoint ellipses can stick out of the rectangle by a
+                // pixel.
+                x1 = std::max<int64_t>({x1, x, clip.x});
+                x2 = std::min<int64_t>({x2, int64_t{x} + w - 1, int64_t{clip.x} + clip.w - 1});
+                if (x1 <= x2)
+                {
+                    fill_span(Int(x1), row, Int(x2 - x1 + 1));
+                }
+            }
+        }
+
+        // Sorts `spans` by y, then x, and merges the ones that overlap or
+        // touch.
+        void MergeSpans(std::vector<RasterizedShape::Span> &spans)
+        {
+            std::sort(spans.begin(), spans.end(), [](const RasterizedShape::Span &a, const RasterizedShape::Span &b)
+                      { return a.y != b.y ? a.y < b.y : a.x < b.x; });
+            size_t merged = 0;
+            for (const RasterizedShape::Span &span : spans)
+            {
+                RasterizedShape::Span &last = spans[merged == 0 ? 0 : merged - 1];
+                if (merged > 0 && span.y == last.y && span.x <= last.x + last.n)
+                {
+                    last.n = std::max(last.n, span.x + span.n - last.x);
+                }
+                else
+                {
+                    spans[merged++] = span;
+                }
+            }
+            spans.resize(merged);
+        }
+
+        // Calls rasterize(fill_span). The polygon and ellipse rasterizers
+        // can report a pixel more than once, which shows when blending, so
+        // with `merge` the spans are collected and merged first.
+        template <typename Rasterize, typename F>
+        void FillSpans(bool merge, const Rasterize &rasterize, const F &fill_span)
+        {
+            if (!merge)
+            {
+                rasterize(fill_span);
+                return;
+            }
+            // Reused from call to call.
+            thread_local std::vector<RasterizedShape::Span> spans;
+            spans.clear();
+            rasterize([](int x, int y, int n)
+                      { spans.push_back({x, y, n}); });
+            MergeSpans(spans);
+            for (const RasterizedShape::Span &span : spans)
+            {
+                fill_span(span.x, span.y, span.n);
+            }
+        }
+
+        // Calls rasterize(draw_pixel). The ellipse outlines can report a
+        // pixel more than once, so with `dedup` the pixels are collected and
+        // drawn once each.
+        template <typename Rasterize, typename F>
+        void DrawPixels(bool dedup, const Rasterize &rasterize, const F &draw_pixel)
+        {
+            if (!dedup)
+            {
+                rasterize(draw_pixel);
+                return;
+            }
+            // Reused from call to call.
+            thread_local std::vector<Point> pixels;
+            pixels.clear();
+            rasterize([](int x, int y)
+                      { pixels.emplace_back(x, y); });
+            std::sort(pixels.begin(), pixels.end(), [](const Point &a, const Point &b)
+                      { return a.y != b.y ? a.y < b.y : a.x < b.x; });
+            pixels.erase(std::unique(pixels.begin(), pixels.end(), [](const Point &a, const Point &b)
+                                     { return a.x == b.x && a.y == b.y; }),
+                         pixels.end());
+            for (const Point &p : pixels)
+            {
+                draw_pixel(p.x, p.y);
+            }
+        }
+
         // Draws an ellipse centered at (cx, cy), with axes given by
         // xradius and yradius.
         //
         // From "A Fast Bresenham Type Algorithm For Drawing Ellipses"
         // by John Kennedy.
         //
-        // void draw_pixel(int x, int y, int i, int counter);
+        // Only the pixels on `arc` are drawn. Quadrants that the arc covers
+        // fully or not at all need no per-pixel angle test.
+        //
+        // void draw_pixel(int x, int y);
         template <typename F>
-        void DrawEllipseTempl(int cx, int cy, int xradius, int yradius, int surface_w, int surface_h, F draw_pixel)
+        void DrawEllipseTempl(int cx, int cy, int xradius, int yradius, const EllipseArc &arc, const Rect &clip, const F &draw_pixel)
         {
-            auto draw_pixel_if_needed = [&](int x, int y)
+            if (IsOutside(EllipseBox(cx, cy, xradius, yradius), clip))
+                return;
+
+            auto draw_pixel_if_needed = [&](int q, int px, int py)
             {
-                if (x >= 0 && x < surface_w && y >= 0 && y < surface_h)
-                    draw_pixel(x, y, y * surface_w + x, 0);
+                const EllipseArc::Coverage coverage = arc.quadrant(q);
+                if (coverage == EllipseArc::kEmpty || (coverage == EllipseArc::kPartial && !arc.Contains(px, py)))
+                    return;
+                const int x = cx + px;
+                const int y = cy + py;
+                if (x >= clip.x && x < clip.x + clip.w && y >= clip.y && y < clip.y + clip.h)
+                    draw_pixel(x, y);
             };
 
-            int x,
-                y,
-                xchange, ychange,
+            int x, y;
+            int64_t xchange, ychange,
                 ellipseerror,
                 TwoASquare, TwoBSquare,
                 StoppingX, StoppingY;
@@ -309,12 +926,12 @@ namespace bgi
             if (0 == xradius && 0 == yradius)
                 return;
 
-            TwoASquare = 2 * xradius * xradius;
-            TwoBSquare = 2 * yradius * yradius;
+            TwoASquare = 2 * int64_t{xradius} * xradius;
+            TwoBSquare = 2 * int64_t{yradius} * yradius;
             x = xradius;
             y = 0;
-            xchange = yradius * yradius * (1 - 2 * xradius);
-            ychange = xradius * xradius;
+            xchange = int64_t{yradius} * yradius * (1 - 2 * int64_t{xradius});
+            ychange = int64_t{xradius} * xradius;
             ellipseerror = 0;
             StoppingX = TwoBSquare * xradius;
             StoppingY = 0;
@@ -322,10 +939,10 @@ namespace bgi
             while (StoppingX >= StoppingY)
             {
                 // 1st set of points, y' > -1
-                draw_pixel_if_needed(cx + x, cy - y);
-                draw_pixel_if_needed(cx - x, cy - y);
-                draw_pixel_if_needed(cx - x, cy + y);
-                draw_pixel_if_needed(cx + x, cy + y);
+                draw_pixel_if_needed(0, x, -y);
+                draw_pixel_if_needed(1, -x, -y);
+                draw_pixel_if_needed(2, -x, y);
+                draw_pixel_if_needed(3, x, y);
 
                 y++;
                 StoppingY += TwoASquare;
@@ -344,8 +961,8 @@ namespace bgi
             // 1st point set is done; start the 2nd set of points
             x = 0;
             y = yradius;
-            xchange = yradius * yradius;
-            ychange = xradius * xradius * (1 - 2 * yradius);
+            xchange = int64_t{yradius} * yradius;
+            ychange = int64_t{xradius} * xradius * (1 - 2 * int64_t{yradius});
             ellipseerror = 0;
             StoppingX = 0;
             StoppingY = TwoASquare * yradius;
@@ -353,10 +970,10 @@ namespace bgi
             while (StoppingX <= StoppingY)
             {
                 // 2nd set of points, y' < -1
-                draw_pixel_if_needed(cx + x, cy - y);
-                draw_pixel_if_needed(cx - x, cy - y);
-                draw_pixel_if_needed(cx - x, cy + y);
-                draw_pixel_if_needed(cx + x, cy + y);
+                draw_pixel_if_needed(0, x, -y);
+                draw_pixel_if_needed(1, -x, -y);
+                draw_pixel_if_needed(2, -x, y);
+                draw_pixel_if_needed(3, x, y);
                 x++;
                 StoppingX += TwoBSquare;
                 ellipseerror += xchange;
@@ -371,23 +988,350 @@ namespace bgi
             }
         }
 
-    } // namespace
+        // The glyphs of a bitmap font, stretched horizontally by `scale_x`.
+        //
+        // Each glyph row is stored as a mask of 8 * scale_x bits (MSB first),
+        // so it can be written with a single masked span fill.
+        class GlyphSet
+        {
+        public:
+            GlyphSet(const std::array<FillPattern, 256> &font, int scale_x)
+                : scale_x_(scale_x), bits_(256 * 8 * scale_x)
+            {
+                for (int c = 0; c < 256; c++)
+                {
+                    for (int row = 0; row < 8; row++)
+                    {
+                        uint8_t *dst = &bits_[(c * 8 + row) * scale_x];
+                        for (int bit = 0; bit < 8 * scale_x; bit++)
+                        {
+                            if (IsFg(font[c], bit / scale_x, row))
+                                dst[bit >> 3] |= 0x80 >> (bit & 7);
+                        }
+                    }
+                }
+            }
 
-    App::App() : App(time(nullptr))
-    {
-    }
+            const uint8_t *Row(uint8_t c, int row) const
+            {
+                return &bits_[(c * 8 + row) * scale_x_];
+            }
 
-    App::App(int random_seed)
-    {
-        BGI_SDL_CHECK_ZERO(SDL_Init(SDL_INIT_VIDEO));
-        BGI_WARN_FALSE(SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest"));
-        std::srand(random_seed);
-    }
+        private:
+            int scale_x_;
+            std::vector<uint8_t> bits_;
+        };
 
-    int App::Random(int exclusive_upper_limit)
-    {
-        // TODO: better random. SDL random?
-        return std::rand() % exclusive_upper_limit;
+        // Returns the glyph set of `font` for `scale_x`, building it on first
+        // use. Thread-safe.
+        const GlyphSet &GetGlyphSet(const std::array<FillPattern, 256> &font, int scale_x)
+        {
+            if (scale_x == 1)
+            {
+                static const GlyphSet glyph_set(font, 1);
+                return glyph_set;
+            }
+
+            static std::mutex mutex;
+            static std::map<int, std::unique_ptr<GlyphSet>> glyph_sets;
+            std::lock_guard<std::mutex> lock(mutex);
+            std::unique_ptr<GlyphSet> &glyph_set = glyph_sets[scale_x];
+            if (!glyph_set)
+            {
+                glyph_set = std::make_unique<GlyphSet>(font, scale_x);
+            }
+            return *glyph_set;
+        }
+
+#ifdef BGI_INSTRUMENTATION
+        // Returns the number of pixels in `box`, saturated at 2^62.
+        int64_t Area(const Box &box)
+        {
+            if (box.x1 > box.x2 || box.y1 > box.y2)
+            {
+                return 0;
+            }
+            const double area = static_cast<double>(box.x2 - box.x1 + 1) * static_cast<double>(box.y2 - box.y1 + 1);
+            return static_cast<int64_t>(std::min(area, 0x1p62));
+        }
+
+        int64_t Area(const Rect &rect)
+        {
+            return int64_t{rect.w} * rect.h;
+        }
+
+        struct AtomicPrimitiveStats
+        {
+            std::atomic<int64_t> calls{0};
+            std::atomic<int64_t> pixels_written{0};
+            std::atomic<int64_t> pixels_clipped{0};
+            std::atomic<int64_t> nanoseconds{0};
+        };
+
+        struct AtomicStats
+        {
+            std::array<AtomicPrimitiveStats, static_cast<int>(Primitive::kCount)> primitives;
+            std::atomic<int64_t> frames{0};
+            std::atomic<int64_t> upload_nanoseconds{0};
+            std::atomic<int64_t> last_upload_nanoseconds{0};
+            std::atomic<int64_t> present_nanoseconds{0};
+            std::atomic<int64_t> last_present_nanoseconds{0};
+        };
+
+        AtomicStats &GetAtomicStats()
+        {
+            static AtomicStats stats;
+            return stats;
+        }
+
+        int64_t NanosecondsSince(std::chrono::steady_clock::time_point start)
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // Whether this thread draws a tile of a TileRenderer. Those calls
+        // were already counted (and clipped) when they were queued.
+        thread_local bool drawing_tile = false;
+
+        // Measures one Drawer call, from construction to destruction.
+        class Probe
+        {
+        public:
+            explicit Probe(Primitive primitive)
+                : primitive_(primitive), start_(std::chrono::steady_clock::now())
+            {
+            }
+
+            ~Probe()
+            {
+                AtomicPrimitiveStats &stats = GetAtomicStats().primitives[static_cast<int>(primitive_)];
+                if (!drawing_tile)
+                {
+                    stats.calls.fetch_add(1, std::memory_order_relaxed);
+                    stats.pixels_clipped.fetch_add(clipped_, std::memory_order_relaxed);
+                }
+                stats.pixels_written.fetch_add(written_, std::memory_order_relaxed);
+                stats.nanoseconds.fetch_add(NanosecondsSince(start_), std::memory_order_relaxed);
+            }
+
+            void Written(int64_t pixels) { written_ += pixels; }
+            void Clipped(int64_t pixels) { clipped_ += pixels; }
+            // Counts the part of `box` outside of `visible`.
+            void Clipped(const Box &box, const Rect &visible) { clipped_ += Area(box) - Area(visible); }
+
+        private:
+            Primitive primitive_;
+            std::chrono::steady_clock::time_point start_;
+            int64_t written_ = 0;
+            int64_t clipped_ = 0;
+        };
+
+        // Marks the calls on this thread as drawing a tile.
+        class TileScope
+        {
+        public:
+            TileScope() { drawing_tile = true; }
+            ~TileScope() { drawing_tile = false; }
+        };
+
+        // Measures uploading and presenting a frame.
+        class FrameProbe
+        {
+        public:
+            FrameProbe() : start_(std::chrono::steady_clock::now()) {}
+
+            void Uploaded()
+            {
+                upload_nanoseconds_ = NanosecondsSince(start_);
+                start_ = std::chrono::steady_clock::now();
+            }
+
+            void Presented()
+            {
+                const int64_t present_nanoseconds = NanosecondsSince(start_);
+                AtomicStats &stats = GetAtomicStats();
+                stats.frames.fetch_add(1, std::memory_order_relaxed);
+                stats.upload_nanoseconds.fetch_add(upload_nanoseconds_, std::memory_order_relaxed);
+                stats.last_upload_nanoseconds.store(upload_nanoseconds_, std::memory_order_relaxed);
+                stats.present_nanoseconds.fetch_add(present_nanoseconds, std::memory_order_relaxed);
+                stats.last_present_nanoseconds.store(present_nanoseconds, std::memory_order_relaxed);
+            }
+
+        private:
+            std::chrono::steady_clock::time_point start_;
+            int64_t upload_nanoseconds_ = 0;
+        };
+
+        // Returns the part of the rect (x, y, w, h) inside `clip`, and counts
+        // the rest as clipped.
+        Rect ClipRect(int x, int y, int w, int h, const Rect &clip, Probe &probe)
+        {
+            const Box box = RectBox(x, y, w, h);
+            const Rect r = Intersect(box, clip);
+            probe.Clipped(box, r);
+            return r;
+        }
+
+        // Returns a span filler that calls `fill_span` and counts the pixels.
+        template <typename F>
+        auto CountWritten(Probe &probe, const F &fill_span)
+        {
+            return [&probe, &fill_span](int x, int y, int n)
+            {
+                probe.Written(n);
+                fill_span(x, y, n);
+            };
+        }
+#else
+        // Without BGI_INSTRUMENTATION, the probes do nothing and compile to
+        // nothing.
+        class Probe
+        {
+        public:
+            explicit Probe(Primitive) {}
+            void Written(int64_t) {}
+            void Clipped(int64_t) {}
+            void Clipped(const Box &, const Rect &) {}
+        };
+
+        class TileScope
+        {
+        public:
+            TileScope() {}
+        };
+
+        class FrameProbe
+        {
+        public:
+            void Uploaded() {}
+            void Presented() {}
+        };
+
+        // The same as without the probes: clipped as Rects, and `fill_span`
+        // itself.
+        Rect ClipRect(int x, int y, int w, int h, const Rect &clip, Probe &)
+        {
+            return Intersect(Rect(x, y, w, h), clip);
+        }
+
+        template <typename F>
+        const F &CountWritten(Probe &, const F &fill_span)
+        {
+            return fill_span;
+        }
+#endif
+
+    } // namespace
+
+    const char *GetPrimitiveName(Primitive primitive)
+    {
+        static constexpr std::array<const char *, static_cast<int>(Primitive::kCount)> names = {
+            "SetPixel",
+            "Clear",
+            "DrawRect",
+            "FillRect",
+            "DrawRoundedRect",
+            "FillRoundedRect",
+            "DrawEllipse",
+            "FillEllipse",
+            "DrawLine",
+            "DrawOpenPoly",
+            "DrawPoly",
+            "FillPoly",
+            "Write",
+            "WriteEx",
+            "FillShape",
+            "Blit",
+        };
+        return names.at(static_cast<int>(primitive));
+    }
+
+#ifdef BGI_INSTRUMENTATION
+    bool IsInstrumented()
+    {
+        return true;
+    }
+
+    Stats GetStats()
+    {
+        const AtomicStats &atomic_stats = GetAtomicStats();
+        Stats stats;
+        for (int i = 0; i < Int(stats.primitives.size()); i++)
+        {
+            const AtomicPrimitiveStats &from = atomic_stats.primitives[i];
+            PrimitiveStats &to = stats.primitives[i];
+            to.calls = from.calls.load(std::memory_order_relaxed);
+            to.pixels_written = from.pixels_written.load(std::memory_order_relaxed);
+            to.pixels_clipped = from.pixels_clipped.load(std::memory_order_relaxed);
+            to.time = std::chrono::nanoseconds(from.nanoseconds.load(std::memory_order_relaxed));
+        }
+        stats.frames = atomic_stats.frames.load(std::memory_order_relaxed);
+        stats.upload_time = std::chrono::nanoseconds(atomic_stats.upload_nanoseconds.load(std::memory_order_relaxed));
+        stats.last_upload_time = std::chrono::nanoseconds(atomic_stats.last_upload_nanoseconds.load(std::memory_order_relaxed));
+        stats.present_time = std::chrono::nanoseconds(atomic_stats.present_nanoseconds.load(std::memory_order_relaxed));
+        stats.last_present_time = std::chrono::nanoseconds(atomic_stats.last_present_nanoseconds.load(std::memory_order_relaxed));
+        return stats;
+    }
+
+    void ResetStats()
+    {
+        AtomicStats &stats = GetAtomicStats();
+        for (AtomicPrimitiveStats &primitive : stats.primitives)
+        {
+            primitive.calls = 0;
+            primitive.pixels_written = 0;
+            primitive.pixels_clipped = 0;
+            primitive.nanoseconds = 0;
+        }
+        stats.frames = 0;
+        stats.upload_nanoseconds = 0;
+        stats.last_upload_nanoseconds = 0;
+        stats.present_nanoseconds = 0;
+        stats.last_present_nanoseconds = 0;
+    }
+#else
+    bool IsInstrumented()
+    {
+        return false;
+    }
+
+    Stats GetStats()
+    {
+        return Stats();
+    }
+
+    void ResetStats()
+    {
+    }
+#endif
+
+    App::App() : App(time(nullptr))
+    {
+    }
+
+    App::App(int random_seed) : App(AppMode::kWindowed, random_seed)
+    {
+    }
+
+    App::App(AppMode mode) : App(mode, time(nullptr))
+    {
+    }
+
+    App::App(AppMode mode, int random_seed)
+        : mode_(mode)
+    {
+        if (mode_ == AppMode::kWindowed)
+        {
+            BGI_SDL_CHECK_ZERO(SDL_Init(SDL_INIT_VIDEO));
+            BGI_WARN_FALSE(SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest"));
+        }
+        std::srand(random_seed);
+    }
+
+    int App::Random(int exclusive_upper_limit)
+    {
+        // TODO: better random. SDL random?
+        return std::rand() % exclusive_upper_limit;
     }
 
     Color App::RandomRgbColor()
@@ -402,11 +1346,27 @@ namespace bgi
 
     App::~App()
     {
-        SDL_Quit();
+        if (mode_ == AppMode::kWindowed)
+        {
+            SDL_Quit();
+        }
+    }
+
+    ThreadPool &App::thread_pool()
+    {
+        if (!thread_pool_)
+        {
+            thread_pool_ = std::make_unique<ThreadPool>();
+        }
+        return *thread_pool_;
     }
 
     KeyPress App::WaitKeyPress(bool auto_quit)
     {
+        if (headless())
+        {
+            BGI_DIE("A headless App has no key presses to wait for.");
+        }
         SDL_Event e;
         while (!(SDL_WaitEvent(&e) && (e.type == SDL_QUIT || e.type == SDL_KEYDOWN)))
         {
@@ -427,6 +1387,10 @@ namespace bgi
     bool App::PollKeyPress(KeyPress &key_press, bool auto_quit)
     {
         key_press = {};
+        if (headless())
+        {
+            return false;
+        }
         SDL_Event e;
         while (SDL_PollEvent(&e))
         {
@@ -450,445 +1414,2711 @@ namespace bgi
         return false;
     }
 
-    Window::Window(std::string_view title, int w, int h)
+    uint64_t DamageList::NextGeneration()
+    {
+        static std::atomic<uint64_t> next_generation{1};
+        return next_generation++;
+    }
+
+    void DamageList::Add(const Rect &rect)
+    {
+        if (rect.w <= 0 || rect.h <= 0)
+        {
+            return;
+        }
+        auto area = [](const Rect &r)
+        { return int64_t{r.w} * r.h; };
+        auto unite = [](const Rect &a, const Rect &b)
+        {
+            const int x1 = std::min(a.x, b.x);
+            const int y1 = std::min(a.y, b.y);
+            return Rect(x1, y1, std::max(a.x + a.w, b.x + b.w) - x1, std::max(a.y + a.h, b.y + b.h) - y1);
+        };
+
+        Rect added = rect;
+        for (size_t i = 0; i < rects_.size();)
+        {
+            const Rect &r = rects_[i];
+            if (r.x <= added.x && r.y <= added.y && r.x + r.w >= added.x + added.w && r.y + r.h >= added.y + added.h)
+            {
+                // Already covered.
+                return;
+            }
+            if (r.x <= added.x + added.w && added.x <= r.x + r.w && r.y <= added.y + added.h && added.y <= r.y + r.h)
+            {
+                // Overlapping or touching: merge, and check the rest again.
+                added = unite(added, r);
+                rects_.erase(rects_.begin() + i);
+                i = 0;
+                continue;
+            }
+            i++;
+        }
+        rects_.push_back(added);
+
+        while (Int(rects_.size()) > kMaxRects)
+        {
+            size_t best_i = 0;
+            size_t best_j = 1;
+            int64_t best_waste = std::numeric_limits<int64_t>::max();
+            for (size_t i = 0; i < rects_.size(); i++)
+            {
+                for (size_t j = i + 1; j < rects_.size(); j++)
+                {
+                    const int64_t waste = area(unite(rects_[i], rects_[j])) - area(rects_[i]) - area(rects_[j]);
+                    if (waste < best_waste)
+                    {
+                        best_i = i;
+                        best_j = j;
+                        best_waste = waste;
+                    }
+                }
+            }
+            const Rect merged = unite(rects_[best_i], rects_[best_j]);
+            rects_.erase(rects_.begin() + best_j);
+            rects_.erase(rects_.begin() + best_i);
+            // The merged rectangle may now overlap others.
+            Add(merged);
+        }
+    }
+
+    SurfaceView SurfaceView::Sub(const Rect &rect) const
+    {
+        Rect r = Intersect(rect, Rect(0, 0, w, h));
+        SurfaceView view(row(r.y) + r.x, r.w, r.h, stride, damage);
+        view.origin = Point(origin.x + r.x, origin.y + r.y);
+        return view;
+    }
+
+    Window::Window(std::string_view title, int w, int h, bool vsync)
+        : vsync_(vsync)
+    {
+        Size physical_size(2 * w, 2 * h);
+        BGI_SDL_CHECK_PTR(window_ = SDL_CreateWindow(std::string(title).c_str(),
+                                                     SDL_WINDOWPOS_UNDEFINED,
+                                                     SDL_WINDOWPOS_UNDEFINED,
+                                                     physical_size.w,
+                                                     physical_size.h,
+                                                     SDL_WINDOW_SHOWN));
+        BGI_SDL_CHECK_PTR(renderer_ = SDL_CreateRenderer(window_, -1, vsync ? SDL_RENDERER_PRESENTVSYNC : 0));
+        BGI_SDL_CHECK_ZERO(SDL_RenderSetLogicalSize(renderer_, w, h));
+        BGI_SDL_CHECK_PTR(texture_ = SDL_CreateTexture(renderer_,
+                                                       SDL_PIXELFORMAT_ARGB8888,
+                                                       SDL_TEXTUREACCESS_STREAMING,
+                                                       w, h));
+    }
+
+    Window::~Window()
+    {
+        SDL_DestroyWindow(window_);
+        SDL_DestroyRenderer(renderer_);
+        SDL_DestroyTexture(texture_);
+    }
+
+    void Window::Update(Surface &surface)
+    {
+        Update(static_cast<const Surface &>(surface));
+        surface.damage.Clear();
+        last_generation_ = surface.damage.generation();
+    }
+
+    void Window::Update(const Surface &surface)
+    {
+        if (locked_)
+        {
+            BGI_DIE("Update() while the window is locked.");
+        }
+        FrameProbe probe;
+        if (&surface != last_surface_ || surface.damage.generation() != last_generation_)
+        {
+            BGI_SDL_CHECK_ZERO(SDL_UpdateTexture(texture_, NULL, surface.pixels.data(), surface.stride * sizeof(Color)));
+            last_surface_ = &surface;
+            last_generation_ = surface.damage.generation();
+        }
+        else
+        {
+            for (const Rect &damage : surface.damage.rects())
+            {
+                Rect r = Intersect(damage, Rect(0, 0, surface.w, surface.h));
+                if (r.w == 0)
+                {
+                    continue;
+                }
+                SDL_Rect sdl_rect = r.sdl();
+                BGI_SDL_CHECK_ZERO(SDL_UpdateTexture(texture_, &sdl_rect, surface.row(r.y) + r.x, surface.stride * sizeof(Color)));
+            }
+        }
+        probe.Uploaded();
+        Render();
+        probe.Presented();
+    }
+
+    SurfaceView Window::Lock()
+    {
+        if (locked_)
+        {
+            BGI_DIE("The window is already locked.");
+        }
+        void *pixels = nullptr;
+        int pitch = 0;
+        BGI_SDL_CHECK_ZERO(SDL_LockTexture(texture_, NULL, &pixels, &pitch));
+        locked_ = true;
+        Size size = this->size();
+        return SurfaceView(static_cast<Color *>(pixels), size.w, size.h, pitch / static_cast<int>(sizeof(Color)));
+    }
+
+    void Window::Present()
+    {
+        if (!locked_)
+        {
+            BGI_DIE("The window is not locked.");
+        }
+        FrameProbe probe;
+        SDL_UnlockTexture(texture_);
+        locked_ = false;
+        // The texture no longer matches any Surface.
+        last_surface_ = nullptr;
+        probe.Uploaded();
+        Render();
+        probe.Presented();
+    }
+
+    void Window::Render()
+    {
+        BGI_SDL_CHECK_ZERO(SDL_SetRenderDrawColor(renderer_, 0, 0, 0, 255));
+        BGI_SDL_CHECK_ZERO(SDL_RenderClear(renderer_));
+        BGI_SDL_CHECK_ZERO(SDL_RenderCopy(renderer_, texture_, NULL, NULL));
+        SDL_RenderPresent(renderer_);
+    }
+
+    void Window::set_fullscreen(bool full_screen)
+    {
+        BGI_SDL_CHECK_ZERO(SDL_SetWindowFullscreen(window_, full_screen ? SDL_WINDOW_FULLSCREEN_DESKTOP : 0));
+    }
+
+    OffscreenWindow::OffscreenWindow(int w, int h)
+        : frame_(w, h), last_frame_time_(std::chrono::steady_clock::now())
+    {
+    }
+
+    void OffscreenWindow::Update(Surface &surface)
+    {
+        Update(static_cast<const Surface &>(surface));
+        surface.damage.Clear();
+        last_generation_ = surface.damage.generation();
+    }
+
+    void OffscreenWindow::Update(const Surface &surface)
+    {
+        if (locked_)
+        {
+            BGI_DIE("Update() while the window is locked.");
+        }
+        FrameProbe probe;
+        if (surface.w != frame_.w || surface.h != frame_.h)
+        {
+            BGI_DIE("The surface is %dx%d, the window is %dx%d.", surface.w, surface.h, frame_.w, frame_.h);
+        }
+        std::vector<Rect> regions;
+        if (&surface != last_surface_ || surface.damage.generation() != last_generation_)
+        {
+            regions.push_back(Rect(0, 0, frame_.w, frame_.h));
+            last_surface_ = &surface;
+            last_generation_ = surface.damage.generation();
+        }
+        else if (surface.damage.empty())
+        {
+            return;
+        }
+        else
+        {
+            regions = surface.damage.rects();
+        }
+        for (const Rect &region : regions)
+        {
+            const Rect r = Intersect(region, Rect(0, 0, frame_.w, frame_.h));
+            for (int y = r.y; y < r.y + r.h; y++)
+            {
+                std::copy_n(surface.row(y) + r.x, r.w, frame_.row(y) + r.x);
+            }
+        }
+        probe.Uploaded();
+        EndFrame();
+        probe.Presented();
+    }
+
+    SurfaceView OffscreenWindow::Lock()
+    {
+        if (locked_)
+        {
+            BGI_DIE("The window is already locked.");
+        }
+        locked_ = true;
+        return SurfaceView(frame_.pixels.data(), frame_.w, frame_.h, frame_.stride);
+    }
+
+    void OffscreenWindow::Present()
+    {
+        if (!locked_)
+        {
+            BGI_DIE("The window is not locked.");
+        }
+        FrameProbe probe;
+        locked_ = false;
+        last_surface_ = nullptr;
+        probe.Uploaded();
+        EndFrame();
+        probe.Presented();
+    }
+
+    void OffscreenWindow::EndFrame()
+    {
+        const auto now = std::chrono::steady_clock::now();
+        frame_times_.push_back(now - last_frame_time_);
+        last_frame_time_ = now;
+    }
+
+    SwapChain::SwapChain(Size size, PresentFunction present, int buffers, int max_latency)
+        : SwapChain(size, std::move(present), nullptr, buffers, max_latency)
+    {
+    }
+
+    SwapChain::SwapChain(OffscreenWindow &window, int buffers, int max_latency)
+        : SwapChain(window.size(), [&window](Surface &surface)
+                    { window.Update(surface); },
+                    buffers, max_latency)
+    {
+    }
+
+    SwapChain::SwapChain(Size size, PresentFunction present, DrawFunction draw, int buffers, int max_latency)
+        : present_(std::move(present)), draw_(std::move(draw))
+    {
+        if (buffers < 2)
+        {
+            BGI_DIE("A SwapChain needs at least 2 buffers, not %d.", buffers);
+        }
+        max_latency_ = max_latency > 0 ? std::min(max_latency, buffers - 1) : buffers - 1;
+        for (int i = 0; i < buffers; i++)
+        {
+            surfaces_.push_back(std::make_unique<Surface>(size));
+        }
+        if (draw_)
+        {
+            thread_ = std::thread([this]
+                                  { DrawLoop(); });
+        }
+        else
+        {
+            thread_ = std::thread([this]
+                                  { PresentLoop(); });
+        }
+    }
+
+    SwapChain::SwapChain(Window &window, DrawFunction draw, int buffers, int max_latency)
+        : SwapChain(window.size(), [&window](Surface &surface)
+                    { window.Update(surface); },
+                    std::move(draw), buffers, max_latency)
+    {
+    }
+
+    SwapChain::~SwapChain()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        condition_.notify_all();
+        thread_.join();
+    }
+
+    Surface &SwapChain::Acquire()
+    {
+        if (draw_)
+        {
+            BGI_DIE("Acquire() on a SwapChain that draws on its own thread.");
+        }
+        if (acquired_)
+        {
+            BGI_DIE("Acquire() twice without Submit().");
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this]
+                        { return CanAcquire(); });
+        acquired_ = true;
+        return *surfaces_[frames_submitted_ % buffers()];
+    }
+
+    void SwapChain::Submit()
+    {
+        if (!acquired_)
+        {
+            BGI_DIE("Submit() without Acquire().");
+        }
+        acquired_ = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            Enqueue();
+        }
+        condition_.notify_all();
+    }
+
+    void SwapChain::Wait()
+    {
+        if (draw_)
+        {
+            BGI_DIE("Wait() on a SwapChain that draws on its own thread.");
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this]
+                        { return in_flight_ == 0; });
+    }
+
+    void SwapChain::Present()
+    {
+        if (!draw_)
+        {
+            BGI_DIE("Present() on a SwapChain without a draw function.");
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this]
+                        { return !queue_.empty(); });
+        const int index = queue_.front();
+        queue_.erase(queue_.begin());
+        lock.unlock();
+        present_(*surfaces_[index]);
+        lock.lock();
+        in_flight_--;
+        frames_presented_++;
+        condition_.notify_all();
+    }
+
+    int64_t SwapChain::frames_presented() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return frames_presented_;
+    }
+
+    void SwapChain::Enqueue()
+    {
+        queue_.push_back(static_cast<int>(frames_submitted_ % buffers()));
+        in_flight_++;
+        frames_submitted_++;
+    }
+
+    void SwapChain::PresentLoop()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;)
+        {
+            condition_.wait(lock, [this]
+                            { return !queue_.empty() || stopping_; });
+            if (queue_.empty())
+            {
+                return;
+            }
+            const int index = queue_.front();
+            queue_.erase(queue_.begin());
+            lock.unlock();
+            present_(*surfaces_[index]);
+            lock.lock();
+            in_flight_--;
+            frames_presented_++;
+            condition_.notify_all();
+        }
+    }
+
+    void SwapChain::DrawLoop()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;)
+        {
+            condition_.wait(lock, [this]
+                            { return CanAcquire() || stopping_; });
+            if (stopping_)
+            {
+                return;
+            }
+            // Only this thread submits, so the buffer stays the same.
+            Surface &surface = *surfaces_[frames_submitted_ % buffers()];
+            lock.unlock();
+            draw_(surface);
+            lock.lock();
+            Enqueue();
+            condition_.notify_all();
+        }
+    }
+
+    FrameLoop::FrameLoop(std::chrono::nanoseconds step, double max_fps)
+        : step_(step), next_frame_(Clock::now()), last_step_(next_frame_), last_frame_end_(next_frame_)
+    {
+        if (step <= std::chrono::nanoseconds(0))
+        {
+            BGI_DIE("The step of a FrameLoop must be positive.");
+        }
+        set_max_fps(max_fps);
+        frame_times_.reserve(kFrameTimeHistory);
+    }
+
+    void FrameLoop::set_max_fps(double max_fps)
+    {
+        max_fps_ = std::max(max_fps, 0.0);
+        frame_period_ = max_fps_ > 0 ? std::chrono::nanoseconds(static_cast<int64_t>(1e9 / max_fps_)) : std::chrono::nanoseconds(0);
+    }
+
+    int FrameLoop::BeginFrame()
+    {
+        Clock::time_point now = Clock::now();
+        if (max_fps_ > 0)
+        {
+            if (now < next_frame_)
+            {
+                // Sleep for most of the wait, and spin for the rest to be on
+                // time.
+                if (next_frame_ - now > kSpinTime)
+                {
+                    std::this_thread::sleep_for(next_frame_ - now - kSpinTime);
+                }
+                while ((now = Clock::now()) < next_frame_)
+                {
+                    std::this_thread::yield();
+                }
+            }
+            next_frame_ += frame_period_;
+            // After a frame that was late by more than a period, start over
+            // instead of catching up with short frames.
+            if (next_frame_ < now)
+            {
+                next_frame_ = now + frame_period_;
+            }
+        }
+
+        pending_ += now - last_step_;
+        last_step_ = now;
+        const int64_t steps = pending_ / step_;
+        if (steps > kMaxStepsPerFrame)
+        {
+            pending_ %= step_;
+            simulated_time_ += kMaxStepsPerFrame * step_;
+            return kMaxStepsPerFrame;
+        }
+        pending_ -= steps * step_;
+        simulated_time_ += steps * step_;
+        return static_cast<int>(steps);
+    }
+
+    void FrameLoop::EndFrame()
+    {
+        const Clock::time_point now = Clock::now();
+        const std::chrono::nanoseconds frame_time = now - last_frame_end_;
+        last_frame_end_ = now;
+        if (frame_times_.size() < kFrameTimeHistory)
+        {
+            frame_times_.push_back(frame_time);
+        }
+        else
+        {
+            frame_times_[frames_ % kFrameTimeHistory] = frame_time;
+        }
+        frames_++;
+    }
+
+    std::chrono::nanoseconds FrameLoop::FrameTimePercentile(double percentile) const
+    {
+        if (frame_times_.empty())
+        {
+            return std::chrono::nanoseconds(0);
+        }
+        std::vector<std::chrono::nanoseconds> times = frame_times_;
+        const double rank = std::clamp(percentile, 0.0, 100.0) / 100 * (times.size() - 1);
+        const auto nth = times.begin() + static_cast<ptrdiff_t>(std::lround(rank));
+        std::nth_element(times.begin(), nth, times.end());
+        return *nth;
+    }
+
+    // Fills spans of a surface with a fill style: a solid color or an 8x8
+    // pattern, whose origin is at (origin_x, origin_y).
+    class Drawer::SpanFiller
+    {
+    public:
+        // Blends the translucent colors if `blend`.
+        SpanFiller(const SurfaceView &surface, FillPattern pattern, Color bg, Color fg, int origin_x, int origin_y, bool blend = false)
+            : pixels_(surface.pixels),
+              stride_(surface.stride),
+              origin_x_(origin_x),
+              origin_y_(origin_y)
+        {
+            solid_ = pattern == fill_patterns::SolidBg || pattern == fill_patterns::SolidFg || bg == fg;
+            if (solid_)
+            {
+                rows_[0] = pattern == fill_patterns::SolidFg ? fg : bg;
+                blend_ = blend && GetAlpha(rows_[0]) != 0xff;
+                if (blend_)
+                {
+                    rows_[0] = spans::Premultiply(rows_[0]);
+                }
+                return;
+            }
+            blend_ = blend && (GetAlpha(bg) != 0xff || GetAlpha(fg) != 0xff);
+            if (blend_)
+            {
+                bg = spans::Premultiply(bg);
+                fg = spans::Premultiply(fg);
+            }
+            for (int row = 0; row < 8; row++)
+            {
+                for (int col = 0; col < 8; col++)
+                {
+                    rows_[row * 8 + col] = IsFg(pattern, col, row) ? fg : bg;
+                }
+            }
+        }
+
+        // Whether every pixel is set to color().
+        bool solid() const { return solid_ && !blend_; }
+        Color color() const { return rows_[0]; }
+        // Whether filling a pixel twice changes it again.
+        bool blends() const { return blend_; }
+
+        void operator()(int x, int y, int n) const
+        {
+            Color *dst = pixels_ + static_cast<ptrdiff_t>(y) * stride_ + x;
+            if (blend_)
+            {
+                Blend(dst, x, y, n);
+                return;
+            }
+            if (solid_)
+            {
+                if (n < kMinKernelSpan)
+                    std::fill(dst, dst + n, rows_[0]);
+                else
+                    spans::Fill(dst, n, rows_[0]);
+                return;
+            }
+
+            const Color *row = &rows_[((y - origin_y_) & 7) * 8];
+            const int phase = (x - origin_x_) & 7;
+            if (n < kMinKernelSpan)
+            {
+                for (int i = 0; i < n; i++)
+                    dst[i] = row[(phase + i) & 7];
+            }
+            else
+            {
+                spans::FillPattern(dst, n, row, phase);
+            }
+        }
+
+    private:
+        // Shorter spans are not worth calling a vectorized kernel for.
+        static constexpr int kMinKernelSpan = 16;
+
+        void Blend(Color *dst, int x, int y, int n) const
+        {
+            if (solid_)
+            {
+                if (rows_[0] == 0)
+                {
+                    // Transparent.
+                    return;
+                }
+                if (n < kMinKernelSpan)
+                {
+                    for (int i = 0; i < n; i++)
+                        dst[i] = spans::BlendPixel(dst[i], rows_[0]);
+                }
+                else
+                {
+                    spans::Blend(dst, n, rows_[0]);
+                }
+                return;
+            }
+
+            const Color *row = &rows_[((y - origin_y_) & 7) * 8];
+            const int phase = (x - origin_x_) & 7;
+            if (n < kMinKernelSpan)
+            {
+                for (int i = 0; i < n; i++)
+                    dst[i] = spans::BlendPixel(dst[i], row[(phase + i) & 7]);
+            }
+            else
+            {
+                spans::BlendPattern(dst, n, row, phase);
+            }
+        }
+
+        Color *pixels_;
+        int stride_;
+        int origin_x_;
+        int origin_y_;
+        bool solid_;
+        // Whether the colors are premultiplied and blended.
+        bool blend_;
+        // The pattern expanded to colors, 8 rows of 8 pixels.
+        std::array<Color, 64> rows_;
+    };
+
+    // Sets pixels to a color, or blends it over them, for the outlines, text
+    // and SetPixel().
+    class Drawer::PixelWriter
+    {
+    public:
+        // Blends `c` if `blend` and it is translucent.
+        PixelWriter(Color c, bool blend)
+            : blend_(blend && GetAlpha(c) != 0xff), color_(blend_ ? spans::Premultiply(c) : c)
+        {
+        }
+
+        // Whether writing a pixel twice changes it again.
+        bool blends() const { return blend_; }
+
+        void operator()(Color &pixel) const
+        {
+            pixel = blend_ ? spans::BlendPixel(pixel, color_) : color_;
+        }
+
+        void Span(Color *dst, int n) const
+        {
+            if (blend_)
+            {
+                spans::Blend(dst, n, color_);
+            }
+            else
+            {
+                spans::Fill(dst, n, color_);
+            }
+        }
+
+        // Like spans::FillMasked().
+        void Masked(Color *dst, int n, const uint8_t *mask, int bit_offset) const
+        {
+            if (blend_)
+            {
+                spans::BlendMasked(dst, n, mask, bit_offset, color_);
+            }
+            else
+            {
+                spans::FillMasked(dst, n, mask, bit_offset, color_);
+            }
+        }
+
+    private:
+        bool blend_;
+        Color color_;
+    };
+
+    Drawer::Drawer(const SurfaceView &surface)
+        : Drawer(surface, Rect(0, 0, surface.w, surface.h))
+    {
+    }
+
+    Drawer::Drawer(const SurfaceView &surface, const Rect &viewport)
+        : surface_(surface), viewport_(viewport), clip_(Intersect(viewport, Rect(0, 0, surface.w, surface.h)))
+    {
+    }
+
+    Drawer::Drawer(TileRenderer &renderer)
+        : Drawer(renderer.surface())
+    {
+        tiles_ = &renderer;
+    }
+
+    Drawer::Drawer(DisplayList &list)
+        : viewport_(0, 0, list.width(), list.height()), clip_(viewport_)
+    {
+        list_ = &list;
+    }
+
+    Drawer::~Drawer() = default;
+
+    Drawer Drawer::Viewport(int x, int y, int w, int h)
+    {
+        Drawer d = *this;
+        d.viewport_.x += x;
+        d.viewport_.y += y;
+        d.viewport_.w = w;
+        d.viewport_.h = h;
+        d.clip_ = Intersect(clip_, d.viewport_);
+        return d;
+    }
+
+    Color *Drawer::GetPixelPtr(int x, int y) const
+    {
+        if (list_)
+        {
+            // A display list has no pixels.
+            return nullptr;
+        }
+        x += viewport_.x;
+        y += viewport_.y;
+
+        if (x < clip_.x || y < clip_.y || x >= clip_.x + clip_.w || y >= clip_.y + clip_.h)
+        {
+            return nullptr;
+        }
+
+        return surface_.row(y) + x;
+    }
+
+    void Drawer::AddDamage(const Rect &rect)
+    {
+        if (surface_.damage)
+        {
+            surface_.damage->Add(Rect(rect.x + surface_.origin.x, rect.y + surface_.origin.y, rect.w, rect.h));
+        }
+    }
+
+    void Drawer::Defer(const Rect &bounds, std::function<void(Drawer &)> draw) const
+    {
+        Drawer drawer = *this;
+        drawer.tiles_ = nullptr;
+        drawer.thread_pool_ = nullptr;
+        drawer.surface_.damage = nullptr;
+        const uint32_t index = tiles_->commands_.size();
+        tiles_->commands_.push_back({drawer, std::move(draw)});
+
+        const int size = TileRenderer::kTileSize;
+        for (int ty = bounds.y / size; ty <= (bounds.y + bounds.h - 1) / size; ty++)
+        {
+            for (int tx = bounds.x / size; tx <= (bounds.x + bounds.w - 1) / size; tx++)
+            {
+                tiles_->bins_[ty * tiles_->tiles_x_ + tx].push_back(index);
+            }
+        }
+    }
+
+    template <typename Rasterize, typename Redraw>
+    int64_t Drawer::BlendOutline(const Rect &bounds, const Rasterize &rasterize, const Redraw &redraw)
+    {
+        if (bounds.w == 0)
+        {
+            return 0;
+        }
+        AddDamage(bounds);
+        if (tiles_)
+        {
+            Defer(bounds, redraw);
+            return 0;
+        }
+        const PixelWriter write = GetPixelWriter(draw_color_);
+        int64_t written = 0;
+        DrawPixels(true, rasterize, [&surface = surface_, &write, &written](int x, int y)
+                   {
+                       write(surface.row(y)[x]);
+                       written++;
+                   });
+        return written;
+    }
+
+    Color Drawer::GetPixel(int x, int y) const
+    {
+        if (Color *pixel = GetPixelPtr(x, y))
+        {
+            return *pixel;
+        }
+        return basic_colors::Black;
+    }
+
+    void Drawer::SetPixel(int x, int y, Color c)
+    {
+        if (list_)
+        {
+            list_->Record(*this, DisplayList::Op::kSetPixel, {x, y, Int(c)});
+            return;
+        }
+        Probe probe(Primitive::kSetPixel);
+        Color *pixel = GetPixelPtr(x, y);
+        probe.Clipped(pixel ? 0 : 1);
+        if (pixel)
+        {
+            const Rect bounds(x + viewport_.x, y + viewport_.y, 1, 1);
+            AddDamage(bounds);
+            if (tiles_)
+            {
+                Defer(bounds, [=](Drawer &d)
+                      { d.SetPixel(x, y, c); });
+                return;
+            }
+            GetPixelWriter(c)(*pixel);
+            probe.Written(1);
+        }
+    }
+
+    void Drawer::Clear(Color c)
+    {
+        if (list_)
+        {
+            list_->Record(*this, DisplayList::Op::kClear, {Int(c)});
+            return;
+        }
+        Probe probe(Primitive::kClear);
+        Drawer d = *this;
+        d.SetFillStyle(c);
+        d.SetBlendMode(BlendMode::kCopy);
+        d.FillRect(0, 0, viewport_.w, viewport_.h);
+    }
+
+    void Drawer::DrawRect(int x, int y, int w, int h)
+    {
+        if (list_)
+        {
+            list_->Record(*this, DisplayList::Op::kDrawRect, {x, y, w, h});
+            return;
+        }
+        Probe probe(Primitive::kDrawRect);
+        DrawPoly(x, y,
+                 x + w - 1, y,
+                 x + w - 1, y + h - 1,
+                 x, y + h - 1);
+    }
+
+    void Drawer::FillRect(int x, int y, int w, int h)
+    {
+        if (list_)
+        {
+            list_->Record(*this, DisplayList::Op::kFillRect, {x, y, w, h});
+            return;
+        }
+        Probe probe(Primitive::kFillRect);
+        const Rect r = ClipRect(x + viewport_.x, y + viewport_.y, w, h, clip_, probe);
+        if (r.w == 0)
+        {
+            return;
+        }
+        AddDamage(r);
+        if (tiles_)
+        {
+            Defer(r, [=](Drawer &d)
+                  { d.FillRect(x, y, w, h); });
+            return;
+        }
+
+        const SpanFiller fill_span = GetSpanFiller();
+        const int64_t area = int64_t{r.w} * r.h;
+        probe.Written(area);
+        const bool stream = fill_span.solid() && area >= kStreamFillPixels;
+        auto fill_rows = [&](int row_begin, int row_end)
+        {
+            const int64_t n = int64_t{r.w} * (row_end - row_begin);
+            if (fill_span.solid() && r.w == surface_.stride && n <= std::numeric_limits<int>::max())
+            {
+                // The rows are contiguous, fill them as one span.
+                (stream ? spans::FillStream : spans::Fill)(surface_.row(row_begin), Int(n), fill_span.color());
+            }
+            else if (stream)
+            {
+                for (int y = row_begin; y < row_end; y++)
+                {
+                    spans::FillStream(surface_.row(y) + r.x, r.w, fill_span.color());
+                }
+            }
+            else
+            {
+                FillRectTempl(r.x, row_begin, r.w, row_end - row_begin, clip_, fill_span);
+            }
+        };
+
+        if (thread_pool_ && area >= kParallelFillPixels)
+        {
+            const int chunks = std::min(r.h, thread_pool_->size() * 4);
+            thread_pool_->ParallelFor(chunks, [&](int i)
+                                      { fill_rows(r.y + Int(int64_t{r.h} * i / chunks), r.y + Int(int64_t{r.h} * (i + 1) / chunks)); });
+            return;
+        }
+        fill_rows(r.y, r.y + r.h);
+    }
+
+    void Drawer::FillRect(const Rect &rect)
+    {
+        FillRect(rect.x, rect.y, rect.w, rect.h);
+    }
+
+    void Drawer::DrawRoundedRect(int x, int y, int w, int h, int rx, int ry)
+    {
+        if (list_)
+        {
+            list_->Record(*this, DisplayList::Op::kDrawRoundedRect, {x, y, w, h, rx, ry});
+            return;
+        }
+        Probe probe(Primitive::kDrawRoundedRect);
+        int m = std::min(w, h) / 2;
+        rx = std::min(rx, m);
+        ry = std::min(ry, m);
+
+        int x2 = x + w - 1;
+        int y2 = y + h - 1;
+        if (GetPixelWriter(draw_color_).blends())
+        {
+            // The arcs and lines meet at the ends of the corners. The pixels
+            // are those of the calls below, which draw no arcs if a radius is
+            // negative enough for their boxes to be empty.
+            const int dx = viewport_.x;
+            const int dy = viewport_.y;
+            const Point centers[] = {{x + rx, y + ry}, {x + rx, y2 - ry}, {x2 - rx, y + ry}, {x2 - rx, y2 - ry}};
+            const int angles[] = {90, 180, 0, 270};
+            const Point ends[] = {{x + rx, y}, {x2 - rx, y}, {x + rx, y2}, {x2 - rx, y2},
+                                  {x, y + ry}, {x, y2 - ry}, {x2, y + ry}, {x2, y2 - ry}};
+            const bool arcs = rx >= -1 && ry >= -1;
+            Box box = BoundingBox(ends, 8, dx, dy);
+            if (arcs)
+            {
+                const Box arcs_box = BoundingBox(centers, 4, dx, dy);
+                box = {std::min(box.x1, arcs_box.x1 - rx - 1), std::min(box.y1, arcs_box.y1 - ry - 1),
+                       std::max(box.x2, arcs_box.x2 + rx + 1), std::max(box.y2, arcs_box.y2 + ry + 1)};
+            }
+            const Rect bounds = Intersect(box, clip_);
+            probe.Clipped(box, bounds);
+            probe.Written(BlendOutline(
+                bounds, [&](const auto &draw_pixel)
+                {
+                    for (int i = 0; arcs && i < 4; i++)
+                    {
+                        DrawEllipseTempl(centers[i].x + dx, centers[i].y + dy, rx, ry, EllipseArc(rx, ry, angles[i], angles[i] + 90), clip_, draw_pixel);
+                    }
+                    for (int i = 0; i < 8; i += 2)
+                    {
+                        DrawLineTempl(ends[i].x + dx, ends[i].y + dy, ends[i + 1].x + dx, ends[i + 1].y + dy, clip_, draw_pixel);
+                    }
+                },
+                [=](Drawer &d)
+                { d.DrawRoundedRect(x, y, w, h, rx, ry); }));
+            return;
+        }
+        DrawEllipse(x + rx, y + ry, rx, ry, 90, 180);
+        DrawEllipse(x + rx, y2 - ry, rx, ry, 180, 270);
+        DrawEllipse(x2 - rx, y + ry, rx, ry, 0, 90);
+        DrawEllipse(x2 - rx, y2 - ry, rx, ry, 270, 360);
+        DrawLine(x + rx, y, x2 - rx, y);
+        DrawLine(x + rx, y2, x2 - rx, y2);
+        DrawLine(x, y + ry, x, y2 - ry);
+        DrawLine(x2, y + ry, x2, y2 - ry);
+    }
+
+    void Drawer::FillRoundedRect(int x, int y, int w, int h, int rx, int ry)
+    {
+        if (list_)
+        {
+            list_->Record(*this, DisplayList::Op::kFillRoundedRect, {x, y, w, h, rx, ry});
+            return;
+        }
+        Probe probe(Primitive::kFillRoundedRect);
+        const Rect bounds = ClipRect(x + viewport_.x, y + viewport_.y, w, h, clip_, probe);
+        if (bounds.w == 0)
+        {
+            return;
+        }
+        AddDamage(bounds);
+        if (tiles_)
+        {
+            Defer(bounds, [=](Drawer &d)
+                  { d.FillRoundedRect(x, y, w, h, rx, ry); });
+            return;
+        }
+
+        int m = std::min(w, h) / 2;
+        rx = std::max(std::min(rx, m), 0);
+        ry = std::max(std::min(ry, m), 0);
+
+        x += viewport_.x;
+        y += viewport_.y;
+        const SpanFiller fill_span = GetSpanFiller();
+        FillRoundedRectTempl(x, y, w, h, rx, ry, clip_, CountWritten(probe, fill_span));
+    }
+
+    // PointPair GetEllipticalArcEndpoints(int x, int y, int w, int h, int angle1 = 0, int angle2 = 360);
+    void Drawer::DrawEllipse(int x, int y, int rx, int ry, int angle1, int angle2)
+    {
+        if (list_)
+        {
+            list_->Record(*this, DisplayList::Op::kDrawEllipse, {x, y, rx, ry, angle1, angle2});
+            return;
+        }
+        Probe probe(Primitive::kDrawEllipse);
+        const Box box = EllipseBox(x + viewport_.x, y + viewport_.y, rx, ry);
+        const Rect bounds = Intersect(box, clip_);
+        probe.Clipped(box, bounds);
+        if (bounds.w == 0)
+        {
+            return;
+        }
+        AddDamage(bounds);
+        if (tiles_)
+        {
+            Defer(bounds, [=](Drawer &d)
+                  { d.DrawEllipse(x, y, rx, ry, angle1, angle2); });
+            return;
+        }
+
+        x += viewport_.x;
+        y += viewport_.y;
+
+        const PixelWriter write = GetPixelWriter(draw_color_);
+        DrawPixels(
+            write.blends(), [&](const auto &draw_pixel)
+            { DrawEllipseTempl(x, y, rx, ry, EllipseArc(rx, ry, angle1, angle2), clip_, draw_pixel); },
+            [&surface = surface_, &probe, &write](int px, int py)
+            {
+                write(surface.row(py)[px]);
+                probe.Written(1);
+            });
+    }
+
+    void Drawer::FillEllipse(int x, int y, int rx, int ry, int angle1, int angle2)
+    {
+        if (list_)
+        {
+            list_->Record(*this, DisplayList::Op::kFillEllipse, {x, y, rx, ry, angle1, angle2});
+            return;
+        }
+        Probe probe(Primitive::kFillEllipse);
+        const Box box = EllipseBox(x + viewport_.x, y + viewport_.y, rx, ry);
+        const Rect bounds = Intersect(box, clip_);
+        probe.Clipped(box, bounds);
+        if (bounds.w == 0)
+        {
+            return;
+        }
+        AddDamage(bounds);
+        if (tiles_)
+        {
+            Defer(bounds, [=](Drawer &d)
+                  { d.FillEllipse(x, y, rx, ry, angle1, angle2); });
+            return;
+        }
+
+        x += viewport_.x;
+        y += viewport_.y;
+
+        const SpanFiller fill_span = GetSpanFiller();
+        FillSpans(
+            fill_span.blends(), [&](const auto &fill)
+            { FillEllipseTempl(x, y, rx, ry, EllipseArc(rx, ry, angle1, angle2), clip_, fill); },
+            CountWritten(probe, fill_span));
+    }
+
+    void Drawer::DrawLine(int x1, int y1, int x2, int y2)
+    {
+        if (list_)
+        {
+            list_->Record(*this, DisplayList::Op::kDrawLine, {x1, y1, x2, y2});
+            return;
+        }
+        Probe probe(Primitive::kDrawLine);
+        const Box box = LineBox(x1 + viewport_.x, y1 + viewport_.y, x2 + viewport_.x, y2 + viewport_.y);
+        const Rect bounds = Intersect(box, clip_);
+        probe.Clipped(box, bounds);
+        if (bounds.w == 0)
+        {
+            return;
+        }
+        AddDamage(bounds);
+        if (tiles_)
+        {
+            Defer(bounds, [=](Drawer &d)
+                  { d.DrawLine(x1, y1, x2, y2); });
+            return;
+        }
+
+        x1 += viewport_.x;
+        y1 += viewport_.y;
+        x2 += viewport_.x;
+        y2 += viewport_.y;
+
+        const Rect &clip = clip_;
+        const SurfaceView &surface = surface_;
+        const PixelWriter write = GetPixelWriter(draw_color_);
+        if (y1 == y2)
+        {
+            if (y1 < clip.y || y1 >= clip.y + clip.h)
+            {
+                return;
+            }
+            const int begin = std::max(std::min(x1, x2), clip.x);
+            const int end = std::min(std::max(x1, x2), clip.x + clip.w - 1);
+            if (begin <= end)
+            {
+                write.Span(surface.row(y1) + begin, end - begin + 1);
+                probe.Written(end - begin + 1);
+            }
+            return;
+        }
+        if (x1 == x2)
+        {
+            if (x1 < clip.x || x1 >= clip.x + clip.w)
+            {
+                return;
+            }
+            const int begin = std::max(std::min(y1, y2), clip.y);
+            const int end = std::min(std::max(y1, y2), clip.y + clip.h - 1);
+            for (int y = begin; y <= end; y++)
+            {
+                write(surface.row(y)[x1]);
+            }
+            probe.Written(std::max(end - begin + 1, 0));
+            return;
+        }
+
+        DrawLineTempl(x1, y1, x2, y2, clip,
+                      [&surface, &probe, &write](int x, int y)
+                      {
+                          write(surface.row(y)[x]);
+                          probe.Written(1);
+                      });
+    }
+
+    Drawer::SpanFiller Drawer::GetSpanFiller() const
+    {
+        return SpanFiller(surface_, fill_pattern_, fill_bg_color_, fill_fg_color_, viewport_.x, viewport_.y,
+                          blend_mode_ == BlendMode::kSourceOver);
+    }
+
+    Drawer::PixelWriter Drawer::GetPixelWriter(Color c) const
+    {
+        return PixelWriter(c, blend_mode_ == BlendMode::kSourceOver);
+    }
+
+    void Drawer::SetPixelWithFillPattern(int x, int y)
+    {
+        SetPixel(x, y, IsFg(fill_pattern_, x, y) ? fill_fg_color_ : fill_bg_color_);
+    }
+
+    void Drawer::DrawOpenPoly(PolygonView polygon)
+    {
+        if (list_)
+        {
+            list_->Record(*this, DisplayList::Op::kDrawOpenPoly, {}, polygon);
+            return;
+        }
+        Probe probe(Primitive::kDrawOpenPoly);
+        if (polygon.empty() || IsOutside(BoundingBox(polygon, viewport_.x, viewport_.y), clip_))
+        {
+            return;
+        }
+        if (GetPixelWriter(draw_color_).blends())
+        {
+            // The lines meet at the vertices.
+            const Rect bounds = Intersect(BoundingBox(polygon, viewport_.x, viewport_.y), clip_);
+            probe.Written(BlendOutline(
+                bounds, [&](const auto &draw_pixel)
+                {
+                    // A single point is a line to itself.
+                    for (size_t i = 0; i == 0 || i + 1 < polygon.size(); i++)
+                    {
+                        const Point p = polygon[i];
+                        const Point q = polygon[std::min(i + 1, polygon.size() - 1)];
+                        DrawLineTempl(p.x + viewport_.x, p.y + viewport_.y, q.x + viewport_.x, q.y + viewport_.y, bounds, draw_pixel);
+                    }
+                },
+                [polygon = std::vector<Point>(polygon.begin(), polygon.end())](Drawer &d)
+                { d.DrawOpenPoly(polygon); }));
+            return;
+        }
+        if (polygon.size() == 1)
+        {
+            Point p = polygon.back();
+            DrawLine(p.x, p.y, p.x, p.y);
+            return;
+        }
+        for (int i = 0; i < Int(polygon.size()) - 1; i++)
+        {
+            Point p = polygon[i];
+            Point q = polygon[i + 1];
+            DrawLine(p.x, p.y, q.x, q.y);
+        }
+    }
+
+    void Drawer::DrawPoly(PolygonView polygon)
+    {
+        if (list_)
+        {
+            list_->Record(*this, DisplayList::Op::kDrawPoly, {}, polygon);
+            return;
+        }
+        Probe probe(Primitive::kDrawPoly);
+        if (polygon.size() == 0)
+        {
+            BGI_WARN("Warning: Polygon size = 0");
+            return;
+        }
+        if (IsOutside(BoundingBox(polygon, viewport_.x, viewport_.y), clip_))
+        {
+            return;
+        }
+        if (GetPixelWriter(draw_color_).blends())
+        {
+            // The lines meet at the vertices.
+            const Rect bounds = Intersect(BoundingBox(polygon, viewport_.x, viewport_.y), clip_);
+            probe.Written(BlendOutline(
+                bounds, [&](const auto &draw_pixel)
+                { DrawClosedPolyTempl(polygon.data(), polygon.size(), viewport_.x, viewport_.y, bounds, draw_pixel); },
+                [polygon = std::vector<Point>(polygon.begin(), polygon.end())](Drawer &d)
+                { d.DrawPoly(polygon); }));
+            return;
+        }
+        Point p = polygon.back();
+        for (Point q : polygon)
+        {
+            DrawLine(p.x, p.y, q.x, q.y);
+            p = q;
+        }
+    }
+
+    void Drawer::DrawPoly(PolygonView polygon, const Affine &transform)
+    {
+        if (list_)
+        {
+            list_->Record(*this, DisplayList::Op::kDrawPolyAffine,
+                          {FloatBits(transform.a), FloatBits(transform.b), FloatBits(transform.c), FloatBits(transform.d), FloatBits(transform.tx), FloatBits(transform.ty)},
+                          polygon);
+            return;
+        }
+        Probe probe(Primitive::kDrawPoly);
+        if (polygon.size() == 0)
+        {
+            BGI_WARN("Warning: Polygon size = 0");
+            return;
+        }
+        // The transformed points, reused from call to call.
+        thread_local std::vector<Point> points;
+        points.resize(polygon.size());
+        transform.Apply(polygon.data(), polygon.size(), points.data());
+        if (IsOutside(BoundingBox(points.data(), points.size(), viewport_.x, viewport_.y), clip_))
+        {
+            return;
+        }
+        if (GetPixelWriter(draw_color_).blends())
+        {
+            const Rect bounds = Intersect(BoundingBox(points.data(), points.size(), viewport_.x, viewport_.y), clip_);
+            probe.Written(BlendOutline(
+                bounds, [&](const auto &draw_pixel)
+                { DrawClosedPolyTempl(points.data(), points.size(), viewport_.x, viewport_.y, bounds, draw_pixel); },
+                [polygon = std::vector<Point>(points.begin(), points.end())](Drawer &d)
+                { d.DrawPoly(polygon); }));
+            return;
+        }
+        Point p = points.back();
+        for (Point q : points)
+        {
+            DrawLine(p.x, p.y, q.x, q.y);
+            p = q;
+        }
+    }
+
+    void Drawer::FillPoly(PolygonView polygon)
+    {
+        if (list_)
+        {
+            list_->Record(*this, DisplayList::Op::kFillPoly, {}, polygon);
+            return;
+        }
+        Probe probe(Primitive::kFillPoly);
+        if (polygon.size() >= 3)
+        {
+            const Box box = BoundingBox(polygon, viewport_.x, viewport_.y);
+            const Rect bounds = Intersect(box, clip_);
+            probe.Clipped(box, bounds);
+            if (bounds.w == 0)
+            {
+                return;
+            }
+            AddDamage(bounds);
+            if (tiles_)
+            {
+                Defer(bounds, [polygon = std::vector<Point>(polygon.begin(), polygon.end())](Drawer &d)
+                      { d.FillPoly(polygon); });
+                return;
+            }
+        }
+        const SpanFiller fill_span = GetSpanFiller();
+        FillSpans(
+            fill_span.blends(), [&](const auto &fill)
+            { FillPolygonTempl(polygon.data(), polygon.size(), viewport_.x, viewport_.y, clip_, fill); },
+            CountWritten(probe, fill_span));
+    }
+
+    void Drawer::FillPoly(PolygonView polygon, const Affine &transform)
+    {
+        if (list_)
+        {
+            list_->Record(*this, DisplayList::Op::kFillPolyAffine,
+                          {FloatBits(transform.a), FloatBits(transform.b), FloatBits(transform.c), FloatBits(transform.d), FloatBits(transform.tx), FloatBits(transform.ty)},
+                          polygon);
+            return;
+        }
+        Probe probe(Primitive::kFillPoly);
+        if (polygon.size() < 3)
+        {
+            BGI_WARN("Warning: Polygon size: %d < 3", Int(polygon.size()));
+            return;
+        }
+        // The transformed points, reused from call to call.
+        thread_local std::vector<Point> points;
+        points.resize(polygon.size());
+        transform.Apply(polygon.data(), polygon.size(), points.data());
+
+        const Box box = BoundingBox(points.data(), points.size(), viewport_.x, viewport_.y);
+        const Rect bounds = Intersect(box, clip_);
+        probe.Clipped(box, bounds);
+        if (bounds.w == 0)
+        {
+            return;
+        }
+        AddDamage(bounds);
+        if (tiles_)
+        {
+            Defer(bounds, [polygon = std::vector<Point>(polygon.begin(), polygon.end()), transform](Drawer &d)
+                  { d.FillPoly(polygon, transform); });
+            return;
+        }
+        const SpanFiller fill_span = GetSpanFiller();
+        FillSpans(
+            fill_span.blends(), [&](const auto &fill)
+            { FillPolygonTempl(points.data(), points.size(), viewport_.x, viewport_.y, clip_, fill); },
+            CountWritten(probe, fill_span));
+    }
+
+    void Drawer::FillShape(const RasterizedShape &shape)
+    {
+        if (list_)
+        {
+            list_->Record(*this, DisplayList::Op::kFillShape, {list_->AddShape(shape)});
+            return;
+        }
+        Probe probe(Primitive::kFillShape);
+        if (shape.empty())
+        {
+            return;
+        }
+        const Rect &shape_bounds = shape.bounds();
+        const Rect bounds = ClipRect(shape_bounds.x + viewport_.x, shape_bounds.y + viewport_.y, shape_bounds.w, shape_bounds.h, clip_, probe);
+        if (bounds.w == 0)
+        {
+            return;
+        }
+        AddDamage(bounds);
+        if (tiles_)
+        {
+            Defer(bounds, [shape](Drawer &d)
+                  { d.FillShape(shape); });
+            return;
+        }
+
+        // Only visit the spans of the visible rows.
+        const std::vector<RasterizedShape::Span> &spans = shape.spans();
+        auto span = std::lower_bound(spans.begin(), spans.end(), bounds.y - viewport_.y,
+                                     [](const RasterizedShape::Span &span, int y)
+                                     { return span.y < y; });
+        const int row_end = bounds.y + bounds.h - viewport_.y;
+        const int x_begin = bounds.x - viewport_.x;
+        const int x_end = bounds.x + bounds.w - viewport_.x;
+        const SpanFiller fill_span = GetSpanFiller();
+        for (; span != spans.end() && span->y < row_end; ++span)
+        {
+            const int begin = std::max(span->x, x_begin);
+            const int end = std::min(span->x + span->n, x_end);
+            if (begin < end)
+            {
+                probe.Written(end - begin);
+                fill_span(begin + viewport_.x, span->y + viewport_.y, end - begin);
+            }
+        }
+    }
+
+    namespace
+    {
+        // Returns a copy of the part of `surface` in `rect`, which is inside
+        // it.
+        Surface CopyRect(const Surface &surface, const Rect &rect)
+        {
+            Surface copy(rect.w, rect.h);
+            for (int y = 0; y < rect.h; y++)
+            {
+                std::memcpy(copy.row(y), surface.row(rect.y + y) + rect.x, rect.w * sizeof(Color));
+            }
+            return copy;
+        }
+    } // namespace
+
+    void Drawer::Blit(const Surface &surface, const Rect &src, int x, int y)
+    {
+        BlitWithMode(surface, src, x, y, BlitMode::kCopy, 0);
+    }
+
+    void Drawer::BlitKeyed(const Surface &surface, const Rect &src, int x, int y, Color key)
+    {
+        BlitWithMode(surface, src, x, y, BlitMode::kKeyed, key);
+    }
+
+    void Drawer::BlitBlended(const Surface &surface, const Rect &src, int x, int y)
+    {
+        BlitWithMode(surface, src, x, y, BlitMode::kBlended, 0);
+    }
+
+    void Drawer::BlitWithMode(const Surface &surface, const Rect &src, int x, int y, BlitMode mode, Color key)
+    {
+        // The part of `src` inside `surface`, and where it goes.
+        const Rect from = Intersect(src, Rect(0, 0, surface.w, surface.h));
+        const int64_t to_x = int64_t{x} + from.x - src.x;
+        const int64_t to_y = int64_t{y} + from.y - src.y;
+        if (list_)
+        {
+            if (from.w > 0)
+            {
+                list_->Record(*this, DisplayList::Op::kBlit,
+                              {list_->AddImage(CopyRect(surface, from)), Int(to_x), Int(to_y), static_cast<int>(mode), Int(key)});
+            }
+            return;
+        }
+        Probe probe(Primitive::kBlit);
+        if (from.w == 0)
+        {
+            return;
+        }
+        const Box box{to_x + viewport_.x, to_y + viewport_.y, to_x + viewport_.x + from.w - 1, to_y + viewport_.y + from.h - 1};
+        const Rect bounds = Intersect(box, clip_);
+        probe.Clipped(box, bounds);
+        if (bounds.w == 0)
+        {
+            return;
+        }
+        AddDamage(bounds);
+        // Whether the pixels are in the surface drawn to.
+        const Color *begin = surface.pixels.data();
+        const bool aliased = !std::less<const Color *>()(surface_.pixels, begin) && std::less<const Color *>()(surface_.pixels, begin + surface.pixels.size());
+        if (tiles_)
+        {
+            if (aliased)
+            {
+                // The tiles would read pixels that other tiles write, so copy
+                // them now, once the calls queued before have drawn them.
+                tiles_->Flush();
+                Defer(bounds, [image = CopyRect(surface, from), to_x = Int(to_x), to_y = Int(to_y), mode, key](Drawer &d)
+                      { d.BlitWithMode(image, Rect(0, 0, image.w, image.h), to_x, to_y, mode, key); });
+                return;
+            }
+            Defer(bounds, [&surface, src, x, y, mode, key](Drawer &d)
+                  { d.BlitWithMode(surface, src, x, y, mode, key); });
+            return;
+        }
+
+        const Surface *source = &surface;
+        Rect rect(from.x + Int(bounds.x - box.x1), from.y + Int(bounds.y - box.y1), bounds.w, bounds.h);
+        // Copy the pixels first if they are in the surface drawn to, where
+        // the rows may overlap.
+        Surface copy;
+        if (aliased)
+        {
+            copy = CopyRect(surface, rect);
+            source = &copy;
+            rect.x = 0;
+            rect.y = 0;
+        }
+
+        probe.Written(int64_t{bounds.w} * bounds.h);
+        auto blit_rows = [&](auto blit_row)
+        {
+            for (int row = 0; row < bounds.h; row++)
+            {
+                blit_row(surface_.row(bounds.y + row) + bounds.x, source->row(rect.y + row) + rect.x);
+            }
+        };
+        switch (mode)
+        {
+        case BlitMode::kCopy:
+            blit_rows([&](Color *dst, const Color *pixels)
+                      { std::memcpy(dst, pixels, bounds.w * sizeof(Color)); });
+            break;
+        case BlitMode::kKeyed:
+            blit_rows([&](Color *dst, const Color *pixels)
+                      { spans::CopyKeyed(dst, pixels, bounds.w, key); });
+            break;
+        case BlitMode::kBlended:
+            blit_rows([&](Color *dst, const Color *pixels)
+                      { spans::BlendPixels(dst, pixels, bounds.w); });
+            break;
+        }
+    }
+
+    Rect Drawer::GetTextRect(int x, int y, std::string_view text)
+    {
+        return Rect(x, y, write_scale_x_ * 8 * text.size(), write_scale_y_ * 8);
+    }
+
+    void Drawer::Write(int x, int y, std::string_view text)
+    {
+        if (list_)
+        {
+            list_->Record(*this, DisplayList::Op::kWrite, {x, y}, PolygonView(), text);
+            return;
+        }
+        Probe probe(Primitive::kWrite);
+        const int scale_x = write_scale_x_;
+        const int scale_y = write_scale_y_;
+        if (scale_x <= 0 || scale_y <= 0)
+        {
+            return;
+        }
+
+        const int text_x = x + viewport_.x;
+        const int text_y = y + viewport_.y;
+
+        // Clip the whole string at once, so that only the visible rows and
+        // characters are visited.
+        const Rect &clip = clip_;
+        const int64_t char_w = 8 * scale_x;
+        const int row_begin = std::max(text_y, clip.y);
+        const int row_end = std::min(int64_t{text_y} + 8 * scale_y, int64_t{clip.y} + clip.h);
+        const int first = text_x >= clip.x ? 0 : Int((int64_t{clip.x} - text_x) / char_w);
+        const int last = Int(std::clamp<int64_t>((int64_t{clip.x} + clip.w - text_x + char_w - 1) / char_w, 0, text.size()));
+        const Box box{text_x, text_y, text_x + char_w * int64_t(text.size()) - 1, text_y + 8 * scale_y - 1};
+        if (row_begin >= row_end || first >= last)
+        {
+            probe.Clipped(box, Rect());
+            return;
+        }
+        const Rect bounds = Intersect(Box{text_x + first * char_w, row_begin, text_x + last * char_w - 1, row_end - 1}, clip);
+        probe.Clipped(box, bounds);
+        AddDamage(bounds);
+        if (tiles_)
+        {
+            Defer(bounds, [x, y, text = std::string(text)](Drawer &d)
+                  { d.Write(x, y, text); });
+            return;
+        }
+
+        const GlyphSet &glyphs = GetGlyphSet(bitmap_font_, scale_x);
+        const PixelWriter write = GetPixelWriter(write_color_);
+        for (int py = row_begin; py < row_end; py++)
+        {
+            const int row = (py - text_y) / scale_y;
+            Color *line = surface_.row(py);
+            for (int i = first; i < last; i++)
+            {
+                const uint8_t c = static_cast<uint8_t>(text[i]);
+                if (((bitmap_font_[c] >> (8 * (7 - row))) & 0xff) == 0)
+                {
+                    continue;
+                }
+                const int char_x = text_x + i * char_w;
+                const int begin = std::max(char_x, clip.x);
+                const int end = std::min(char_x + char_w, int64_t{clip.x} + clip.w);
+                write.Masked(line + begin, end - begin, glyphs.Row(c, row), begin - char_x);
+                probe.Written(end - begin);
+            }
+        }
+    }
+
+    void Drawer::WriteEx(int x, int y, std::string_view text, const Padding &padding, const Margin &margin, int rx, int ry)
+    {
+        if (list_)
+        {
+            list_->Record(*this, DisplayList::Op::kWriteEx,
+                          {x, y, padding.left, padding.right, padding.top, padding.bottom, margin.left, margin.right, margin.top, margin.bottom, rx, ry},
+                          PolygonView(), text);
+            return;
+        }
+        Probe probe(Primitive::kWriteEx);
+        Rect r = GetTextRect(x, y, text);
+        FillRoundedRect(r.x - padding.left - margin.left - 1,
+                        r.y - padding.top - margin.top - 1,
+                        r.w + padding.left + padding.right + margin.left + margin.right + 2,
+                        r.h + padding.top + padding.bottom + margin.top + margin.bottom + 2,
+                        rx, ry);
+        DrawRoundedRect(r.x - padding.left - 1,
+                        r.y - padding.top - 1,
+                        r.w + padding.left + padding.right + 2,
+                        r.h + padding.top + padding.bottom + 2,
+                        rx, ry);
+        Write(x, y, text);
+    }
+
+    void Drawer::SetDrawStyle(Color c)
+    {
+        draw_color_ = c;
+    }
+
+    void Drawer::SetFillStyle(Color c)
+    {
+        fill_bg_color_ = c;
+        fill_fg_color_ = c;
+        fill_pattern_ = basic_fill_patterns::SolidBg;
+    }
+
+    void Drawer::SetFillStyle(FillPattern pattern, Color bg, Color fg)
+    {
+        fill_bg_color_ = bg;
+        fill_fg_color_ = fg;
+        fill_pattern_ = pattern;
+    }
+
+    void Drawer::SetWriteStyle(Color c, int scale_x, int scale_y)
+    {
+        write_color_ = c;
+        write_scale_x_ = scale_x;
+        write_scale_y_ = scale_y;
+    }
+
+    TileRenderer::TileRenderer(const SurfaceView &surface, int threads)
+        : surface_(surface),
+          tiles_x_((surface.w + kTileSize - 1) / kTileSize),
+          tiles_y_((surface.h + kTileSize - 1) / kTileSize),
+          bins_(tiles_x_ * tiles_y_),
+          pool_(std::make_unique<ThreadPool>(threads))
+    {
+    }
+
+    TileRenderer::~TileRenderer()
+    {
+        Flush();
+    }
+
+    void TileRenderer::Flush()
+    {
+        std::vector<int> tiles;
+        for (int i = 0; i < Int(bins_.size()); i++)
+        {
+            if (!bins_[i].empty())
+            {
+                tiles.push_back(i);
+            }
+        }
+
+        pool_->ParallelFor(Int(tiles.size()), [&](int i)
+                           {
+            TileScope scope;
+            const int tile = tiles[i];
+            const Rect tile_rect(tile % tiles_x_ * kTileSize, tile / tiles_x_ * kTileSize, kTileSize, kTileSize);
+            for (uint32_t index : bins_[tile])
+            {
+                Command &command = commands_[index];
+                Drawer drawer = command.drawer;
+                drawer.clip_ = Intersect(drawer.clip_, tile_rect);
+                command.draw(drawer);
+            }
+            bins_[tile].clear(); });
+        commands_.clear();
+    }
+
+    namespace
+    {
+        bool IsOpaque(Color c)
+        {
+            return GetAlpha(c) == 0xff;
+        }
+
+        bool SameRect(const Rect &a, const Rect &b)
+        {
+            return a.x == b.x && a.y == b.y && a.w == b.w && a.h == b.h;
+        }
+
+        // Returns whether `inner` is inside `outer`.
+        bool Contains(const Rect &outer, const Rect &inner)
+        {
+            return inner.x >= outer.x && inner.y >= outer.y &&
+                   int64_t{inner.x} + inner.w <= int64_t{outer.x} + outer.w &&
+                   int64_t{inner.y} + inner.h <= int64_t{outer.y} + outer.h;
+        }
+
+        // Sets `a` to the union of `a` and `b` if that is a rect they tile.
+        bool MergeRects(Rect &a, const Rect &b)
+        {
+            if (a.w <= 0 || a.h <= 0 || b.w <= 0 || b.h <= 0)
+            {
+                return false;
+            }
+            if (a.y == b.y && a.h == b.h && int64_t{a.w} + b.w <= std::numeric_limits<int>::max() &&
+                (int64_t{a.x} + a.w == b.x || int64_t{b.x} + b.w == a.x))
+            {
+                a.x = std::min(a.x, b.x);
+                a.w += b.w;
+                return true;
+            }
+            if (a.x == b.x && a.w == b.w && int64_t{a.h} + b.h <= std::numeric_limits<int>::max() &&
+                (int64_t{a.y} + a.h == b.y || int64_t{b.y} + b.h == a.y))
+            {
+                a.y = std::min(a.y, b.y);
+                a.h += b.h;
+                return true;
+            }
+            return false;
+        }
+
+        // Optimize() compares each call with at most this many of the later
+        // calls covering it.
+        constexpr size_t kMaxCovers = 64;
+    } // namespace
+
+    DisplayList::DisplayList(int w, int h)
+        : size_(w, h)
+    {
+        Clear();
+    }
+
+    DisplayList::DisplayList(const Size &size)
+        : DisplayList(size.w, size.h)
+    {
+    }
+
+    void DisplayList::Clear()
+    {
+        words_.clear();
+        shapes_.clear();
+        images_.clear();
+        state_ = State();
+        state_.viewport = Rect(0, 0, size_.w, size_.h);
+        state_.clip = state_.viewport;
+        calls_ = 0;
+    }
+
+    int DisplayList::AddShape(const RasterizedShape &shape)
+    {
+        shapes_.push_back(shape);
+        return Int(shapes_.size() - 1);
+    }
+
+    int DisplayList::AddImage(Surface image)
+    {
+        images_.push_back(std::move(image));
+        return Int(images_.size() - 1);
+    }
+
+    void DisplayList::Append(Op op, std::initializer_list<uint32_t> args)
+    {
+        words_.push_back(static_cast<uint32_t>(op) | static_cast<uint32_t>(args.size()) << 8);
+        words_.insert(words_.end(), args);
+    }
+
+    void DisplayList::RecordState(const State &state)
+    {
+        if (state.draw_color != state_.draw_color)
+        {
+            Append(Op::kDrawStyle, {state.draw_color});
+        }
+        if (state.fill_pattern != state_.fill_pattern || state.fill_bg_color != state_.fill_bg_color || state.fill_fg_color != state_.fill_fg_color)
+        {
+            Append(Op::kFillStyle, {static_cast<uint32_t>(state.fill_pattern), static_cast<uint32_t>(state.fill_pattern >> 32),
+                                    state.fill_bg_color, state.fill_fg_color});
+        }
+        if (state.write_color != state_.write_color || state.write_scale_x != state_.write_scale_x || state.write_scale_y != state_.write_scale_y)
+        {
+            Append(Op::kWriteStyle, {state.write_color, static_cast<uint32_t>(state.write_scale_x), static_cast<uint32_t>(state.write_scale_y)});
+        }
+        if (state.blend_mode != state_.blend_mode)
+        {
+            Append(Op::kBlendMode, {static_cast<uint32_t>(state.blend_mode)});
+        }
+        if (!SameRect(state.viewport, state_.viewport) || !SameRect(state.clip, state_.clip))
+        {
+            const Rect &v = state.viewport;
+            const Rect &c = state.clip;
+            Append(Op::kViewport, {static_cast<uint32_t>(v.x), static_cast<uint32_t>(v.y), static_cast<uint32_t>(v.w), static_cast<uint32_t>(v.h),
+                                   static_cast<uint32_t>(c.x), static_cast<uint32_t>(c.y), static_cast<uint32_t>(c.w), static_cast<uint32_t>(c.h)});
+        }
+        state_ = state;
+    }
+
+    bool DisplayList::ApplyState(State &state, Op op, const uint32_t *args)
+    {
+        switch (op)
+        {
+        case Op::kDrawStyle:
+            state.draw_color = args[0];
+            return true;
+        case Op::kFillStyle:
+            state.fill_pattern = FillPattern{args[0]} | FillPattern{args[1]} << 32;
+            state.fill_bg_color = args[2];
+            state.fill_fg_color = args[3];
+            return true;
+        case Op::kWriteStyle:
+            state.write_color = args[0];
+            state.write_scale_x = Int(args[1]);
+            state.write_scale_y = Int(args[2]);
+            return true;
+        case Op::kViewport:
+            state.viewport = Rect(Int(args[0]), Int(args[1]), Int(args[2]), Int(args[3]));
+            state.clip = Rect(Int(args[4]), Int(args[5]), Int(args[6]), Int(args[7]));
+            return true;
+        case Op::kBlendMode:
+            state.blend_mode = static_cast<BlendMode>(args[0]);
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    void DisplayList::Record(const Drawer &drawer, Op op, std::initializer_list<int> args, PolygonView points, std::string_view text)
+    {
+        State state;
+        state.draw_color = drawer.draw_color_;
+        state.fill_bg_color = drawer.fill_bg_color_;
+        state.fill_fg_color = drawer.fill_fg_color_;
+        state.fill_pattern = drawer.fill_pattern_;
+        state.write_color = drawer.write_color_;
+        state.write_scale_x = drawer.write_scale_x_;
+        state.write_scale_y = drawer.write_scale_y_;
+        state.blend_mode = drawer.blend_mode_;
+        state.viewport = drawer.viewport_;
+        state.clip = drawer.clip_;
+        RecordState(state);
+
+        const size_t header = words_.size();
+        words_.push_back(0);
+        words_.insert(words_.end(), args.begin(), args.end());
+        switch (op)
+        {
+        case Op::kDrawOpenPoly:
+        case Op::kDrawPoly:
+        case Op::kFillPoly:
+        case Op::kDrawPolyAffine:
+        case Op::kFillPolyAffine:
+            words_.push_back(static_cast<uint32_t>(points.size()));
+            for (const Point &p : points)
+            {
+                words_.push_back(p.x);
+                words_.push_back(p.y);
+            }
+            break;
+        case Op::kWrite:
+        case Op::kWriteEx:
+            words_.push_back(static_cast<uint32_t>(text.size()));
+            if (!text.empty())
+            {
+                const size_t begin = words_.size();
+                words_.resize(begin + (text.size() + 3) / 4);
+                std::memcpy(words_.data() + begin, text.data(), text.size());
+            }
+            break;
+        default:
+            break;
+        }
+        const size_t n = words_.size() - header - 1;
+        if (n >= (size_t{1} << 24))
+        {
+            BGI_DIE("DisplayList: Too large call: %zu words", n);
+        }
+        words_[header] = static_cast<uint32_t>(op) | static_cast<uint32_t>(n) << 8;
+        calls_++;
+    }
+
+    void DisplayList::Replay(Drawer drawer, int dx, int dy) const
+    {
+        const Rect &clip = drawer.clip_;
+        Replay(drawer, dx, dy, Rect(clip.x - drawer.viewport_.x, clip.y - drawer.viewport_.y, clip.w, clip.h));
+    }
+
+    void DisplayList::Replay(Drawer drawer, int dx, int dy, const Rect &clip) const
+    {
+        // The origin of the list and the clip rect, in surface coordinates.
+        const int origin_x = drawer.viewport_.x + dx;
+        const int origin_y = drawer.viewport_.y + dy;
+        const Rect clip_rect = Intersect(drawer.clip_, Rect(clip.x + drawer.viewport_.x, clip.y + drawer.viewport_.y, clip.w, clip.h));
+
+        Drawer &d = drawer;
+        State state;
+        state.viewport = Rect(0, 0, size_.w, size_.h);
+        state.clip = state.viewport;
+        auto apply_state = [&]
+        {
+            d.SetDrawStyle(state.draw_color);
+            d.SetFillStyle(state.fill_pattern, state.fill_bg_color, state.fill_fg_color);
+            d.SetWriteStyle(state.write_color, state.write_scale_x, state.write_scale_y);
+            d.SetBlendMode(state.blend_mode);
+            d.viewport_ = Rect(origin_x + state.viewport.x, origin_y + state.viewport.y, state.viewport.w, state.viewport.h);
+            d.clip_ = Intersect(clip_rect, Rect(origin_x + state.clip.x, origin_y + state.clip.y, state.clip.w, state.clip.h));
+        };
+        apply_state();
+
+        // The points of the current call, reused from call to call.
+        thread_local std::vector<Point> points;
+        for (size_t i = 0; i < words_.size();)
+        {
+            const Op op = static_cast<Op>(words_[i] & 0xff);
+            const uint32_t *args = words_.data() + i + 1;
+            i += 1 + (words_[i] >> 8);
+            if (ApplyState(state, op, args))
+            {
+                apply_state();
+                continue;
+            }
+
+            auto arg = [args](int k)
+            { return Int(args[k]); };
+            // The points, or text, stored after `k` arguments.
+            auto get_points = [&](int k)
+            {
+                points.resize(args[k]);
+                for (size_t j = 0; j < points.size(); j++)
+                {
+                    points[j] = Point(arg(k + 1 + 2 * j), arg(k + 2 + 2 * j));
+                }
+                return PolygonView(points);
+            };
+            auto get_text = [args](int k)
+            { return std::string_view(reinterpret_cast<const char *>(args + k + 1), args[k]); };
+            auto get_affine = [args]
+            {
+                Affine m;
+                m.a = BitsFloat(args[0]);
+                m.b = BitsFloat(args[1]);
+                m.c = BitsFloat(args[2]);
+                m.d = BitsFloat(args[3]);
+                m.tx = BitsFloat(args[4]);
+                m.ty = BitsFloat(args[5]);
+                return m;
+            };
+            switch (op)
+            {
+            case Op::kSetPixel:
+                d.SetPixel(arg(0), arg(1), args[2]);
+                break;
+            case Op::kClear:
+                d.Clear(args[0]);
+                break;
+            case Op::kDrawRect:
+                d.DrawRect(arg(0), arg(1), arg(2), arg(3));
+                break;
+            case Op::kFillRect:
+                d.FillRect(arg(0), arg(1), arg(2), arg(3));
+                break;
+            case Op::kDrawRoundedRect:
+                d.DrawRoundedRect(arg(0), arg(1), arg(2), arg(3), arg(4), arg(5));
+                break;
+            case Op::kFillRoundedRect:
+                d.FillRoundedRect(arg(0), arg(1), arg(2), arg(3), arg(4), arg(5));
+                break;
+            case Op::kDrawEllipse:
+                d.DrawEllipse(arg(0), arg(1), arg(2), arg(3), arg(4), arg(5));
+                break;
+            case Op::kFillEllipse:
+                d.FillEllipse(arg(0), arg(1), arg(2), arg(3), arg(4), arg(5));
+                break;
+            case Op::kDrawLine:
+                d.DrawLine(arg(0), arg(1), arg(2), arg(3));
+                break;
+            case Op::kDrawOpenPoly:
+                d.DrawOpenPoly(get_points(0));
+                break;
+            case Op::kDrawPoly:
+                d.DrawPoly(get_points(0));
+                break;
+            case Op::kFillPoly:
+                d.FillPoly(get_points(0));
+                break;
+            case Op::kDrawPolyAffine:
+                d.DrawPoly(get_points(6), get_affine());
+                break;
+            case Op::kFillPolyAffine:
+                d.FillPoly(get_points(6), get_affine());
+                break;
+            case Op::kFillShape:
+                d.FillShape(shapes_[args[0]]);
+                break;
+            case Op::kBlit:
+            {
+                const Surface &image = images_[args[0]];
+                d.BlitWithMode(image, Rect(0, 0, image.w, image.h), arg(1), arg(2), static_cast<Drawer::BlitMode>(args[3]), args[4]);
+                break;
+            }
+            case Op::kWrite:
+                d.Write(arg(0), arg(1), get_text(2));
+                break;
+            case Op::kWriteEx:
+                d.WriteEx(arg(0), arg(1), get_text(12), Padding{arg(2), arg(3), arg(4), arg(5)},
+                          Margin{arg(6), arg(7), arg(8), arg(9)}, arg(10), arg(11));
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    void DisplayList::Optimize()
+    {
+        struct Call
+        {
+            State state;
+            Op op;
+            std::vector<uint32_t> args;
+        };
+        auto same_state = [](const State &a, const State &b)
+        {
+            return a.draw_color == b.draw_color && a.fill_bg_color == b.fill_bg_color && a.fill_fg_color == b.fill_fg_color &&
+                   a.fill_pattern == b.fill_pattern && a.write_color == b.write_color && a.write_scale_x == b.write_scale_x &&
+                   a.write_scale_y == b.write_scale_y && a.blend_mode == b.blend_mode && SameRect(a.viewport, b.viewport) &&
+                   SameRect(a.clip, b.clip);
+        };
+        auto get_rect = [](const Call &call)
+        {
+            return Rect(Int(call.args[0]), Int(call.args[1]), Int(call.args[2]), Int(call.args[3]));
+        };
+
+        // Decode the calls, merging the fills that tile a rect with the
+        // same state.
+        std::vector<Call> calls;
+        State state;
+        state.viewport = Rect(0, 0, size_.w, size_.h);
+        state.clip = state.viewport;
+        for (size_t i = 0; i < words_.size();)
+        {
+            const Op op = static_cast<Op>(words_[i] & 0xff);
+            const uint32_t *args = words_.data() + i + 1;
+            const uint32_t n = words_[i] >> 8;
+            i += 1 + n;
+            if (ApplyState(state, op, args))
+            {
+                continue;
+            }
+            if (op == Op::kFillRect && !calls.empty() && calls.back().op == Op::kFillRect && same_state(calls.back().state, state))
+            {
+                Rect rect = get_rect(calls.back());
+                if (MergeRects(rect, Rect(Int(args[0]), Int(args[1]), Int(args[2]), Int(args[3]))))
+                {
+                    calls.back().args = {static_cast<uint32_t>(rect.x), static_cast<uint32_t>(rect.y), static_cast<uint32_t>(rect.w), static_cast<uint32_t>(rect.h)};
+                    continue;
+                }
+            }
+            calls.push_back({state, op, std::vector<uint32_t>(args, args + n)});
+        }
+
+        // Returns the box that `call` draws in, in viewport coordinates, if
+        // it is simple to compute.
+        std::vector<Point> points;
+        auto get_box = [&](const Call &call, Box &box)
+        {
+            const std::vector<uint32_t> &args = call.args;
+            auto arg = [&args](int k)
+            { return Int(args[k]); };
+            auto points_box = [&](int k, const Affine &transform)
+            {
+                points.resize(args[k]);
+                for (size_t j = 0; j < points.size(); j++)
+                {
+                    points[j] = Point(arg(k + 1 + 2 * j), arg(k + 2 + 2 * j));
+                }
+                transform.Apply(points.data(), points.size(), points.data());
+                // No points draw nothing.
+                box = points.empty() ? Box{0, 0, -1, -1} : BoundingBox(points.data(), points.size(), 0, 0);
+            };
+            switch (call.op)
+            {
+            case Op::kSetPixel:
+                box = RectBox(arg(0), arg(1), 1, 1);
+                return true;
+            case Op::kClear:
+                box = RectBox(0, 0, call.state.viewport.w, call.state.viewport.h);
+                return true;
+            case Op::kDrawRect:
+                box = LineBox(arg(0), arg(1), arg(0) + arg(2) - 1, arg(1) + arg(3) - 1);
+                return true;
+            case Op::kFillRect:
+            case Op::kFillRoundedRect:
+                box = RectBox(arg(0), arg(1), arg(2), arg(3));
+                return true;
+            case Op::kDrawEllipse:
+            case Op::kFillEllipse:
+                box = EllipseBox(arg(0), arg(1), arg(2), arg(3));
+                return true;
+            case Op::kDrawLine:
+                box = LineBox(arg(0), arg(1), arg(2), arg(3));
+                return true;
+            case Op::kDrawOpenPoly:
+            case Op::kDrawPoly:
+                points_box(0, Affine());
+                return true;
+            case Op::kFillPoly:
+                points_box(0, Affine());
+                return points.size() >= 3;
+            case Op::kDrawPolyAffine:
+            case Op::kFillPolyAffine:
+            {
+                Affine m;
+                m.a = BitsFloat(args[0]);
+                m.b = BitsFloat(args[1]);
+                m.c = BitsFloat(args[2]);
+                m.d = BitsFloat(args[3]);
+                m.tx = BitsFloat(args[4]);
+                m.ty = BitsFloat(args[5]);
+                points_box(6, m);
+                return call.op == Op::kDrawPolyAffine || points.size() >= 3;
+            }
+            case Op::kFillShape:
+            {
+                const RasterizedShape &shape = shapes_[args[0]];
+                box = shape.empty() ? Box{0, 0, -1, -1} : RectBox(shape.bounds().x, shape.bounds().y, shape.bounds().w, shape.bounds().h);
+                return true;
+            }
+            case Op::kBlit:
+            {
+                const Surface &image = images_[args[0]];
+                box = RectBox(arg(1), arg(2), image.w, image.h);
+                return true;
+            }
+            case Op::kWrite:
+            {
+                const int64_t scale_x = call.state.write_scale_x;
+                const int64_t scale_y = call.state.write_scale_y;
+                if (scale_x <= 0 || scale_y <= 0)
+                {
+                    box = Box{0, 0, -1, -1};
+                    return true;
+                }
+                box = Box{arg(0), arg(1), arg(0) + 8 * scale_x * args[2] - 1, arg(1) + 8 * scale_y - 1};
+                return true;
+            }
+            default:
+                // The corners of rounded rects depend on clamping; keep
+                // them.
+                return false;
+            }
+        };
+        // Returns whether `call` overwrites all pixels in its box.
+        auto is_cover = [](const Call &call)
+        {
+            if (call.op == Op::kClear)
+            {
+                return IsOpaque(call.args[0]);
+            }
+            if (call.op == Op::kBlit)
+            {
+                return static_cast<Drawer::BlitMode>(call.args[3]) == Drawer::BlitMode::kCopy;
+            }
+            const State &s = call.state;
+            return call.op == Op::kFillRect &&
+                   (s.fill_pattern == ~basic_fill_patterns::SolidBg || IsOpaque(s.fill_bg_color)) &&
+                   (s.fill_pattern == basic_fill_patterns::SolidBg || IsOpaque(s.fill_fg_color));
+        };
+
+        // Drop the calls that draw nothing, or only where a later call
+        // covers.
+        std::vector<bool> keep(calls.size(), true);
+        std::vector<Rect> covers;
+        for (size_t i = calls.size(); i-- > 0;)
+        {
+            const Call &call = calls[i];
+            Box box;
+            if (!get_box(call, box))
+            {
+                continue;
+            }
+            const Rect &viewport = call.state.viewport;
+            const Rect bounds = Intersect(Box{box.x1 + viewport.x, box.y1 + viewport.y, box.x2 + viewport.x, box.y2 + viewport.y}, call.state.clip);
+            if (bounds.w == 0 || std::any_of(covers.begin(), covers.end(), [&](const Rect &cover)
+                                             { return Contains(cover, bounds); }))
+            {
+                keep[i] = false;
+                continue;
+            }
+            if (is_cover(call) && covers.size() < kMaxCovers)
+            {
+                covers.push_back(bounds);
+            }
+        }
+
+        std::vector<RasterizedShape> shapes;
+        shapes.swap(shapes_);
+        std::vector<Surface> images;
+        images.swap(images_);
+        Clear();
+        for (size_t i = 0; i < calls.size(); i++)
+        {
+            Call &call = calls[i];
+            if (!keep[i])
+            {
+                continue;
+            }
+            if (call.op == Op::kFillShape)
+            {
+                call.args[0] = AddShape(shapes[call.args[0]]);
+            }
+            if (call.op == Op::kBlit)
+            {
+                call.args[0] = AddImage(std::move(images[call.args[0]]));
+            }
+            RecordState(call.state);
+            words_.push_back(static_cast<uint32_t>(call.op) | static_cast<uint32_t>(call.args.size()) << 8);
+            words_.insert(words_.end(), call.args.begin(), call.args.end());
+            calls_++;
+        }
+    }
+
+    namespace
+    {
+        thread_local PolygonArena *active_polygon_arena = nullptr;
+    } // namespace
+
+    Polygon::Polygon()
+        : data_(reinterpret_cast<Point *>(inline_)), arena_(PolygonArena::active())
     {
-        Size physical_size(2 * w, 2 * h);
-        BGI_SDL_CHECK_PTR(window_ = SDL_CreateWindow(std::string(title).c_str(),
-                                                     SDL_WINDOWPOS_UNDEFINED,
-                                                     SDL_WINDOWPOS_UNDEFINED,
-                                                     physical_size.w,
-                                                     physical_size.h,
-                                                     SDL_WINDOW_SHOWN));
-        BGI_SDL_CHECK_PTR(renderer_ = SDL_CreateRenderer(window_, -1, SDL_RENDERER_PRESENTVSYNC));
-        BGI_SDL_CHECK_ZERO(SDL_RenderSetLogicalSize(renderer_, w, h));
-        BGI_SDL_CHECK_PTR(texture_ = SDL_CreateTexture(renderer_,
-                                                       SDL_PIXELFORMAT_ARGB8888,
-                                                       SDL_TEXTUREACCESS_STREAMING,
-                                                       w, h));
+        static_assert(std::is_trivially_copyable_v<Point> && std::is_trivially_destructible_v<Point>);
     }
 
-    Window::~Window()
+    Polygon::Polygon(size_t size, const Point &value)
+        : Polygon()
     {
-        SDL_DestroyWindow(window_);
-        SDL_DestroyRenderer(renderer_);
-        SDL_DestroyTexture(texture_);
+        resize(size, value);
     }
 
-    void Window::Update(const Surface &surface)
+    Polygon::Polygon(std::initializer_list<Point> points)
+        : Polygon()
     {
-        BGI_SDL_CHECK_ZERO(SDL_UpdateTexture(texture_, NULL, surface.pixels.data(), surface.w * sizeof(Color)));
-        BGI_SDL_CHECK_ZERO(SDL_SetRenderDrawColor(renderer_, 0, 0, 0, 255));
-        BGI_SDL_CHECK_ZERO(SDL_RenderClear(renderer_));
-        BGI_SDL_CHECK_ZERO(SDL_RenderCopy(renderer_, texture_, NULL, NULL));
-        SDL_RenderPresent(renderer_);
+        insert(end(), points.begin(), points.end());
     }
 
-    void Window::set_fullscreen(bool full_screen)
+    Polygon::Polygon(const Polygon &other)
+        : Polygon()
     {
-        BGI_SDL_CHECK_ZERO(SDL_SetWindowFullscreen(window_, full_screen ? SDL_WINDOW_FULLSCREEN_DESKTOP : 0));
+        *this = other;
     }
 
-    Drawer::Drawer(Surface &surface)
-        : Drawer(surface, Rect(0, 0, surface.w, surface.h))
+    Polygon::Polygon(Polygon &&other) noexcept
+        : Polygon()
     {
+        if (other.is_inline())
+        {
+            std::copy_n(other.data_, other.size_, data_);
+        }
+        else
+        {
+            data_ = other.data_;
+            capacity_ = other.capacity_;
+            arena_ = other.arena_;
+            other.data_ = reinterpret_cast<Point *>(other.inline_);
+            other.capacity_ = kInlineSize;
+        }
+        size_ = other.size_;
+        other.size_ = 0;
     }
 
-    Drawer::Drawer(Surface &surface, const Rect &viewport)
-        : surface_(&surface), viewport_(viewport)
+    Polygon &Polygon::operator=(const Polygon &other)
     {
+        if (this != &other)
+        {
+            reserve(other.size_);
+            std::copy_n(other.data_, other.size_, data_);
+            size_ = other.size_;
+        }
+        return *this;
     }
 
-    Drawer::~Drawer() = default;
+    Polygon &Polygon::operator=(Polygon &&other)
+    {
+        if (this == &other)
+        {
+            return *this;
+        }
+        if (other.is_inline() || other.arena_ != arena_)
+        {
+            return *this = other;
+        }
+        if (!is_inline() && !arena_)
+        {
+            ::operator delete(data_);
+        }
+        data_ = other.data_;
+        size_ = other.size_;
+        capacity_ = other.capacity_;
+        other.data_ = reinterpret_cast<Point *>(other.inline_);
+        other.size_ = 0;
+        other.capacity_ = kInlineSize;
+        return *this;
+    }
 
-    Drawer Drawer::Viewport(int x, int y, int w, int h)
+    Polygon &Polygon::operator=(std::initializer_list<Point> points)
     {
-        Drawer d = *this;
-        d.viewport_.x += x;
-        d.viewport_.y += y;
-        d.viewport_.w = w;
-        d.viewport_.h = h;
-        return d;
+        clear();
+        insert(end(), points.begin(), points.end());
+        return *this;
     }
 
-    Color *Drawer::GetPixelPtr(int x, int y) const
+    Polygon::~Polygon()
     {
-        x += viewport_.x;
-        y += viewport_.y;
+        if (!is_inline() && !arena_)
+        {
+            ::operator delete(data_);
+        }
+    }
 
-        if (x < 0 || y < 0 || x >= surface_->w || y >= surface_->h)
+    Point &Polygon::at(size_t i)
+    {
+        if (i >= size_)
         {
-            return nullptr;
+            BGI_DIE("Polygon index %zu out of range (size %u).", i, size_);
         }
+        return data_[i];
+    }
 
-        return &surface_->pixels[y * surface_->w + x];
+    const Point &Polygon::at(size_t i) const
+    {
+        return const_cast<Polygon *>(this)->at(i);
     }
 
-    Color Drawer::GetPixel(int x, int y) const
+    void Polygon::reserve(size_t capacity)
     {
-        if (Color *pixel = GetPixelPtr(x, y))
+        if (capacity > capacity_)
         {
-            return *pixel;
+            Grow(capacity);
         }
-        return basic_colors::Black;
     }
 
-    void Drawer::SetPixel(int x, int y, Color c)
+    void Polygon::resize(size_t size, const Point &value)
     {
-        if (Color *pixel = GetPixelPtr(x, y))
+        reserve(size);
+        if (size > size_)
         {
-            *pixel = c;
+            std::fill(data_ + size_, data_ + size, value);
         }
+        size_ = static_cast<uint32_t>(size);
     }
 
-    void Drawer::Clear(Color c)
+    Polygon::iterator Polygon::insert(const_iterator pos, const Point &point)
     {
-        Drawer d = *this;
-        d.SetFillStyle(c);
-        d.FillRect(0, 0, viewport_.w, viewport_.h);
+        const size_t index = pos - data_;
+        // `point` may be in this polygon, which push_back() can move.
+        const Point copy = point;
+        push_back(copy);
+        std::rotate(data_ + index, data_ + size_ - 1, data_ + size_);
+        return data_ + index;
     }
 
-    void Drawer::DrawRect(int x, int y, int w, int h)
+    Polygon::iterator Polygon::erase(const_iterator first, const_iterator last)
     {
-        DrawPoly(x, y,
-                 x + w - 1, y,
-                 x, y + h - 1,
-                 x + w - 1, y + h - 1);
+        Point *begin = data_ + (first - data_);
+        std::copy(last, cend(), begin);
+        size_ -= static_cast<uint32_t>(last - first);
+        return begin;
     }
 
-    void Drawer::FillRect(int x, int y, int w, int h)
+    bool operator==(const Polygon &a, const Polygon &b)
     {
-        x += viewport_.x;
-        y += viewport_.y;
-
-        if (fill_pattern_ == basic_fill_patterns::SolidBg && x == 0 && y == 0 && w == surface_->w && h == surface_->h)
-        {
-            std::fill(surface_->pixels.begin(), surface_->pixels.end(), fill_bg_color_);
-            return;
-        }
+        return std::equal(a.begin(), a.end(), b.begin(), b.end(),
+                          [](const Point &p, const Point &q)
+                          { return p.x == q.x && p.y == q.y; });
+    }
 
-        if (fill_pattern_ == basic_fill_patterns::SolidBg)
+    void Polygon::Grow(size_t capacity)
+    {
+        if (capacity > std::numeric_limits<uint32_t>::max() / 2)
         {
-            Crop(x, y, w, h, surface_->w, surface_->h);
-            for (int row = y; row < y + h; ++row)
-            {
-                std::fill(surface_->pixels.begin() + row * surface_->w + x,
-                          surface_->pixels.begin() + row * surface_->w + x + w,
-                          fill_bg_color_);
-            }
+            BGI_DIE("Polygon too large: %zu points.", capacity);
         }
-        else
+        capacity = std::max<size_t>(capacity, 2 * capacity_);
+        Point *data = static_cast<Point *>(arena_ ? arena_->Allocate(capacity * sizeof(Point)) : ::operator new(capacity * sizeof(Point)));
+        std::copy_n(data_, size_, data);
+        if (!is_inline() && !arena_)
         {
-            FillRectTempl(x, y, w, h, surface_->w, surface_->h,
-                          [pixels = surface_->pixels.data(),
-                           pattern = fill_pattern_,
-                           fg = fill_fg_color_,
-                           bg = fill_bg_color_,
-                           vpx = viewport_.x,
-                           vpy = viewport_.y](int x, int y, int i)
-                          { pixels[i] = IsFg(pattern, x - vpx, y - vpy) ? fg : bg; });
+            ::operator delete(data_);
         }
+        data_ = data;
+        capacity_ = static_cast<uint32_t>(capacity);
     }
 
-    void Drawer::FillRect(const Rect &rect)
+    PolygonArena::PolygonArena(size_t block_size)
+        : block_size_(std::max<size_t>(block_size, 1024))
     {
-        FillRect(rect.x, rect.y, rect.w, rect.h);
     }
 
-    void Drawer::DrawRoundedRect(int x, int y, int w, int h, int rx, int ry)
+    PolygonArena::Scope::Scope(PolygonArena &arena)
+        : arena_(arena), previous_(active_polygon_arena)
     {
-        int m = std::min(w, h) / 2;
-        rx = std::min(rx, m);
-        ry = std::min(ry, m);
-
-        int x2 = x + w - 1;
-        int y2 = y + h - 1;
-        DrawEllipse(x + rx, y + ry, rx, ry, 90, 180);
-        DrawEllipse(x + rx, y2 - ry, rx, ry, 180, 270);
-        DrawEllipse(x2 - rx, y + ry, rx, ry, 0, 90);
-        DrawEllipse(x2 - rx, y2 - ry, rx, ry, 270, 360);
-        DrawLine(x + rx, y, x2 - rx, y);
-        DrawLine(x + rx, y2, x2 - rx, y2);
-        DrawLine(x, y + ry, x, y2 - ry);
-        DrawLine(x2, y + ry, x2, y2 - ry);
+        active_polygon_arena = &arena;
     }
 
-    void Drawer::FillRoundedRect(int x, int y, int w, int h, int rx, int ry)
+    PolygonArena::Scope::~Scope()
     {
-        int m = std::min(w, h) / 2;
-        rx = std::min(rx, m);
-        ry = std::min(ry, m);
+        active_polygon_arena = previous_;
+        arena_.Reset();
+    }
 
-        int x2 = x + w - 1;
-        int y2 = y + h - 1;
-        FillEllipse(x + rx, y + ry, rx, ry);
-        FillEllipse(x + rx, y2 - ry, rx, ry);
-        FillEllipse(x2 - rx, y + ry, rx, ry);
-        FillEllipse(x2 - rx, y2 - ry, rx, ry);
-        FillRect(x + rx, y, w - 2 * rx, ry);
-        FillRect(x, y + ry, w, h - 2 * ry);
-        FillRect(x + rx, y2 - ry + 1, w - 2 * rx, ry);
+    PolygonArena *PolygonArena::active()
+    {
+        return active_polygon_arena;
     }
 
-    // PointPair GetEllipticalArcEndpoints(int x, int y, int w, int h, int angle1 = 0, int angle2 = 360);
-    void Drawer::DrawEllipse(int x, int y, int rx, int ry, int angle1, int angle2)
+    void *PolygonArena::Allocate(size_t bytes)
     {
-        if (angle1 == 0 && angle2 == 360)
+        // Aligned like the blocks from new[].
+        constexpr size_t kAlignment = alignof(std::max_align_t);
+        bytes = (bytes + kAlignment - 1) / kAlignment * kAlignment;
+        for (; block_ < blocks_.size(); block_++, offset_ = 0)
         {
-            x += viewport_.x;
-            y += viewport_.y;
-
-            DrawEllipseTempl(
-                x, y, rx, ry, surface_->w, surface_->h,
-                [pixels = surface_->pixels.data(),
-                 color = draw_color_](int, int, int i, int)
-                { pixels[i] = color; });
-            return;
+            if (offset_ + bytes <= blocks_[block_].size)
+            {
+                break;
+            }
+        }
+        if (block_ == blocks_.size())
+        {
+            Block block;
+            block.size = std::max(bytes, block_size_);
+            block.memory.reset(new unsigned char[block.size]);
+            blocks_.push_back(std::move(block));
+            offset_ = 0;
         }
+        void *memory = blocks_[block_].memory.get() + offset_;
+        offset_ += bytes;
+        bytes_allocated_ += bytes;
+        return memory;
+    }
 
-        DrawOpenPoly(MakeEllipticalArc(x, y, rx, ry, angle1, angle2));
+    void PolygonArena::Reset()
+    {
+        block_ = 0;
+        offset_ = 0;
+        bytes_allocated_ = 0;
     }
 
-    void Drawer::FillEllipse(int x, int y, int rx, int ry, int angle1, int angle2)
+    namespace
     {
-        if (angle1 == 0 && angle2 == 360)
-        {
-            x += viewport_.x;
-            y += viewport_.y;
+        // Shapes are rasterized within this clip rect, +-2^29.
+        const Rect kRasterizeClip(-(1 << 29), -(1 << 29), 1 << 30, 1 << 30);
 
-            if (fill_pattern_ == basic_fill_patterns::SolidBg)
+        // Calls rasterize(clip, add_span) with the clip rect that contains
+        // `box`, and collects the spans.
+        template <typename F>
+        std::vector<RasterizedShape::Span> CollectSpans(const Box &box, const F &rasterize)
+        {
+            std::vector<RasterizedShape::Span> spans;
+            const Rect clip = Intersect(box, kRasterizeClip);
+            if (clip.w == 0)
             {
-                FillEllipseTempl(x, y, rx, ry, surface_->w, surface_->h,
-                                 [pixels = surface_->pixels.data(), bg = fill_bg_color_](int, int, int i)
-                                 { pixels[i] = bg; });
+                return spans;
             }
-            else
+            rasterize(clip, [&spans](int x, int y, int n)
+                      { spans.push_back({x, y, n}); });
+            return spans;
+        }
+
+        void AppendKey(std::vector<int32_t> &key, int value)
+        {
+            key.push_back(value);
+        }
+
+        // Floats are appended as their bits, with -0 as 0 so that keys
+        // compare like the floats do.
+        void AppendKey(std::vector<int32_t> &key, float value)
+        {
+            if (value == 0)
             {
-                FillEllipseTempl(x, y, rx, ry, surface_->w, surface_->h,
-                                 [pixels = surface_->pixels.data(),
-                                  pattern = fill_pattern_,
-                                  fg = fill_fg_color_,
-                                  bg = fill_bg_color_,
-                                  vpx = viewport_.x,
-                                  vpy = viewport_.y](int x, int y, int i)
-                                 { pixels[i] = IsFg(pattern, x - vpx, y - vpy) ? fg : bg; });
+                value = 0;
             }
-            return;
+            int32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            key.push_back(bits);
         }
 
-        Polygon p = MakeEllipticalArc(x, y, rx, ry, angle1, angle2);
-        p.push_back(Point(x, y));
-        FillPoly(p);
-    }
+        template <typename... T>
+        void AppendKeys(std::vector<int32_t> &key, T... values)
+        {
+            (AppendKey(key, values), ...);
+        }
 
-    void Drawer::DrawLine(int x1, int y1, int x2, int y2)
+        // FNV-1a, a word at a time.
+        size_t HashKey(const std::vector<int32_t> &key)
+        {
+            uint64_t hash = 14695981039346656037ull;
+            for (int32_t word : key)
+            {
+                hash = (hash ^ static_cast<uint32_t>(word)) * 1099511628211ull;
+            }
+            return static_cast<size_t>(hash);
+        }
+    } // namespace
+
+    RasterizedShape::RasterizedShape(std::vector<Span> spans)
     {
-        x1 += viewport_.x;
-        y1 += viewport_.y;
-        x2 += viewport_.x;
-        y2 += viewport_.y;
-        DrawLineTempl(x1, y1, x2, y2, surface_->w, surface_->h,
-                      [pixels = surface_->pixels.data(),
-                       color = draw_color_](int, int, int i, int)
-                      { pixels[i] = color; });
+        MergeSpans(spans);
+        if (!spans.empty())
+        {
+            int x1 = spans.front().x;
+            int x2 = spans.front().x + spans.front().n;
+            for (const Span &span : spans)
+            {
+                x1 = std::min(x1, span.x);
+                x2 = std::max(x2, span.x + span.n);
+            }
+            bounds_ = Rect(x1, spans.front().y, x2 - x1, spans.back().y - spans.front().y + 1);
+        }
+        spans_ = std::make_shared<const std::vector<Span>>(std::move(spans));
     }
 
-    void Drawer::SetPixelWithFillPattern(int x, int y)
+    const std::vector<RasterizedShape::Span> &RasterizedShape::spans() const
     {
-        SetPixel(x, y, IsFg(fill_pattern_, x, y) ? fill_fg_color_ : fill_bg_color_);
+        static const std::vector<Span> no_spans;
+        return spans_ ? *spans_ : no_spans;
     }
 
-    void Drawer::DrawOpenPoly(const Polygon &polygon)
+    RasterizedShape RasterizedShape::FromPolygon(PolygonView polygon, const Affine &transform)
     {
-        if (polygon.size() == 0)
-        {
-            return;
-        }
-        if (polygon.size() == 1)
-        {
-            Point p = polygon.back();
-            DrawLine(p.x, p.y, p.x, p.y);
-            return;
-        }
-        for (int i = 0; i < Int(polygon.size()) - 1; i++)
+        if (polygon.size() < 3)
         {
-            Point p = polygon.at(i);
-            Point q = polygon.at(i + 1);
-            DrawLine(p.x, p.y, q.x, q.y);
+            BGI_WARN("Warning: Polygon size: %d < 3", Int(polygon.size()));
+            return RasterizedShape(std::vector<Span>());
         }
+        std::vector<Point> points(polygon.size());
+        transform.Apply(polygon.data(), polygon.size(), points.data());
+        return RasterizedShape(CollectSpans(BoundingBox(points.data(), points.size(), 0, 0), [&](const Rect &clip, const auto &add_span)
+                                            { FillPolygonTempl(points.data(), points.size(), 0, 0, clip, add_span); }));
     }
 
-    void Drawer::DrawPoly(const Polygon &polygon)
+    RasterizedShape RasterizedShape::FromEllipse(int x, int y, int rx, int ry, int angle1, int angle2)
     {
-        if (polygon.size() == 0)
+        return RasterizedShape(CollectSpans(EllipseBox(x, y, rx, ry), [&](const Rect &clip, const auto &add_span)
+                                            { FillEllipseTempl(x, y, rx, ry, EllipseArc(rx, ry, angle1, angle2), clip, add_span); }));
+    }
+
+    RasterizedShape RasterizedShape::FromRoundedRect(int x, int y, int w, int h, int rx, int ry)
+    {
+        // Clamped like in Drawer::FillRoundedRect().
+        const int m = std::min(w, h) / 2;
+        rx = std::max(std::min(rx, m), 0);
+        ry = std::max(std::min(ry, m), 0);
+        return RasterizedShape(CollectSpans(RectBox(x, y, w, h), [&](const Rect &clip, const auto &add_span)
+                                            { FillRoundedRectTempl(x, y, w, h, rx, ry, clip, add_span); }));
+    }
+
+    template <typename Rasterize>
+    RasterizedShape ShapeCache::Get(const Rasterize &rasterize)
+    {
+        const size_t hash = HashKey(key_);
+        const auto range = shapes_.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
         {
-            BGI_WARN("Warning: Polygon size = 0");
-            return;
+            if (it->second.key == key_)
+            {
+                hits_++;
+                return it->second.shape;
+            }
         }
-        Point p = polygon.back();
-        for (Point q : polygon)
+        misses_++;
+        if (shapes_.size() >= max_shapes_)
         {
-            DrawLine(p.x, p.y, q.x, q.y);
-            p = q;
+            shapes_.clear();
         }
+        return shapes_.emplace(hash, Entry{key_, rasterize()})->second.shape;
     }
 
-    void Drawer::FillPoly(const Polygon &polygon)
+    RasterizedShape ShapeCache::GetPolygon(PolygonView polygon, const Affine &transform)
     {
-        Polygon p = Transform(polygon, 0, 1, 1, viewport_.x, viewport_.y);
-        if (fill_pattern_ == basic_fill_patterns::SolidBg)
-        {
-            FillPolygonTempl(p, surface_->w, surface_->h,
-                             [pixels = surface_->pixels.data(),
-                              bg = fill_bg_color_](int, int, int i)
-                             { pixels[i] = bg; });
-        }
-        else
+        key_.assign(1, 'p');
+        AppendKeys(key_, transform.a, transform.b, transform.c, transform.d, transform.tx, transform.ty);
+        for (size_t i = 0; i < polygon.size(); i++)
         {
-            FillPolygonTempl(p, surface_->w, surface_->h,
-                             [pixels = surface_->pixels.data(),
-                              pattern = fill_pattern_,
-                              fg = fill_fg_color_,
-                              bg = fill_bg_color_,
-                              vpx = viewport_.x,
-                              vpy = viewport_.y](int x, int y, int i)
-                             { pixels[i] = IsFg(pattern, x - vpx, y - vpy) ? fg : bg; });
+            AppendKeys(key_, polygon.data()[i].x, polygon.data()[i].y);
         }
+        return Get([&]
+                   { return RasterizedShape::FromPolygon(polygon, transform); });
     }
 
-    Rect Drawer::GetTextRect(int x, int y, std::string_view text)
+    RasterizedShape ShapeCache::GetEllipse(int x, int y, int rx, int ry, int angle1, int angle2)
     {
-        return Rect(x, y, write_scale_x_ * 8 * text.size(), write_scale_y_ * 8);
+        key_.assign(1, 'e');
+        AppendKeys(key_, x, y, rx, ry, angle1, angle2);
+        return Get([&]
+                   { return RasterizedShape::FromEllipse(x, y, rx, ry, angle1, angle2); });
     }
 
-    void Drawer::Write(int x, int y, std::string_view text)
+    RasterizedShape ShapeCache::GetRoundedRect(int x, int y, int w, int h, int rx, int ry)
     {
-        for (size_t i = 0; i < text.size(); i++)
-        {
-            DrawBitmapChar(x + i * write_scale_x_ * 8, y, text[i]);
-        }
+        key_.assign(1, 'r');
+        AppendKeys(key_, x, y, w, h, rx, ry);
+        return Get([&]
+                   { return RasterizedShape::FromRoundedRect(x, y, w, h, rx, ry); });
     }
 
-    void Drawer::WriteEx(int x, int y, std::string_view text, const Padding &padding, const Margin &margin, int rx, int ry)
+    Polygon Transform(const Polygon &polygon, float cw_rot_deg, float scale_x, float scale_y, int translate_x, int translate_y)
     {
-        Rect r = GetTextRect(x, y, text);
-        FillRoundedRect(r.x - padding.left - margin.left - 1,
-                        r.y - padding.top - margin.top - 1,
-                        r.w + padding.left + padding.right + margin.left + margin.right + 2,
-                        r.h + padding.top + padding.bottom + margin.top + margin.bottom + 2,
-                        rx, ry);
-        DrawRoundedRect(r.x - padding.left - 1,
-                        r.y - padding.top - 1,
-                        r.w + padding.left + padding.right + 2,
-                        r.h + padding.top + padding.bottom + 2,
-                        rx, ry);
-        Write(x, y, text);
+        Polygon result = polygon;
+        TransformPoints(result.data(), result.size(), TransformType{cw_rot_deg, scale_x, scale_y, translate_x, translate_y});
+        return result;
     }
 
-    void Drawer::SetDrawStyle(Color c)
+    Polygon Transform(const Polygon &polygon, const TransformType &transform)
     {
-        draw_color_ = c;
+        return Transform(polygon, transform.cw_rot_deg, transform.scale_x, transform.scale_y, transform.translate_x, transform.translate_y);
     }
 
-    void Drawer::SetFillStyle(Color c)
+    Polygon Transform(const Polygon &polygon, const Affine &transform)
     {
-        fill_bg_color_ = c;
-        fill_fg_color_ = c;
-        fill_pattern_ = basic_fill_patterns::SolidBg;
+        Polygon result(polygon.size());
+        transform.Apply(polygon.data(), polygon.size(), result.data());
+        return result;
     }
 
-    void Drawer::SetFillStyle(FillPattern pattern, Color bg, Color fg)
+    Affine Affine::Translate(float x, float y)
     {
-        fill_bg_color_ = bg;
-        fill_fg_color_ = fg;
-        fill_pattern_ = pattern;
+        return {1, 0, 0, 1, x, y};
     }
 
-    void Drawer::SetWriteStyle(Color c, int scale_x, int scale_y)
+    Affine Affine::Scale(float x, float y)
     {
-        write_color_ = c;
-        write_scale_x_ = scale_x;
-        write_scale_y_ = scale_y;
+        return {x, 0, 0, y, 0, 0};
     }
 
-    void Drawer::DrawBitmapChar(int x, int y, char c)
+    Affine Affine::Rotate(float cw_rot_deg)
     {
-        uint8_t uc = static_cast<uint8_t>(c);
-        FillPattern pattern = bitmap_font_[uc];
+        const float rad = 0.01745329252f * cw_rot_deg;
+        const float cosine = std::cos(rad);
+        const float sine = std::sin(rad);
+        return {cosine, -sine, sine, cosine, 0, 0};
+    }
 
-        if (write_scale_x_ == 1 && write_scale_y_ == 1)
-        {
-            x += viewport_.x;
-            y += viewport_.y;
+    Affine Affine::FromTransform(const TransformType &transform)
+    {
+        return Translate(Float(transform.translate_x), Float(transform.translate_y)) *
+               Scale(transform.scale_x, transform.scale_y) *
+               Rotate(transform.cw_rot_deg);
+    }
 
-            FillRectTempl(x, y, 8, 8, surface_->w, surface_->h,
-                          [pixels = surface_->pixels.data(),
-                           pattern,
-                           fg = write_color_,
-                           x0 = x,
-                           y0 = y](int x, int y, int i)
-                          {
-                              if (IsFg(pattern, x - x0, y - y0))
-                                  pixels[i] = fg;
-                          });
-            return;
-        }
+    Affine Affine::MirrorHoriz(int mirror_x)
+    {
+        return {-1, 0, 0, 1, 2 * Float(mirror_x), 0};
+    }
 
-        Drawer d = *this;
-        d.SetFillStyle(write_color_);
-        for (int row = 0; row < 8; row++)
-        {
-            for (int col = 0; col < 8; col++)
-            {
-                if (IsFg(pattern, col, row))
-                {
-                    d.FillRect(x + col * write_scale_x_, y + row * write_scale_y_, write_scale_x_, write_scale_y_);
-                }
-            }
-        }
+    Affine Affine::MirrorVert(int mirror_y)
+    {
+        return {1, 0, 0, -1, 0, 2 * Float(mirror_y)};
     }
 
-    Polygon Transform(const Polygon &polygon, float cw_rot_deg, float scale_x, float scale_y, int translate_x, int translate_y)
+    Affine Affine::Inverse() const
     {
-        Polygon result = polygon;
-        if (cw_rot_deg != 0.0f)
+        const float determinant = a * d - b * c;
+        if (determinant == 0)
         {
-            float rad = 0.01745329252f * cw_rot_deg;
-            float cosine = std::cos(rad);
-            float sine = std::sin(rad);
-            for (Point &p : result)
-            {
-                p = {Round((p.x * cosine - p.y * sine) * scale_x) + translate_x,
-                     Round((p.x * sine + p.y * cosine) * scale_y) + translate_y};
-            }
-            return result;
+            BGI_WARN("Warning: the transformation is not invertible");
+            return Affine();
         }
+        const float ia = d / determinant;
+        const float ib = -b / determinant;
+        const float ic = -c / determinant;
+        const float id = a / determinant;
+        return {ia, ib, ic, id, -(ia * tx + ib * ty), -(ic * tx + id * ty)};
+    }
 
-        if (scale_x != 1.0f || scale_y != 1.0f)
-        {
-            for (Point &p : result)
-            {
-                p = {Round(p.x * scale_x) + translate_x,
-                     Round(p.y * scale_y) + translate_y};
-            }
-            return result;
-        }
+    Point Affine::Apply(const Point &point) const
+    {
+        Point result;
+        spans::TransformPoints(&point, 1, *this, &result);
+        return result;
+    }
 
-        if (translate_x != 0 || translate_y != 0)
-        {
-            for (Point &p : result)
-            {
-                p = {p.x + translate_x,
-                     p.y + translate_y};
-            }
-            return result;
-        }
+    void Affine::Apply(const Point *src, size_t n, Point *dst) const
+    {
+        spans::TransformPoints(src, n, *this, dst);
+    }
 
-        return result;
+    void Affine::Apply(Polygon &polygon) const
+    {
+        spans::TransformPoints(polygon.data(), polygon.size(), *this, polygon.data());
     }
 
-    Polygon Transform(const Polygon &polygon, const TransformType &transform)
+    Affine operator*(const Affine &second, const Affine &first)
     {
-        return Transform(polygon, transform.cw_rot_deg, transform.scale_x, transform.scale_y, transform.translate_x, transform.translate_y);
+        return {second.a * first.a + second.b * first.c,
+                second.a * first.b + second.b * first.d,
+                second.c * first.a + second.d * first.c,
+                second.c * first.b + second.d * first.d,
+                second.a * first.tx + second.b * first.ty + second.tx,
+                second.c * first.tx + second.d * first.ty + second.ty};
     }
 
     Polygon MirrorHoriz(const Polygon &polygon, int mirror_x)
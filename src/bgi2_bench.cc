@@ -0,0 +1,737 @@
+#include "bgi2.h"
+#include "grill_scene.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+using namespace bgi;
+
+namespace
+{
+    // A polygon with `num_vertices` vertices, centered in a `size` x `size`
+    // square. Stars alternate between an outer and an inner radius.
+    Polygon MakeRoundPolygon(int num_vertices, int size, bool star)
+    {
+        constexpr float pi_mul_2 = 3.1415926 * 2.0;
+
+        Polygon polygon;
+        polygon.reserve(num_vertices);
+        for (int i = 0; i < num_vertices; i++)
+        {
+            float r = (star && i % 2 == 1 ? 0.3f : 0.48f) * size;
+            float angle = pi_mul_2 * i / num_vertices;
+            polygon.emplace_back(size / 2 + Round(r * std::cos(angle)),
+                                 size / 2 + Round(r * std::sin(angle)));
+        }
+        return polygon;
+    }
+
+    // Scaling with the vertex count. A convex polygon crosses each row only
+    // twice, while the edges of a star with many vertices all cross the
+    // same rows.
+    void BM_FillPoly(benchmark::State &state, bool star)
+    {
+        const int num_vertices = state.range(0);
+        Surface surface(512, 512);
+        Drawer d(surface);
+        d.SetFillStyle(colors::Red);
+        Polygon polygon = MakeRoundPolygon(num_vertices, surface.w, star);
+        for (auto _ : state)
+        {
+            d.FillPoly(polygon);
+            benchmark::ClobberMemory();
+        }
+        state.SetComplexityN(num_vertices);
+    }
+    BENCHMARK_CAPTURE(BM_FillPoly, Convex, false)->RangeMultiplier(4)->Range(4, 16384)->Complexity();
+    BENCHMARK_CAPTURE(BM_FillPoly, Star, true)->RangeMultiplier(4)->Range(4, 16384)->Complexity();
+
+    // A polygon zoomed in around the left edge of the surface. The visible
+    // area stays the same while the geometry grows with the zoom.
+    void BM_FillPolyZoomed(benchmark::State &state)
+    {
+        const int zoom = state.range(0);
+        Surface surface(512, 512);
+        Drawer d(surface);
+        d.SetFillStyle(colors::Red);
+        Polygon polygon = Transform(MakeRoundPolygon(256, 512 * zoom, /*star=*/false),
+                                    0, 1, 1, -256 * zoom, 256 - 256 * zoom);
+        for (auto _ : state)
+        {
+            d.FillPoly(polygon);
+            benchmark::ClobberMemory();
+        }
+    }
+    BENCHMARK(BM_FillPolyZoomed)->RangeMultiplier(4)->Range(1, 256);
+
+    void BM_FillEllipseSectorZoomed(benchmark::State &state)
+    {
+        const int zoom = state.range(0);
+        Surface surface(512, 512);
+        Drawer d(surface);
+        d.SetFillStyle(colors::Red);
+        for (auto _ : state)
+        {
+            d.FillEllipse(0, 256, 256 * zoom, 256 * zoom, 300, 420);
+            benchmark::ClobberMemory();
+        }
+    }
+    BENCHMARK(BM_FillEllipseSectorZoomed)->RangeMultiplier(4)->Range(1, 256);
+
+    void BM_DrawEllipseArc(benchmark::State &state)
+    {
+        const int radius = state.range(0);
+        Surface surface(1024, 1024);
+        Drawer d(surface);
+        d.SetDrawStyle(colors::White);
+        for (auto _ : state)
+        {
+            d.DrawEllipse(512, 512, radius, radius, 30, 300);
+            benchmark::ClobberMemory();
+        }
+    }
+    BENCHMARK(BM_DrawEllipseArc)->RangeMultiplier(4)->Range(4, 1024);
+
+    void BM_FillEllipseSector(benchmark::State &state)
+    {
+        const int radius = state.range(0);
+        Surface surface(1024, 1024);
+        Drawer d(surface);
+        d.SetFillStyle(colors::Red);
+        for (auto _ : state)
+        {
+            d.FillEllipse(512, 512, radius, radius, 30, 300);
+            benchmark::ClobberMemory();
+        }
+    }
+    BENCHMARK(BM_FillEllipseSector)->RangeMultiplier(4)->Range(4, 1024);
+
+    void BM_DrawRoundedRect(benchmark::State &state)
+    {
+        const int radius = state.range(0);
+        Surface surface(1024, 1024);
+        Drawer d(surface);
+        d.SetDrawStyle(colors::White);
+        for (auto _ : state)
+        {
+            d.DrawRoundedRect(100, 100, 800, 800, radius, radius);
+            benchmark::ClobberMemory();
+        }
+    }
+    BENCHMARK(BM_DrawRoundedRect)->RangeMultiplier(4)->Range(4, 256);
+
+    // Label backgrounds, as drawn by WriteEx. The "pixels_written" counter
+    // is the number of pixel stores per rounded rect.
+    void BM_FillRoundedRect(benchmark::State &state)
+    {
+        const int size = state.range(0);
+        const int radius = std::max(2, size / 8);
+        Surface surface(1024, 1024);
+        Drawer d(surface);
+        d.SetFillStyle(colors::Red);
+        for (auto _ : state)
+        {
+            d.FillRoundedRect(10, 10, 2 * size, size, radius, radius);
+            benchmark::ClobberMemory();
+        }
+        int covered = 0;
+        d.Clear(colors::Black);
+        d.FillRoundedRect(10, 10, 2 * size, size, radius, radius);
+        for (Color c : surface.pixels)
+        {
+            covered += c == colors::Red;
+        }
+        state.counters["pixels_written"] = covered;
+        state.SetItemsProcessed(state.iterations() * covered);
+    }
+    BENCHMARK(BM_FillRoundedRect)->RangeMultiplier(4)->Range(16, 1024 / 2);
+
+    // The previous FillRoundedRect: four full ellipses and three rectangles.
+    void BM_FillRoundedRectComposite(benchmark::State &state)
+    {
+        const int size = state.range(0);
+        const int radius = std::max(2, size / 8);
+        const int x = 10, y = 10, w = 2 * size, h = size;
+        const int x2 = x + w - 1;
+        const int y2 = y + h - 1;
+        Surface surface(1024, 1024);
+        Drawer d(surface);
+        d.SetFillStyle(colors::Red);
+        auto fill = [&](Drawer &d)
+        {
+            d.FillEllipse(x + radius, y + radius, radius, radius);
+            d.FillEllipse(x + radius, y2 - radius, radius, radius);
+            d.FillEllipse(x2 - radius, y + radius, radius, radius);
+            d.FillEllipse(x2 - radius, y2 - radius, radius, radius);
+            d.FillRect(x + radius, y, w - 2 * radius, radius);
+            d.FillRect(x, y + radius, w, h - 2 * radius);
+            d.FillRect(x + radius, y2 - radius + 1, w - 2 * radius, radius);
+        };
+        for (auto _ : state)
+        {
+            fill(d);
+            benchmark::ClobberMemory();
+        }
+
+        // Count the stores: the pixels of each piece, drawn on its own.
+        int written = 0;
+        {
+            Surface counts(1024, 1024);
+            for (int piece = 0; piece < 7; piece++)
+            {
+                Drawer c(counts);
+                c.Clear(colors::Black);
+                c.SetFillStyle(colors::Red);
+                if (piece < 4)
+                    c.FillEllipse(piece < 2 ? x + radius : x2 - radius, piece % 2 ? y2 - radius : y + radius, radius, radius);
+                else if (piece == 4)
+                    c.FillRect(x + radius, y, w - 2 * radius, radius);
+                else if (piece == 5)
+                    c.FillRect(x, y + radius, w, h - 2 * radius);
+                else
+                    c.FillRect(x + radius, y2 - radius + 1, w - 2 * radius, radius);
+                for (Color p : counts.pixels)
+                {
+                    written += p == colors::Red;
+                }
+            }
+        }
+        state.counters["pixels_written"] = written;
+        state.SetItemsProcessed(state.iterations() * written);
+    }
+    BENCHMARK(BM_FillRoundedRectComposite)->RangeMultiplier(4)->Range(16, 1024 / 2);
+
+    void BM_FillRect(benchmark::State &state, FillPattern pattern)
+    {
+        const int size = state.range(0);
+        Surface surface(size, size);
+        Drawer d(surface);
+        d.SetFillStyle(pattern, colors::Blue, colors::Yellow);
+        for (auto _ : state)
+        {
+            d.FillRect(1, 1, size - 2, size - 2);
+            benchmark::ClobberMemory();
+        }
+        state.SetItemsProcessed(state.iterations() * (size - 2) * (size - 2));
+    }
+    BENCHMARK_CAPTURE(BM_FillRect, Solid, fill_patterns::SolidBg)->RangeMultiplier(4)->Range(16, 1024);
+    BENCHMARK_CAPTURE(BM_FillRect, Hatch, fill_patterns::Hatch)->RangeMultiplier(4)->Range(16, 1024);
+    BENCHMARK_CAPTURE(BM_FillRect, CrossHatch, fill_patterns::CrossHatch)->RangeMultiplier(4)->Range(16, 1024);
+
+    // A HUD: 100 short strings per iteration, partly clipped at the right edge.
+    void BM_Write(benchmark::State &state)
+    {
+        const int scale = state.range(0);
+        Surface surface(1024, 768);
+        Drawer d(surface);
+        d.SetWriteStyle(colors::White, scale, scale);
+        for (auto _ : state)
+        {
+            for (int i = 0; i < 100; i++)
+            {
+                d.Write((i * 97) % 1000, (i * 53) % 760, "x=1234 y=567");
+            }
+            benchmark::ClobberMemory();
+        }
+        state.SetItemsProcessed(state.iterations() * 100);
+    }
+    BENCHMARK(BM_Write)->DenseRange(1, 3);
+
+    // Lines of length `range(0)` through the center of a 1024x768 surface, in
+    // 64 directions. Long lines are mostly off-screen.
+    void BM_DrawLine(benchmark::State &state)
+    {
+        const int length = state.range(0);
+        Surface surface(1024, 768);
+        Drawer d(surface);
+        d.SetDrawStyle(colors::White);
+        Polygon ends;
+        for (int i = 0; i < 64; i++)
+        {
+            const double angle = i * 2 * 3.14159265358979 / 64;
+            ends.emplace_back(Int(std::cos(angle) * length / 2), Int(std::sin(angle) * length / 2));
+        }
+        for (auto _ : state)
+        {
+            for (const Point &p : ends)
+            {
+                d.DrawLine(512 - p.x, 384 - p.y, 512 + p.x, 384 + p.y);
+            }
+            benchmark::ClobberMemory();
+        }
+        state.SetItemsProcessed(state.iterations() * ends.size());
+    }
+    BENCHMARK(BM_DrawLine)->RangeMultiplier(8)->Range(8, 1 << 20);
+
+    void BM_DrawLineAxisAligned(benchmark::State &state, bool horizontal)
+    {
+        const int length = state.range(0);
+        Surface surface(1024, 768);
+        Drawer d(surface);
+        d.SetDrawStyle(colors::White);
+        for (auto _ : state)
+        {
+            for (int i = 0; i < 64; i++)
+            {
+                if (horizontal)
+                {
+                    d.DrawLine(512 - length / 2, i * 12, 512 + length / 2, i * 12);
+                }
+                else
+                {
+                    d.DrawLine(i * 16, 384 - length / 2, i * 16, 384 + length / 2);
+                }
+            }
+            benchmark::ClobberMemory();
+        }
+        state.SetItemsProcessed(state.iterations() * 64);
+    }
+    BENCHMARK_CAPTURE(BM_DrawLineAxisAligned, Horizontal, true)->RangeMultiplier(8)->Range(8, 1 << 20);
+    BENCHMARK_CAPTURE(BM_DrawLineAxisAligned, Vertical, false)->RangeMultiplier(8)->Range(8, 1 << 20);
+
+    // Where a benchmarked shape is drawn on its 512x512 surface.
+    enum class Placement
+    {
+        kInside,
+        // Across the top right corner.
+        kPartlyClipped,
+        // Outside the surface.
+        kClippedAway,
+    };
+
+    // Draws a shape whose bounding box is (x, y, size, size).
+    using Primitive = void (*)(Drawer &d, int x, int y, int size);
+
+    // One Drawer method with a size of range(0), with a hatch fill style.
+    void BM_Primitive(benchmark::State &state, Primitive primitive, Placement placement)
+    {
+        const int size = state.range(0);
+        Surface surface(512, 512);
+        Drawer d(surface);
+        d.SetFillStyle(fill_patterns::Hatch, colors::Blue, colors::Yellow);
+        d.SetDrawStyle(colors::White);
+        d.SetWriteStyle(colors::White);
+        int x = (surface.w - size) / 2;
+        int y = (surface.h - size) / 2;
+        if (placement == Placement::kPartlyClipped)
+        {
+            x = surface.w - size / 2;
+            y = -size / 2;
+        }
+        else if (placement == Placement::kClippedAway)
+        {
+            x = surface.w + size;
+            y = -2 * size;
+        }
+        for (auto _ : state)
+        {
+            primitive(d, x, y, size);
+            benchmark::ClobberMemory();
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+
+#define BGI_BENCHMARK_PRIMITIVE(name, ...)                                                      \
+    BENCHMARK_CAPTURE(BM_Primitive, name##_Inside,                                               \
+                      [](Drawer &d, int x, int y, int size) { __VA_ARGS__; }, Placement::kInside) \
+        ->RangeMultiplier(8)                                                                     \
+        ->Range(8, 512);                                                                         \
+    BENCHMARK_CAPTURE(BM_Primitive, name##_PartlyClipped,                                        \
+                      [](Drawer &d, int x, int y, int size) { __VA_ARGS__; },                    \
+                      Placement::kPartlyClipped)                                                 \
+        ->RangeMultiplier(8)                                                                     \
+        ->Range(8, 512);                                                                         \
+    BENCHMARK_CAPTURE(BM_Primitive, name##_ClippedAway,                                          \
+                      [](Drawer &d, int x, int y, int size) { __VA_ARGS__; },                    \
+                      Placement::kClippedAway)                                                   \
+        ->RangeMultiplier(8)                                                                     \
+        ->Range(8, 512)
+
+    BGI_BENCHMARK_PRIMITIVE(SetPixel, d.SetPixel(x + size / 2, y + size / 2, colors::Red));
+    BGI_BENCHMARK_PRIMITIVE(GetPixel, benchmark::DoNotOptimize(d.GetPixel(x + size / 2, y + size / 2)));
+    BGI_BENCHMARK_PRIMITIVE(Clear, d.Viewport(x, y, size, size).Clear(colors::Black));
+    BGI_BENCHMARK_PRIMITIVE(DrawRect, d.DrawRect(x, y, size, size));
+    BGI_BENCHMARK_PRIMITIVE(FillRect, d.FillRect(x, y, size, size));
+    BGI_BENCHMARK_PRIMITIVE(DrawRoundedRect, d.DrawRoundedRect(x, y, size, size, size / 4, size / 8));
+    BGI_BENCHMARK_PRIMITIVE(FillRoundedRect, d.FillRoundedRect(x, y, size, size, size / 4, size / 8));
+    BGI_BENCHMARK_PRIMITIVE(DrawEllipse, d.DrawEllipse(x + size / 2, y + size / 2, size / 2, size / 3));
+    BGI_BENCHMARK_PRIMITIVE(FillEllipse, d.FillEllipse(x + size / 2, y + size / 2, size / 2, size / 3));
+    BGI_BENCHMARK_PRIMITIVE(DrawArc, d.DrawEllipse(x + size / 2, y + size / 2, size / 2, size / 3, 30, 250));
+    BGI_BENCHMARK_PRIMITIVE(FillSector, d.FillEllipse(x + size / 2, y + size / 2, size / 2, size / 3, 30, 250));
+    BGI_BENCHMARK_PRIMITIVE(DrawLine, d.DrawLine(x, y, x + size - 1, y + size / 3));
+    BGI_BENCHMARK_PRIMITIVE(DrawOpenPoly, d.DrawOpenPoly(MakePolygon(x, y, x + size, y + size / 2, x, y + size, x + size / 2, y)));
+    BGI_BENCHMARK_PRIMITIVE(DrawPoly, d.DrawPoly(x, y, x + size, y + size / 2, x, y + size, x + size / 2, y));
+    BGI_BENCHMARK_PRIMITIVE(FillPoly, d.FillPoly(x, y, x + size, y + size / 2, x, y + size, x + size / 2, y));
+    BGI_BENCHMARK_PRIMITIVE(Write, d.Write(x, y, std::string_view("0123456789abcdefghijklmnopqrstuvwxyz", size / 8 <= 36 ? size / 8 : 36)));
+    BGI_BENCHMARK_PRIMITIVE(WriteEx, d.WriteEx(x, y, "label", Padding{2, 2, 1, 1}, Margin{1, 1, 1, 1}, size / 16, size / 16));
+
+#undef BGI_BENCHMARK_PRIMITIVE
+
+    // Text with different horizontal and vertical scales.
+    void BM_WriteScaled(benchmark::State &state)
+    {
+        const int scale_x = state.range(0);
+        const int scale_y = state.range(1);
+        Surface surface(1024, 768);
+        Drawer d(surface);
+        d.SetWriteStyle(colors::White, scale_x, scale_y);
+        for (auto _ : state)
+        {
+            d.Write(10, 10, "The quick brown fox");
+            benchmark::ClobberMemory();
+        }
+        state.SetItemsProcessed(state.iterations() * 19);
+    }
+    BENCHMARK(BM_WriteScaled)->Args({1, 1})->Args({2, 1})->Args({1, 2})->Args({3, 5})->Args({6, 6});
+
+    // Transforming a polygon with range(0) vertices.
+    void BM_Transform(benchmark::State &state, TransformType transform)
+    {
+        const int num_vertices = state.range(0);
+        const Polygon polygon = MakeRoundPolygon(num_vertices, 512, /*star=*/false);
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(Transform(polygon, transform));
+        }
+        state.SetItemsProcessed(state.iterations() * num_vertices);
+    }
+    BENCHMARK_CAPTURE(BM_Transform, Translate, TransformType{0, 1, 1, 10, 20})->RangeMultiplier(8)->Range(8, 4096);
+    BENCHMARK_CAPTURE(BM_Transform, Scale, TransformType{0, 1.5, 0.5, 10, 20})->RangeMultiplier(8)->Range(8, 4096);
+    BENCHMARK_CAPTURE(BM_Transform, Rotate, TransformType{30, 1.5, 0.5, 10, 20})->RangeMultiplier(8)->Range(8, 4096);
+
+    // Transforming the points of a polygon with range(0) vertices in place,
+    // with an Affine matrix (rotating, scaling and translating).
+    void BM_AffineApply(benchmark::State &state)
+    {
+        const int num_vertices = state.range(0);
+        Polygon polygon = MakeRoundPolygon(num_vertices, 512, /*star=*/false);
+        const Affine m = Affine::FromTransform(TransformType{30, 1.5, 0.5, 10, 20});
+        for (auto _ : state)
+        {
+            m.Apply(polygon);
+            benchmark::ClobberMemory();
+        }
+        state.SetItemsProcessed(state.iterations() * num_vertices);
+    }
+    BENCHMARK(BM_AffineApply)->RangeMultiplier(8)->Range(8, 4096);
+
+    // Filling a rotated polygon: transforming a copy first, or transforming
+    // while filling.
+    void BM_FillRotatedPoly(benchmark::State &state, bool copy)
+    {
+        Surface surface(1024, 1024);
+        Drawer d(surface);
+        const Polygon polygon = MakeRoundPolygon(state.range(0), 512, /*star=*/false);
+        int angle = 0;
+        for (auto _ : state)
+        {
+            const Affine m = Affine::Translate(256, 256) * Affine::Rotate(Float(angle++ % 360));
+            if (copy)
+            {
+                d.FillPoly(Transform(polygon, m));
+            }
+            else
+            {
+                d.FillPoly(polygon, m);
+            }
+            benchmark::ClobberMemory();
+        }
+    }
+    BENCHMARK_CAPTURE(BM_FillRotatedPoly, Copy, true)->Arg(8)->Arg(64)->Arg(512);
+    BENCHMARK_CAPTURE(BM_FillRotatedPoly, InPlace, false)->Arg(8)->Arg(64)->Arg(512);
+
+    // Filling a rect in BlendMode::kSourceOver: an opaque color (which is
+    // stored as in kCopy), a translucent color and a translucent pattern.
+    void BM_FillRectBlend(benchmark::State &state, Color color, bool pattern)
+    {
+        Surface surface(1024, 1024);
+        Drawer d(surface);
+        d.SetBlendMode(BlendMode::kSourceOver);
+        if (pattern)
+        {
+            d.SetFillStyle(fill_patterns::CloseDot, color, Argb(0x40, 0, 0, 0xff));
+        }
+        else
+        {
+            d.SetFillStyle(color);
+        }
+        const int size = state.range(0);
+        for (auto _ : state)
+        {
+            d.FillRect(0, 0, size, size);
+            benchmark::ClobberMemory();
+        }
+        state.SetItemsProcessed(state.iterations() * size * size);
+    }
+    BENCHMARK_CAPTURE(BM_FillRectBlend, Opaque, colors::Red, false)->Arg(16)->Arg(256)->Arg(1024);
+    BENCHMARK_CAPTURE(BM_FillRectBlend, Translucent, Argb(0x80, 0xff, 0, 0), false)->Arg(16)->Arg(256)->Arg(1024);
+    BENCHMARK_CAPTURE(BM_FillRectBlend, Pattern, Argb(0x80, 0xff, 0, 0), true)->Arg(16)->Arg(256)->Arg(1024);
+
+    // How BM_Blit copies the sprite.
+    enum class BlitType
+    {
+        kSetPixel,
+        kCopy,
+        kKeyed,
+        kBlended,
+    };
+
+    // Copying a size x size sprite.
+    void BM_Blit(benchmark::State &state, BlitType type)
+    {
+        const int size = state.range(0);
+        Surface sprite(size, size);
+        for (size_t i = 0; i < sprite.pixels.size(); i++)
+        {
+            // Opaque, transparent (or keyed) and translucent stripes.
+            sprite.pixels[i] = i % 24 < 8 ? colors::Red : i % 24 < 16 ? 0 : Argb(0x80, 0x80, 0, 0);
+        }
+        Surface surface(1024, 1024);
+        Drawer d(surface);
+        for (auto _ : state)
+        {
+            switch (type)
+            {
+            case BlitType::kSetPixel:
+                for (int y = 0; y < size; y++)
+                {
+                    for (int x = 0; x < size; x++)
+                    {
+                        d.SetPixel(10 + x, 10 + y, sprite.row(y)[x]);
+                    }
+                }
+                break;
+            case BlitType::kCopy:
+                d.Blit(sprite, Rect(0, 0, size, size), 10, 10);
+                break;
+            case BlitType::kKeyed:
+                d.BlitKeyed(sprite, Rect(0, 0, size, size), 10, 10, 0);
+                break;
+            case BlitType::kBlended:
+                d.BlitBlended(sprite, Rect(0, 0, size, size), 10, 10);
+                break;
+            }
+            benchmark::ClobberMemory();
+        }
+        state.SetItemsProcessed(state.iterations() * size * size);
+    }
+    BENCHMARK_CAPTURE(BM_Blit, SetPixel, BlitType::kSetPixel)->Arg(16)->Arg(64)->Arg(512);
+    BENCHMARK_CAPTURE(BM_Blit, Copy, BlitType::kCopy)->Arg(16)->Arg(64)->Arg(512);
+    BENCHMARK_CAPTURE(BM_Blit, Keyed, BlitType::kKeyed)->Arg(16)->Arg(64)->Arg(512);
+    BENCHMARK_CAPTURE(BM_Blit, Blended, BlitType::kBlended)->Arg(16)->Arg(64)->Arg(512);
+
+    // Filling the same polygon each frame: rasterizing it each time, or
+    // replaying its cached spans.
+    void BM_FillCachedPoly(benchmark::State &state, bool cached)
+    {
+        Surface surface(1024, 1024);
+        Drawer d(surface);
+        const Polygon polygon = MakeRoundPolygon(state.range(0), 512, /*star=*/true);
+        const Affine m = Affine::Translate(512, 512);
+        ShapeCache cache;
+        for (auto _ : state)
+        {
+            if (cached)
+            {
+                d.FillShape(cache.GetPolygon(polygon, m));
+            }
+            else
+            {
+                d.FillPoly(polygon, m);
+            }
+            benchmark::ClobberMemory();
+        }
+    }
+    BENCHMARK_CAPTURE(BM_FillCachedPoly, FillPoly, false)->Arg(8)->Arg(64)->Arg(512);
+    BENCHMARK_CAPTURE(BM_FillCachedPoly, FillShape, true)->Arg(8)->Arg(64)->Arg(512);
+
+    // Like BM_Transform, with the results in a PolygonArena that is reset
+    // after each one, as in a frame.
+    void BM_TransformInArena(benchmark::State &state)
+    {
+        const int num_vertices = state.range(0);
+        const Polygon polygon = MakeRoundPolygon(num_vertices, 512, /*star=*/false);
+        PolygonArena arena;
+        for (auto _ : state)
+        {
+            PolygonArena::Scope scope(arena);
+            benchmark::DoNotOptimize(Transform(polygon, TransformType{0, 1, 1, 10, 20}));
+        }
+        state.SetItemsProcessed(state.iterations() * num_vertices);
+    }
+    BENCHMARK(BM_TransformInArena)->RangeMultiplier(8)->Range(8, 4096);
+
+    void BM_MakeEllipticalArc(benchmark::State &state)
+    {
+        const int radius = state.range(0);
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(MakeEllipticalArc(0, 0, radius, radius / 2, 30, 300));
+        }
+    }
+    BENCHMARK(BM_MakeEllipticalArc)->RangeMultiplier(8)->Range(8, 4096);
+
+    // The grill simulator example, without a display: animating, drawing
+    // and presenting an 800x600 frame to an off-screen window.
+    void BM_GrillScene(benchmark::State &state, bool open)
+    {
+        OffscreenWindow window(800, 600);
+        Surface surface(window.size());
+        Drawer d(surface);
+        grill::GrillState grill_state;
+        grill_state.open = open;
+        for (auto _ : state)
+        {
+            if (grill_state.door_anim == grill::DoorAnim::None)
+            {
+                grill_state.door_anim = grill_state.door_open_pct == 0 ? grill::DoorAnim::Open : grill::DoorAnim::Close;
+            }
+            grill::Animate(grill_state);
+            grill::DrawGrill(d, grill_state);
+            window.Update(surface);
+        }
+        state.counters["fps"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+        state.counters["pixels_per_second"] = benchmark::Counter(state.iterations() * surface.w * surface.h, benchmark::Counter::kIsRate);
+    }
+    BENCHMARK_CAPTURE(BM_GrillScene, Closed, false)->UseRealTime();
+    BENCHMARK_CAPTURE(BM_GrillScene, Open, true)->UseRealTime();
+
+    // Replaying a recorded frame of the grill scene, as recorded or
+    // optimized.
+    void BM_GrillSceneReplay(benchmark::State &state, bool optimize)
+    {
+        Surface surface(800, 600);
+        DisplayList list(surface.w, surface.h);
+        grill::GrillState grill_state;
+        grill_state.door_open_pct = 50;
+        grill::DrawGrill(Drawer(list), grill_state);
+        if (optimize)
+        {
+            list.Optimize();
+        }
+        Drawer d(surface);
+        for (auto _ : state)
+        {
+            list.Replay(d);
+            benchmark::ClobberMemory();
+        }
+        state.counters["calls"] = list.size();
+        state.counters["bytes"] = list.bytes();
+    }
+    BENCHMARK_CAPTURE(BM_GrillSceneReplay, Recorded, false);
+    BENCHMARK_CAPTURE(BM_GrillSceneReplay, Optimized, true);
+
+    // The grill scene presented through a swap chain with `buffers`
+    // buffers, so that drawing overlaps with presenting.
+    void BM_GrillSceneSwapChain(benchmark::State &state)
+    {
+        OffscreenWindow window(800, 600);
+        grill::GrillState grill_state;
+        SwapChain chain(window, state.range(0));
+        for (auto _ : state)
+        {
+            if (grill_state.door_anim == grill::DoorAnim::None)
+            {
+                grill_state.door_anim = grill_state.door_open_pct == 0 ? grill::DoorAnim::Open : grill::DoorAnim::Close;
+            }
+            grill::Animate(grill_state);
+            grill::DrawGrill(Drawer(chain.Acquire()), grill_state);
+            chain.Submit();
+        }
+        chain.Wait();
+        state.counters["fps"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+    }
+    BENCHMARK(BM_GrillSceneSwapChain)->Arg(2)->Arg(3)->UseRealTime();
+
+    // A scrolled 200x200 panel whose content is 4000x4000, so most of the
+    // shapes are clipped away.
+    void BM_ScrolledPanel(benchmark::State &state)
+    {
+        Surface surface(1024, 768);
+        Drawer panel = Drawer(surface).Viewport(100, 100, 200, 200);
+        Drawer content = panel.Viewport(-1900, -1900, 4000, 4000);
+        content.SetFillStyle(fill_patterns::Hatch, colors::Blue, colors::Yellow);
+        content.SetDrawStyle(colors::White);
+        for (auto _ : state)
+        {
+            for (int y = 0; y < 4000; y += 100)
+            {
+                for (int x = 0; x < 4000; x += 100)
+                {
+                    content.FillRoundedRect(x, y, 90, 90, 10, 10);
+                    content.DrawEllipse(x + 45, y + 45, 40, 30);
+                    content.DrawLine(x, y, x + 90, y + 90);
+                    content.Write(x + 5, y + 40, "label");
+                }
+            }
+            benchmark::ClobberMemory();
+        }
+        state.SetItemsProcessed(state.iterations() * 40 * 40 * 4);
+    }
+    BENCHMARK(BM_ScrolledPanel);
+
+    // Clearing a 64 MiB surface, on the calling thread (threads = 0) or
+    // split across a pool.
+    void BM_ClearLarge(benchmark::State &state)
+    {
+        const int threads = state.range(0);
+        Surface surface(4096, 4096);
+        ThreadPool pool(std::max(threads, 1));
+        Drawer d(surface);
+        if (threads > 0)
+        {
+            d.SetThreadPool(&pool);
+        }
+        for (auto _ : state)
+        {
+            d.Clear(colors::Blue);
+            benchmark::ClobberMemory();
+        }
+        state.SetBytesProcessed(state.iterations() * surface.pixels.size() * sizeof(Color));
+    }
+    BENCHMARK(BM_ClearLarge)->Arg(0)->Arg(1)->Arg(4)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+    // Many polygons, ellipses and labels on a 4K frame, drawn right away
+    // (threads = 0) or binned into tiles and drawn by `threads` threads.
+    void BM_TiledFrame(benchmark::State &state)
+    {
+        const int threads = state.range(0);
+        Surface surface(3840, 2160);
+        std::unique_ptr<TileRenderer> renderer;
+        if (threads > 0)
+        {
+            renderer = std::make_unique<TileRenderer>(surface, threads);
+        }
+        Drawer d = renderer ? Drawer(*renderer) : Drawer(surface);
+        d.SetDrawStyle(colors::White);
+        d.SetWriteStyle(colors::Yellow, 2, 2);
+        const Polygon star = MakeRoundPolygon(10, 120, /*star=*/true);
+        for (auto _ : state)
+        {
+            d.Clear(colors::Black);
+            for (int y = 0; y < 2160; y += 120)
+            {
+                for (int x = 0; x < 3840; x += 120)
+                {
+                    d.SetFillStyle(fill_patterns::Slash, colors::Blue, colors::LightBlue);
+                    d.FillPoly(Transform(star, 0, 1, 1, x, y));
+                    d.SetFillStyle(colors::Red);
+                    d.FillEllipse(x + 60, y + 60, 30, 20);
+                    d.DrawEllipse(x + 60, y + 60, 40, 30);
+                    d.Write(x + 10, y + 90, "tile");
+                }
+            }
+            if (renderer)
+            {
+                renderer->Flush();
+            }
+            benchmark::ClobberMemory();
+        }
+        state.SetItemsProcessed(state.iterations() * 18 * 32 * 4);
+    }
+    BENCHMARK(BM_TiledFrame)->Arg(0)->Arg(1)->Arg(4)->Arg(16)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+} // namespace
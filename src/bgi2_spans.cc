@@ -0,0 +1,693 @@
+#include "bgi2_spans.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define BGI_SPANS_SSE2 1
+#if defined(__GNUC__)
+#define BGI_SPANS_AVX2 1
+#endif
+#endif
+
+namespace bgi::spans
+{
+    namespace
+    {
+        // Returns the number of pixels before `dst` is aligned to `alignment`
+        // bytes.
+        int MisalignedPixels(const Color *dst, int alignment)
+        {
+            uintptr_t offset = reinterpret_cast<uintptr_t>(dst) & (alignment - 1);
+            return offset == 0 ? 0 : Int((alignment - offset) / sizeof(Color));
+        }
+
+        // Returns the 8 bits of `mask` starting at bit `bit`, MSB first.
+        int MaskByte(const uint8_t *mask, int bit)
+        {
+            const int byte = bit >> 3;
+            const int shift = bit & 7;
+            if (shift == 0)
+            {
+                // Don't touch the next byte, it may be past the end.
+                return mask[byte];
+            }
+            return ((mask[byte] << shift) | (mask[byte + 1] >> (8 - shift))) & 0xff;
+        }
+
+        void FillScalar(Color *dst, int n, Color c)
+        {
+            std::fill(dst, dst + n, c);
+        }
+
+        void FillPatternScalar(Color *dst, int n, const Color *row, int phase)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                dst[i] = row[(phase + i) & 7];
+            }
+        }
+
+        void FillMaskedScalar(Color *dst, int n, const uint8_t *mask, int bit_offset, Color c)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                const int bit = bit_offset + i;
+                if (mask[bit >> 3] & (0x80 >> (bit & 7)))
+                {
+                    dst[i] = c;
+                }
+            }
+        }
+
+        void BlendScalar(Color *dst, int n, Color c)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                dst[i] = BlendPixel(dst[i], c);
+            }
+        }
+
+        void BlendPatternScalar(Color *dst, int n, const Color *row, int phase)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                dst[i] = BlendPixel(dst[i], row[(phase + i) & 7]);
+            }
+        }
+
+        void BlendMaskedScalar(Color *dst, int n, const uint8_t *mask, int bit_offset, Color c)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                const int bit = bit_offset + i;
+                if (mask[bit >> 3] & (0x80 >> (bit & 7)))
+                {
+                    dst[i] = BlendPixel(dst[i], c);
+                }
+            }
+        }
+
+        void CopyKeyedScalar(Color *dst, const Color *src, int n, Color key)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                if (src[i] != key)
+                {
+                    dst[i] = src[i];
+                }
+            }
+        }
+
+        void BlendPixelsScalar(Color *dst, const Color *src, int n)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                dst[i] = BlendPixel(dst[i], src[i]);
+            }
+        }
+
+        void TransformPointsScalar(const Point *src, size_t n, const Affine &m, Point *dst)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                const float x = static_cast<float>(src[i].x);
+                const float y = static_cast<float>(src[i].y);
+                dst[i] = Point(Round(m.a * x + m.b * y + m.tx), Round(m.c * x + m.d * y + m.ty));
+            }
+        }
+
+#if BGI_SPANS_SSE2
+        // Rounds to the nearest integer, halfway cases away from zero, like
+        // std::round().
+        __m128i RoundSse2(__m128 v)
+        {
+            const __m128i truncated = _mm_cvttps_epi32(v);
+            const __m128 fraction = _mm_sub_ps(v, _mm_cvtepi32_ps(truncated));
+            // The masks are -1 where the fraction rounds up or down.
+            const __m128i up = _mm_castps_si128(_mm_cmpge_ps(fraction, _mm_set1_ps(0.5f)));
+            const __m128i down = _mm_castps_si128(_mm_cmple_ps(fraction, _mm_set1_ps(-0.5f)));
+            return _mm_add_epi32(_mm_sub_epi32(truncated, up), down);
+        }
+
+        // Two points at a time: (x0, y0, x1, y1) times (a, d, a, d), plus
+        // (y0, x0, y1, x1) times (b, c, b, c), plus (tx, ty, tx, ty).
+        void TransformPointsSse2(const Point *src, size_t n, const Affine &m, Point *dst)
+        {
+            const __m128 ad = _mm_setr_ps(m.a, m.d, m.a, m.d);
+            const __m128 bc = _mm_setr_ps(m.b, m.c, m.b, m.c);
+            const __m128 t = _mm_setr_ps(m.tx, m.ty, m.tx, m.ty);
+            size_t i = 0;
+            for (; i + 2 <= n; i += 2)
+            {
+                const __m128 v = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i)));
+                const __m128 swapped = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+                const __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v, ad), _mm_mul_ps(swapped, bc)), t);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), RoundSse2(r));
+            }
+            TransformPointsScalar(src + i, n - i, m, dst + i);
+        }
+
+        void FillSse2(Color *dst, int n, Color c)
+        {
+            int head = std::min(n, MisalignedPixels(dst, 16));
+            FillScalar(dst, head, c);
+
+            const __m128i v = _mm_set1_epi32(static_cast<int>(c));
+            int i = head;
+            for (; i + 4 <= n; i += 4)
+            {
+                _mm_store_si128(reinterpret_cast<__m128i *>(dst + i), v);
+            }
+            FillScalar(dst + i, n - i, c);
+        }
+
+        void FillStreamSse2(Color *dst, int n, Color c)
+        {
+            int head = std::min(n, MisalignedPixels(dst, 16));
+            FillScalar(dst, head, c);
+
+            const __m128i v = _mm_set1_epi32(static_cast<int>(c));
+            int i = head;
+            for (; i + 4 <= n; i += 4)
+            {
+                _mm_stream_si128(reinterpret_cast<__m128i *>(dst + i), v);
+            }
+            _mm_sfence();
+            FillScalar(dst + i, n - i, c);
+        }
+
+        void FillPatternSse2(Color *dst, int n, const Color *row, int phase)
+        {
+            int head = std::min(n, MisalignedPixels(dst, 16));
+            FillPatternScalar(dst, head, row, phase);
+
+            alignas(16) Color rotated[8];
+            for (int j = 0; j < 8; j++)
+            {
+                rotated[j] = row[(phase + head + j) & 7];
+            }
+            const __m128i lo = _mm_load_si128(reinterpret_cast<const __m128i *>(rotated));
+            const __m128i hi = _mm_load_si128(reinterpret_cast<const __m128i *>(rotated + 4));
+            int i = head;
+            for (; i + 8 <= n; i += 8)
+            {
+                _mm_store_si128(reinterpret_cast<__m128i *>(dst + i), lo);
+                _mm_store_si128(reinterpret_cast<__m128i *>(dst + i + 4), hi);
+            }
+            FillPatternScalar(dst + i, n - i, rotated, i - head);
+        }
+
+        // Sets the 4 pixels to `color`, where the bits of `nibble` are set (MSB first).
+        inline void FillMasked4Sse2(Color *dst, int nibble, __m128i color)
+        {
+            const __m128i bits = _mm_setr_epi32(0x8, 0x4, 0x2, 0x1);
+            const __m128i lanes = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(nibble), bits), bits);
+            const __m128i old = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+                             _mm_or_si128(_mm_and_si128(lanes, color), _mm_andnot_si128(lanes, old)));
+        }
+
+        void FillMaskedSse2(Color *dst, int n, const uint8_t *mask, int bit_offset, Color c)
+        {
+            const __m128i color = _mm_set1_epi32(static_cast<int>(c));
+            int i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                const int byte = MaskByte(mask, bit_offset + i);
+                if (byte == 0xff)
+                {
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), color);
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 4), color);
+                }
+                else if (byte != 0)
+                {
+                    FillMasked4Sse2(dst + i, byte >> 4, color);
+                    FillMasked4Sse2(dst + i + 4, byte & 0xf, color);
+                }
+            }
+            FillMaskedScalar(dst + i, n - i, mask, bit_offset + i, c);
+        }
+
+        // Returns 255 - alpha of the 4 colors in `src`, in the 16 bit lanes
+        // of the channels of the first two (lo) and the last two (hi).
+        inline void InverseAlphaSse2(__m128i src, __m128i &lo, __m128i &hi)
+        {
+            const __m128i inv = _mm_sub_epi32(_mm_set1_epi32(255), _mm_srli_epi32(src, 24));
+            lo = _mm_unpacklo_epi32(inv, inv);
+            hi = _mm_unpackhi_epi32(inv, inv);
+            lo = _mm_or_si128(lo, _mm_slli_epi32(lo, 16));
+            hi = _mm_or_si128(hi, _mm_slli_epi32(hi, 16));
+        }
+
+        // Returns x * inv / 255 in each 16 bit lane, rounded like
+        // BlendPixel().
+        inline __m128i ScaleSse2(__m128i x, __m128i inv)
+        {
+            const __m128i t = _mm_add_epi16(_mm_mullo_epi16(x, inv), _mm_set1_epi16(128));
+            return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+        }
+
+        // Returns the 4 premultiplied colors `src` blended over `dst`, where
+        // inv_lo and inv_hi are from InverseAlphaSse2(src).
+        inline __m128i Blend4Sse2(__m128i dst, __m128i src, __m128i inv_lo, __m128i inv_hi)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i lo = ScaleSse2(_mm_unpacklo_epi8(dst, zero), inv_lo);
+            const __m128i hi = ScaleSse2(_mm_unpackhi_epi8(dst, zero), inv_hi);
+            return _mm_add_epi8(src, _mm_packus_epi16(lo, hi));
+        }
+
+        void BlendSse2(Color *dst, int n, Color c)
+        {
+            const __m128i src = _mm_set1_epi32(static_cast<int>(c));
+            const __m128i inv = _mm_set1_epi16(static_cast<short>(255 - (c >> 24)));
+            int i = 0;
+            for (; i + 4 <= n; i += 4)
+            {
+                __m128i *p = reinterpret_cast<__m128i *>(dst + i);
+                _mm_storeu_si128(p, Blend4Sse2(_mm_loadu_si128(p), src, inv, inv));
+            }
+            BlendScalar(dst + i, n - i, c);
+        }
+
+        void BlendPatternSse2(Color *dst, int n, const Color *row, int phase)
+        {
+            alignas(16) Color rotated[8];
+            for (int j = 0; j < 8; j++)
+            {
+                rotated[j] = row[(phase + j) & 7];
+            }
+            __m128i src[2];
+            __m128i inv_lo[2];
+            __m128i inv_hi[2];
+            for (int k = 0; k < 2; k++)
+            {
+                src[k] = _mm_load_si128(reinterpret_cast<const __m128i *>(rotated + 4 * k));
+                InverseAlphaSse2(src[k], inv_lo[k], inv_hi[k]);
+            }
+            int i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                for (int k = 0; k < 2; k++)
+                {
+                    __m128i *p = reinterpret_cast<__m128i *>(dst + i + 4 * k);
+                    _mm_storeu_si128(p, Blend4Sse2(_mm_loadu_si128(p), src[k], inv_lo[k], inv_hi[k]));
+                }
+            }
+            BlendPatternScalar(dst + i, n - i, rotated, i);
+        }
+
+        // Blends `src` over the 4 pixels where the bits of `nibble` are set
+        // (MSB first).
+        inline void BlendMasked4Sse2(Color *dst, int nibble, __m128i src, __m128i inv)
+        {
+            const __m128i bits = _mm_setr_epi32(0x8, 0x4, 0x2, 0x1);
+            const __m128i lanes = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(nibble), bits), bits);
+            const __m128i old = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst));
+            const __m128i blended = Blend4Sse2(old, src, inv, inv);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+                             _mm_or_si128(_mm_and_si128(lanes, blended), _mm_andnot_si128(lanes, old)));
+        }
+
+        void BlendMaskedSse2(Color *dst, int n, const uint8_t *mask, int bit_offset, Color c)
+        {
+            const __m128i src = _mm_set1_epi32(static_cast<int>(c));
+            const __m128i inv = _mm_set1_epi16(static_cast<short>(255 - (c >> 24)));
+            int i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                const int byte = MaskByte(mask, bit_offset + i);
+                if (byte != 0)
+                {
+                    BlendMasked4Sse2(dst + i, byte >> 4, src, inv);
+                    BlendMasked4Sse2(dst + i + 4, byte & 0xf, src, inv);
+                }
+            }
+            BlendMaskedScalar(dst + i, n - i, mask, bit_offset + i, c);
+        }
+
+        void CopyKeyedSse2(Color *dst, const Color *src, int n, Color key)
+        {
+            const __m128i k = _mm_set1_epi32(static_cast<int>(key));
+            int i = 0;
+            for (; i + 4 <= n; i += 4)
+            {
+                const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+                // -1 where the pixel is the key.
+                const __m128i keyed = _mm_cmpeq_epi32(s, k);
+                const int kept = _mm_movemask_ps(_mm_castsi128_ps(keyed)) ^ 0xf;
+                if (kept == 0xf)
+                {
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), s);
+                }
+                else if (kept != 0)
+                {
+                    __m128i *p = reinterpret_cast<__m128i *>(dst + i);
+                    _mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(keyed, _mm_loadu_si128(p)), _mm_andnot_si128(keyed, s)));
+                }
+            }
+            CopyKeyedScalar(dst + i, src + i, n - i, key);
+        }
+
+        void BlendPixelsSse2(Color *dst, const Color *src, int n)
+        {
+            const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xff000000));
+            int i = 0;
+            for (; i + 4 <= n; i += 4)
+            {
+                const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+                __m128i *p = reinterpret_cast<__m128i *>(dst + i);
+                // Opaque pixels are stored, transparent black ones skipped.
+                if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, alpha), alpha)) == 0xffff)
+                {
+                    _mm_storeu_si128(p, s);
+                }
+                else if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, _mm_setzero_si128())) != 0xffff)
+                {
+                    __m128i inv_lo;
+                    __m128i inv_hi;
+                    InverseAlphaSse2(s, inv_lo, inv_hi);
+                    _mm_storeu_si128(p, Blend4Sse2(_mm_loadu_si128(p), s, inv_lo, inv_hi));
+                }
+            }
+            BlendPixelsScalar(dst + i, src + i, n - i);
+        }
+#endif
+
+#if BGI_SPANS_AVX2
+        __attribute__((target("avx2"))) void FillAvx2(Color *dst, int n, Color c)
+        {
+            int head = std::min(n, MisalignedPixels(dst, 32));
+            FillScalar(dst, head, c);
+
+            const __m256i v = _mm256_set1_epi32(static_cast<int>(c));
+            int i = head;
+            for (; i + 16 <= n; i += 16)
+            {
+                _mm256_store_si256(reinterpret_cast<__m256i *>(dst + i), v);
+                _mm256_store_si256(reinterpret_cast<__m256i *>(dst + i + 8), v);
+            }
+            for (; i + 8 <= n; i += 8)
+            {
+                _mm256_store_si256(reinterpret_cast<__m256i *>(dst + i), v);
+            }
+            FillScalar(dst + i, n - i, c);
+        }
+
+        __attribute__((target("avx2"))) void FillStreamAvx2(Color *dst, int n, Color c)
+        {
+            int head = std::min(n, MisalignedPixels(dst, 32));
+            FillScalar(dst, head, c);
+
+            const __m256i v = _mm256_set1_epi32(static_cast<int>(c));
+            int i = head;
+            for (; i + 16 <= n; i += 16)
+            {
+                _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + i), v);
+                _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + i + 8), v);
+            }
+            for (; i + 8 <= n; i += 8)
+            {
+                _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + i), v);
+            }
+            _mm_sfence();
+            FillScalar(dst + i, n - i, c);
+        }
+
+        __attribute__((target("avx2"))) void FillPatternAvx2(Color *dst, int n, const Color *row, int phase)
+        {
+            int head = std::min(n, MisalignedPixels(dst, 32));
+            FillPatternScalar(dst, head, row, phase);
+
+            alignas(32) Color rotated[8];
+            for (int j = 0; j < 8; j++)
+            {
+                rotated[j] = row[(phase + head + j) & 7];
+            }
+            const __m256i v = _mm256_load_si256(reinterpret_cast<const __m256i *>(rotated));
+            int i = head;
+            for (; i + 8 <= n; i += 8)
+            {
+                _mm256_store_si256(reinterpret_cast<__m256i *>(dst + i), v);
+            }
+            FillPatternScalar(dst + i, n - i, rotated, i - head);
+        }
+
+        __attribute__((target("avx2"))) void FillMaskedAvx2(Color *dst, int n, const uint8_t *mask, int bit_offset, Color c)
+        {
+            const __m256i color = _mm256_set1_epi32(static_cast<int>(c));
+            const __m256i bits = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+            int i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                const int byte = MaskByte(mask, bit_offset + i);
+                if (byte != 0)
+                {
+                    const __m256i lanes = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(byte), bits), bits);
+                    _mm256_maskstore_epi32(reinterpret_cast<int *>(dst + i), lanes, color);
+                }
+            }
+            FillMaskedScalar(dst + i, n - i, mask, bit_offset + i, c);
+        }
+
+        // The AVX2 versions of the SSE2 blending helpers. The 128 bit halves
+        // are unpacked and packed separately, so `lo` holds the colors 0, 1,
+        // 4 and 5, and `hi` the colors 2, 3, 6 and 7.
+        __attribute__((target("avx2"))) inline void InverseAlphaAvx2(__m256i src, __m256i &lo, __m256i &hi)
+        {
+            const __m256i inv = _mm256_sub_epi32(_mm256_set1_epi32(255), _mm256_srli_epi32(src, 24));
+            lo = _mm256_unpacklo_epi32(inv, inv);
+            hi = _mm256_unpackhi_epi32(inv, inv);
+            lo = _mm256_or_si256(lo, _mm256_slli_epi32(lo, 16));
+            hi = _mm256_or_si256(hi, _mm256_slli_epi32(hi, 16));
+        }
+
+        __attribute__((target("avx2"))) inline __m256i ScaleAvx2(__m256i x, __m256i inv)
+        {
+            const __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(x, inv), _mm256_set1_epi16(128));
+            return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+        }
+
+        __attribute__((target("avx2"))) inline __m256i Blend8Avx2(__m256i dst, __m256i src, __m256i inv_lo, __m256i inv_hi)
+        {
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i lo = ScaleAvx2(_mm256_unpacklo_epi8(dst, zero), inv_lo);
+            const __m256i hi = ScaleAvx2(_mm256_unpackhi_epi8(dst, zero), inv_hi);
+            return _mm256_add_epi8(src, _mm256_packus_epi16(lo, hi));
+        }
+
+        __attribute__((target("avx2"))) void BlendAvx2(Color *dst, int n, Color c)
+        {
+            const __m256i src = _mm256_set1_epi32(static_cast<int>(c));
+            const __m256i inv = _mm256_set1_epi16(static_cast<short>(255 - (c >> 24)));
+            int i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                __m256i *p = reinterpret_cast<__m256i *>(dst + i);
+                _mm256_storeu_si256(p, Blend8Avx2(_mm256_loadu_si256(p), src, inv, inv));
+            }
+            BlendScalar(dst + i, n - i, c);
+        }
+
+        __attribute__((target("avx2"))) void BlendPatternAvx2(Color *dst, int n, const Color *row, int phase)
+        {
+            alignas(32) Color rotated[8];
+            for (int j = 0; j < 8; j++)
+            {
+                rotated[j] = row[(phase + j) & 7];
+            }
+            const __m256i src = _mm256_load_si256(reinterpret_cast<const __m256i *>(rotated));
+            __m256i inv_lo;
+            __m256i inv_hi;
+            InverseAlphaAvx2(src, inv_lo, inv_hi);
+            int i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                __m256i *p = reinterpret_cast<__m256i *>(dst + i);
+                _mm256_storeu_si256(p, Blend8Avx2(_mm256_loadu_si256(p), src, inv_lo, inv_hi));
+            }
+            BlendPatternScalar(dst + i, n - i, rotated, i);
+        }
+
+        __attribute__((target("avx2"))) void BlendMaskedAvx2(Color *dst, int n, const uint8_t *mask, int bit_offset, Color c)
+        {
+            const __m256i src = _mm256_set1_epi32(static_cast<int>(c));
+            const __m256i inv = _mm256_set1_epi16(static_cast<short>(255 - (c >> 24)));
+            const __m256i bits = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+            int i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                const int byte = MaskByte(mask, bit_offset + i);
+                if (byte != 0)
+                {
+                    __m256i *p = reinterpret_cast<__m256i *>(dst + i);
+                    const __m256i lanes = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(byte), bits), bits);
+                    _mm256_maskstore_epi32(reinterpret_cast<int *>(dst + i), lanes, Blend8Avx2(_mm256_loadu_si256(p), src, inv, inv));
+                }
+            }
+            BlendMaskedScalar(dst + i, n - i, mask, bit_offset + i, c);
+        }
+
+        __attribute__((target("avx2"))) void CopyKeyedAvx2(Color *dst, const Color *src, int n, Color key)
+        {
+            const __m256i k = _mm256_set1_epi32(static_cast<int>(key));
+            int i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+                // -1 where the pixel is kept.
+                const __m256i kept = _mm256_xor_si256(_mm256_cmpeq_epi32(s, k), _mm256_set1_epi32(-1));
+                _mm256_maskstore_epi32(reinterpret_cast<int *>(dst + i), kept, s);
+            }
+            CopyKeyedScalar(dst + i, src + i, n - i, key);
+        }
+
+        __attribute__((target("avx2"))) void BlendPixelsAvx2(Color *dst, const Color *src, int n)
+        {
+            const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xff000000));
+            int i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+                __m256i *p = reinterpret_cast<__m256i *>(dst + i);
+                // Opaque pixels are stored, transparent black ones skipped.
+                if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(s, alpha), alpha)) == -1)
+                {
+                    _mm256_storeu_si256(p, s);
+                }
+                else if (!_mm256_testz_si256(s, s))
+                {
+                    __m256i inv_lo;
+                    __m256i inv_hi;
+                    InverseAlphaAvx2(s, inv_lo, inv_hi);
+                    _mm256_storeu_si256(p, Blend8Avx2(_mm256_loadu_si256(p), s, inv_lo, inv_hi));
+                }
+            }
+            BlendPixelsScalar(dst + i, src + i, n - i);
+        }
+
+        __attribute__((target("avx2"))) void TransformPointsAvx2(const Point *src, size_t n, const Affine &m, Point *dst)
+        {
+            const __m256 ad = _mm256_setr_ps(m.a, m.d, m.a, m.d, m.a, m.d, m.a, m.d);
+            const __m256 bc = _mm256_setr_ps(m.b, m.c, m.b, m.c, m.b, m.c, m.b, m.c);
+            const __m256 t = _mm256_setr_ps(m.tx, m.ty, m.tx, m.ty, m.tx, m.ty, m.tx, m.ty);
+            const __m256 half = _mm256_set1_ps(0.5f);
+            const __m256 minus_half = _mm256_set1_ps(-0.5f);
+            size_t i = 0;
+            for (; i + 4 <= n; i += 4)
+            {
+                const __m256 v = _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i)));
+                const __m256 swapped = _mm256_permute_ps(v, _MM_SHUFFLE(2, 3, 0, 1));
+                const __m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(v, ad), _mm256_mul_ps(swapped, bc)), t);
+                // Rounded like RoundSse2().
+                const __m256i truncated = _mm256_cvttps_epi32(r);
+                const __m256 fraction = _mm256_sub_ps(r, _mm256_cvtepi32_ps(truncated));
+                const __m256i up = _mm256_castps_si256(_mm256_cmp_ps(fraction, half, _CMP_GE_OQ));
+                const __m256i down = _mm256_castps_si256(_mm256_cmp_ps(fraction, minus_half, _CMP_LE_OQ));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_add_epi32(_mm256_sub_epi32(truncated, up), down));
+            }
+            TransformPointsScalar(src + i, n - i, m, dst + i);
+        }
+#endif
+
+        struct Kernels
+        {
+            const char *name;
+            void (*fill)(Color *dst, int n, Color c);
+            void (*fill_stream)(Color *dst, int n, Color c);
+            void (*fill_pattern)(Color *dst, int n, const Color *row, int phase);
+            void (*fill_masked)(Color *dst, int n, const uint8_t *mask, int bit_offset, Color c);
+            void (*blend)(Color *dst, int n, Color c);
+            void (*blend_pattern)(Color *dst, int n, const Color *row, int phase);
+            void (*blend_masked)(Color *dst, int n, const uint8_t *mask, int bit_offset, Color c);
+            void (*copy_keyed)(Color *dst, const Color *src, int n, Color key);
+            void (*blend_pixels)(Color *dst, const Color *src, int n);
+            void (*transform_points)(const Point *src, size_t n, const Affine &transform, Point *dst);
+        };
+
+        Kernels SelectKernels()
+        {
+#if BGI_SPANS_AVX2
+            if (__builtin_cpu_supports("avx2"))
+            {
+                return {"avx2", FillAvx2, FillStreamAvx2, FillPatternAvx2, FillMaskedAvx2,
+                        BlendAvx2, BlendPatternAvx2, BlendMaskedAvx2, CopyKeyedAvx2, BlendPixelsAvx2,
+                        TransformPointsAvx2};
+            }
+#endif
+#if BGI_SPANS_SSE2
+            return {"sse2", FillSse2, FillStreamSse2, FillPatternSse2, FillMaskedSse2,
+                    BlendSse2, BlendPatternSse2, BlendMaskedSse2, CopyKeyedSse2, BlendPixelsSse2,
+                    TransformPointsSse2};
+#else
+            return {"scalar", FillScalar, FillScalar, FillPatternScalar, FillMaskedScalar,
+                    BlendScalar, BlendPatternScalar, BlendMaskedScalar, CopyKeyedScalar, BlendPixelsScalar,
+                    TransformPointsScalar};
+#endif
+        }
+
+        const Kernels &GetKernels()
+        {
+            static const Kernels kernels = SelectKernels();
+            return kernels;
+        }
+    } // namespace
+
+    void Fill(Color *dst, int n, Color c)
+    {
+        GetKernels().fill(dst, n, c);
+    }
+
+    void FillStream(Color *dst, int n, Color c)
+    {
+        GetKernels().fill_stream(dst, n, c);
+    }
+
+    void FillPattern(Color *dst, int n, const Color *row, int phase)
+    {
+        GetKernels().fill_pattern(dst, n, row, phase);
+    }
+
+    void FillMasked(Color *dst, int n, const uint8_t *mask, int bit_offset, Color c)
+    {
+        GetKernels().fill_masked(dst, n, mask, bit_offset, c);
+    }
+
+    void Blend(Color *dst, int n, Color c)
+    {
+        GetKernels().blend(dst, n, c);
+    }
+
+    void BlendPattern(Color *dst, int n, const Color *row, int phase)
+    {
+        GetKernels().blend_pattern(dst, n, row, phase);
+    }
+
+    void BlendMasked(Color *dst, int n, const uint8_t *mask, int bit_offset, Color c)
+    {
+        GetKernels().blend_masked(dst, n, mask, bit_offset, c);
+    }
+
+    void CopyKeyed(Color *dst, const Color *src, int n, Color key)
+    {
+        GetKernels().copy_keyed(dst, src, n, key);
+    }
+
+    void BlendPixels(Color *dst, const Color *src, int n)
+    {
+        GetKernels().blend_pixels(dst, src, n);
+    }
+
+    void TransformPoints(const Point *src, size_t n, const Affine &transform, Point *dst)
+    {
+        GetKernels().transform_points(src, n, transform, dst);
+    }
+
+    const char *KernelName()
+    {
+        return GetKernels().name;
+    }
+} // namespace bgi::spans
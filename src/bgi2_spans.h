@@ -0,0 +1,74 @@
+#pragma once
+
+#include "bgi2.h"
+
+// Kernels for filling and blending horizontal spans of pixels, and for
+// transforming points.
+//
+// These are the innermost loops of all fill operations. They are vectorized
+// with SSE2 or AVX2 where available, selected at runtime based on the CPU.
+namespace bgi::spans
+{
+    // Sets `n` pixels to `c`.
+    void Fill(Color *dst, int n, Color c);
+
+    // Like Fill(), but with non-temporal stores, which bypass the caches. For
+    // fills much larger than the caches, which would only evict everything.
+    void FillStream(Color *dst, int n, Color c);
+
+    // Sets `n` pixels from the repeating 8 pixel long `row`: dst[i] is set to
+    // row[(phase + i) % 8].
+    void FillPattern(Color *dst, int n, const Color *row, int phase);
+
+    // Sets the pixels dst[i] (0 <= i < n) to `c`, where bit (bit_offset + i)
+    // of `mask` is set. The bits of each byte are used from MSB to LSB.
+    void FillMasked(Color *dst, int n, const uint8_t *mask, int bit_offset, Color c);
+
+    // Returns `c` with the color channels multiplied by its alpha.
+    inline Color Premultiply(Color c)
+    {
+        const uint32_t a = c >> 24;
+        uint32_t rb = (c & 0x00ff00ff) * a + 0x00800080;
+        rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+        uint32_t g = (c & 0x0000ff00) * a + 0x00008000;
+        g = ((g + ((g >> 8) & 0x0000ff00)) >> 8) & 0x0000ff00;
+        return (c & 0xff000000) | rb | g;
+    }
+
+    // Returns the premultiplied color `src` drawn over `dst` (source-over):
+    // src + dst * (255 - alpha of src) / 255 in each channel, rounded. The
+    // kernels below round the same way.
+    inline Color BlendPixel(Color dst, Color src)
+    {
+        const uint32_t inv = 255 - (src >> 24);
+        // Two channels at a time, 16 bits apart: red and blue, alpha and
+        // green.
+        uint32_t rb = (dst & 0x00ff00ff) * inv + 0x00800080;
+        rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+        uint32_t ag = ((dst >> 8) & 0x00ff00ff) * inv + 0x00800080;
+        ag = (ag + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+        return src + (rb | ag);
+    }
+
+    // Blends the premultiplied color `c` over `n` pixels.
+    void Blend(Color *dst, int n, Color c);
+
+    // Like FillPattern(), but blends the premultiplied colors of `row`.
+    void BlendPattern(Color *dst, int n, const Color *row, int phase);
+
+    // Like FillMasked(), but blends the premultiplied color `c`.
+    void BlendMasked(Color *dst, int n, const uint8_t *mask, int bit_offset, Color c);
+
+    // Sets dst[i] to src[i] for 0 <= i < n, where src[i] is not `key`.
+    void CopyKeyed(Color *dst, const Color *src, int n, Color key);
+
+    // Blends the premultiplied colors src[i] over dst[i] for 0 <= i < n.
+    void BlendPixels(Color *dst, const Color *src, int n);
+
+    // Sets dst[i] to transform.Apply(src[i]) for 0 <= i < n. `dst` may be
+    // `src`.
+    void TransformPoints(const Point *src, size_t n, const Affine &transform, Point *dst);
+
+    // Returns the name of the selected kernels ("avx2", "sse2" or "scalar").
+    const char *KernelName();
+} // namespace bgi::spans
@@ -2,16 +2,1475 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <future>
+#include <random>
+#include <string>
+#include <thread>
+
 TEST(Bgi2Test, FirstTest)
 {
-    bgi::App app;
-    bgi::Window main_win("FirstTest", 800, 600);
+    bgi::App app(bgi::AppMode::kHeadless);
+    bgi::OffscreenWindow main_win(800, 600);
     bgi::Surface surface(main_win.size());
     bgi::Drawer d(surface);
     d.Clear(bgi::colors::Blue);
     d.SetDrawStyle(bgi::colors::Red);
     d.DrawEllipse(100, 100, 20, 20);
     main_win.Update(surface);
+    ASSERT_EQ(surface.pixels, main_win.frame().pixels);
+}
+
+TEST(Bgi2Test, OffscreenWindowRecordsFrames)
+{
+    bgi::App app(bgi::AppMode::kHeadless);
+    bgi::KeyPress key_press;
+    ASSERT_FALSE(app.PollKeyPress(key_press));
+
+    bgi::OffscreenWindow win(64, 48);
+    bgi::Surface surface(win.size());
+    bgi::Drawer d(surface);
+    d.Clear(bgi::colors::Blue);
+    win.Update(surface);
+    // Only the damaged region is copied.
+    surface.row(0)[0] = bgi::colors::Red;
+    d.SetFillStyle(bgi::colors::Green);
+    d.FillRect(10, 10, 5, 5);
+    win.Update(surface);
+    ASSERT_EQ(bgi::colors::Blue, win.frame().row(0)[0]);
+    ASSERT_EQ(bgi::colors::Green, win.frame().row(12)[12]);
+    // Nothing changed, nothing to present.
+    win.Update(surface);
+
+    bgi::Drawer(win.Lock()).Clear(bgi::colors::Yellow);
+    win.Present();
+    ASSERT_EQ(bgi::colors::Yellow, win.frame().row(0)[0]);
+    ASSERT_EQ(3u, win.frame_times().size());
+}
+
+TEST(Bgi2Test, WindowsUploadWholeSurfacesTheyMissed)
+{
+    bgi::OffscreenWindow win1(64, 48);
+    bgi::OffscreenWindow win2(64, 48);
+    bgi::Surface a(win1.size());
+    bgi::Surface b(win1.size());
+    bgi::Drawer(a).Clear(bgi::colors::Blue);
+    bgi::Drawer(b).Clear(bgi::colors::Red);
+
+    // One surface shown in two windows: the second one gets all of it,
+    // though the first one cleared the damage.
+    win1.Update(a);
+    win2.Update(a);
+    EXPECT_EQ(win2.frame().pixels, win1.frame().pixels);
+    bgi::Drawer d(a);
+    d.SetFillStyle(bgi::colors::Green);
+    d.FillRect(10, 10, 5, 5);
+    win1.Update(a);
+    bgi::Drawer(a).SetPixel(40, 40, bgi::colors::Yellow);
+    win2.Update(a);
+    EXPECT_EQ(win2.frame().row(12)[12], bgi::colors::Green);
+    EXPECT_EQ(win2.frame().row(40)[40], bgi::colors::Yellow);
+
+    // Two surfaces in turn, as a SwapChain shows them.
+    win1.Update(b);
+    EXPECT_EQ(win1.frame().pixels, b.pixels);
+    win1.Update(a);
+    EXPECT_EQ(win1.frame().pixels, a.pixels);
+
+    // Updating from a const surface keeps the damage for the next update.
+    bgi::Drawer(b).SetPixel(1, 1, bgi::colors::White);
+    win1.Update(b);
+    bgi::Drawer(b).SetPixel(2, 2, bgi::colors::White);
+    win2.Update(static_cast<const bgi::Surface &>(b));
+    EXPECT_FALSE(b.damage.empty());
+    EXPECT_EQ(win2.frame().pixels, b.pixels);
+}
+
+namespace
+{
+    // The original polygon filler, which intersects every edge with every row
+    // (but fills spans up to the right edge of the surface).
+    void ReferenceFillPoly(bgi::Surface &surface, const bgi::Polygon &polygon, bgi::Color c)
+    {
+        auto draw_span = [&](int x1, int x2, int y)
+        {
+            if (x2 < x1)
+                std::swap(x1, x2);
+            if (y < 0 || y >= surface.h || x2 < 0 || x1 >= surface.w)
+                return;
+            x1 = std::max(x1, 0);
+            x2 = std::min(x2, surface.w);
+            for (int x = x1; x < x2; x++)
+                surface.row(y)[x] = c;
+        };
+
+        int ymin = polygon.back().y;
+        int ymax = polygon.back().y;
+        for (const bgi::Point &p : polygon)
+        {
+            ymin = std::min(ymin, p.y);
+            ymax = std::max(ymax, p.y);
+        }
+        std::vector<int> nodes;
+        for (int pixel_y = ymin; pixel_y <= ymax; pixel_y++)
+        {
+            nodes.clear();
+            bgi::Point p = polygon.back();
+            for (bgi::Point q : polygon)
+            {
+                float y = pixel_y, x1 = p.x, y1 = p.y, x2 = q.x, y2 = q.y;
+                if ((y1 < y && y2 >= y) || (y2 < y && y1 >= y))
+                {
+                    nodes.push_back(bgi::Int(x1 + (y - y1) / (y2 - y1) * (x2 - x1)));
+                }
+                else if ((y1 == y && y2 > y) || (y2 == y && y1 > y))
+                {
+                    int x = bgi::Int(x1 + (y - y1) / (y2 - y1) * (x2 - x1));
+                    if (x >= 0 && x < surface.w && pixel_y >= 0 && pixel_y < surface.h)
+                        surface.row(pixel_y)[x] = c;
+                }
+                else if (y1 == y && y2 == y)
+                {
+                    draw_span(p.x, q.x, pixel_y);
+                }
+                p = q;
+            }
+            std::sort(nodes.begin(), nodes.end());
+            for (size_t i = 0; i + 1 < nodes.size(); i += 2)
+                draw_span(nodes[i], nodes[i + 1], pixel_y);
+        }
+    }
+
+    // The original line drawer, which steps through the whole line.
+    void ReferenceDrawLine(bgi::Surface &surface, int x1, int y1, int x2, int y2, bgi::Color c)
+    {
+        int dx = std::abs(x2 - x1);
+        int sx = x1 < x2 ? 1 : -1;
+        int dy = std::abs(y2 - y1);
+        int sy = y1 < y2 ? 1 : -1;
+        int err = (dx > dy ? dx : -dy) / 2;
+        for (;;)
+        {
+            if (x1 >= 0 && x1 < surface.w && y1 >= 0 && y1 < surface.h)
+                surface.row(y1)[x1] = c;
+            if (x1 == x2 && y1 == y2)
+                break;
+            int last_err = err;
+            if (last_err > -dx)
+            {
+                err -= dy;
+                x1 += sx;
+            }
+            if (last_err < dy)
+            {
+                err += dx;
+                y1 += sy;
+            }
+        }
+    }
+} // namespace
+
+TEST(Bgi2Test, FillPolyMatchesReference)
+{
+    std::mt19937 rng(42);
+    bgi::Surface expected(200, 150);
+    bgi::Surface actual(200, 150);
+    bgi::Drawer d(actual);
+    d.SetFillStyle(bgi::colors::White);
+    for (int i = 0; i < 2000; i++)
+    {
+        const int range = i % 2 == 0 ? 300 : 3000;
+        bgi::Polygon polygon;
+        for (int j = 0, n = 3 + rng() % 10; j < n; j++)
+        {
+            polygon.emplace_back(bgi::Int(rng() % range) - range / 4, bgi::Int(rng() % range) - range / 4);
+        }
+        bgi::Drawer(expected).Clear(bgi::colors::Black);
+        d.Clear(bgi::colors::Black);
+
+        ReferenceFillPoly(expected, polygon, bgi::colors::White);
+        d.FillPoly(polygon);
+        ASSERT_EQ(expected.pixels, actual.pixels) << "polygon #" << i;
+    }
+}
+
+TEST(Bgi2Test, DrawLineMatchesReference)
+{
+    std::mt19937 rng(42);
+    bgi::Surface expected(120, 90);
+    bgi::Surface actual(120, 90);
+    bgi::Drawer d(actual);
+    d.SetDrawStyle(bgi::colors::White);
+    for (int i = 0; i < 20000; i++)
+    {
+        const int range = i % 3 == 0 ? 200 : i % 3 == 1 ? 2000 : 20000;
+        const int x1 = int(rng() % range) - range / 2 + 60;
+        const int y1 = int(rng() % range) - range / 2 + 45;
+        const int x2 = i % 7 == 0 ? x1 : int(rng() % range) - range / 2 + 60;
+        const int y2 = i % 5 == 0 ? y1 : int(rng() % range) - range / 2 + 45;
+        bgi::Drawer(expected).Clear(bgi::colors::Black);
+        d.Clear(bgi::colors::Black);
+
+        ReferenceDrawLine(expected, x1, y1, x2, y2, bgi::colors::White);
+        d.DrawLine(x1, y1, x2, y2);
+        ASSERT_EQ(expected.pixels, actual.pixels) << "line #" << i << ": " << x1 << "," << y1 << " " << x2 << "," << y2;
+    }
+}
+
+TEST(Bgi2Test, ArcsAndSectorsPartitionTheEllipse)
+{
+    std::mt19937 rng(42);
+    bgi::Surface full(100, 80);
+    bgi::Surface parts(100, 80);
+    for (int i = 0; i < 500; i++)
+    {
+        const int x = int(rng() % 120) - 10;
+        const int y = int(rng() % 100) - 10;
+        const int rx = rng() % 40;
+        const int ry = rng() % 40;
+        const int angle1 = int(rng() % 1000) - 500;
+        const int angle2 = angle1 + 1 + rng() % 358;
+        const bool fill = i % 2 == 0;
+        bgi::Drawer f(full);
+        bgi::Drawer d(parts);
+        f.Clear(bgi::colors::Black);
+        d.Clear(bgi::colors::Black);
+        f.SetFillStyle(bgi::colors::White);
+        d.SetFillStyle(bgi::colors::White);
+        f.SetDrawStyle(bgi::colors::White);
+        d.SetDrawStyle(bgi::colors::White);
+
+        // The two arcs between angle1 and angle2 make up the whole ellipse,
+        // and every pixel of the first one is within (or next to) its angles.
+        if (fill)
+        {
+            f.FillEllipse(x, y, rx, ry);
+            d.FillEllipse(x, y, rx, ry, angle1, angle2);
+        }
+        else
+        {
+            f.DrawEllipse(x, y, rx, ry);
+            d.DrawEllipse(x, y, rx, ry, angle1, angle2);
+        }
+        for (int py = 0; py < parts.h; py++)
+        {
+            for (int px = 0; px < parts.w; px++)
+            {
+                if (parts.row(py)[px] != bgi::colors::White || (px == x && py == y))
+                    continue;
+                const double angle = std::atan2(double(y - py) * std::max(rx, 1), double(px - x) * std::max(ry, 1)) * 180 / 3.14159265358979;
+                const double from_begin = std::fmod(std::fmod(angle - angle1, 360) + 360 + 0.5, 360) - 0.5;
+                ASSERT_LE(from_begin, angle2 - angle1 + 0.5) << "#" << i << " x=" << px << " y=" << py;
+            }
+        }
+        if (fill)
+        {
+            d.FillEllipse(x, y, rx, ry, angle2, angle1 + 360);
+        }
+        else
+        {
+            d.DrawEllipse(x, y, rx, ry, angle2, angle1 + 360);
+        }
+        ASSERT_EQ(full.pixels, parts.pixels) << "#" << i;
+    }
+
+    // A zero sweep draws nothing.
+    bgi::Drawer d(parts);
+    d.Clear(bgi::colors::Black);
+    d.SetFillStyle(bgi::colors::White);
+    d.SetDrawStyle(bgi::colors::White);
+    for (int angle : {0, 45, 90, 180, 270, -30, 720})
+    {
+        d.FillEllipse(50, 40, 8, 8, angle, angle);
+        d.DrawEllipse(50, 40, 8, 8, angle, angle);
+    }
+    EXPECT_EQ(std::count(parts.pixels.begin(), parts.pixels.end(), bgi::colors::White), 0);
+}
+
+TEST(Bgi2Test, FillRoundedRectMatchesCorners)
+{
+    std::mt19937 rng(42);
+    bgi::Surface expected(200, 150);
+    bgi::Surface actual(200, 150);
+    for (int i = 0; i < 2000; i++)
+    {
+        const int x = int(rng() % 60) + 20;
+        const int y = int(rng() % 40) + 20;
+        const int w = rng() % 100;
+        const int h = rng() % 90;
+        int rx = rng() % 60;
+        int ry = rng() % 60;
+        bgi::Drawer e(expected);
+        bgi::Drawer d(actual);
+        e.Clear(bgi::colors::Black);
+        d.Clear(bgi::colors::Black);
+        e.SetFillStyle(bgi::fill_patterns::CrossHatch, bgi::colors::Blue, bgi::colors::Yellow);
+        d.SetFillStyle(bgi::fill_patterns::CrossHatch, bgi::colors::Blue, bgi::colors::Yellow);
+        d.FillRoundedRect(x, y, w, h, rx, ry);
+
+        // The corner ellipses and the rectangles between them, cut to the
+        // rectangle.
+        const int m = std::min(w, h) / 2;
+        rx = std::min(rx, m);
+        ry = std::min(ry, m);
+        const int x2 = x + w - 1;
+        const int y2 = y + h - 1;
+        e.FillEllipse(x + rx, y + ry, rx, ry);
+        e.FillEllipse(x + rx, y2 - ry, rx, ry);
+        e.FillEllipse(x2 - rx, y + ry, rx, ry);
+        e.FillEllipse(x2 - rx, y2 - ry, rx, ry);
+        e.FillRect(x + rx, y, w - 2 * rx, ry);
+        e.FillRect(x, y + ry, w, h - 2 * ry);
+        e.FillRect(x + rx, y2 - ry + 1, w - 2 * rx, ry);
+        for (int py = 0; py < expected.h; py++)
+        {
+            for (int px = 0; px < expected.w; px++)
+            {
+                if (px < x || px > x2 || py < y || py > y2)
+                    expected.row(py)[px] = bgi::colors::Black;
+            }
+        }
+        ASSERT_EQ(expected.pixels, actual.pixels) << "#" << i;
+    }
+}
+
+TEST(Bgi2Test, ViewportClips)
+{
+    std::mt19937 rng(42);
+    auto R = [&](int lo, int hi)
+    { return lo + int(rng() % (hi - lo + 1)); };
+    bgi::Surface expected(160, 120);
+    bgi::Surface actual(160, 120);
+    for (int i = 0; i < 3000; i++)
+    {
+        const bgi::Rect viewport(R(-20, 100), R(-20, 80), R(0, 120), R(0, 100));
+        const int args[] = {R(-60, 160), R(-60, 140), R(-60, 160), R(-60, 140), R(0, 60), R(0, 60), R(0, 360)};
+        auto draw = [&](bgi::Drawer d)
+        {
+            d.SetFillStyle(bgi::fill_patterns::Hatch, bgi::colors::Blue, bgi::colors::Yellow);
+            d.SetDrawStyle(bgi::colors::Red);
+            d.SetWriteStyle(bgi::colors::Green, 1 + i % 2, 1 + i % 3);
+            const auto [x1, y1, x2, y2, rx, ry, angle] = args;
+            switch (i % 9)
+            {
+            case 0: d.FillRect(x1, y1, x2 - x1, y2 - y1); break;
+            case 1: d.DrawLine(x1, y1, x2, y2); break;
+            case 2: d.DrawLine(x1, y1, x2, y1); break;
+            case 3: d.FillEllipse(x1, y1, rx, ry, angle, angle + 100); break;
+            case 4: d.DrawEllipse(x1, y1, rx, ry); break;
+            case 5: d.FillRoundedRect(x1, y1, x2 - x1, y2 - y1, rx, ry); break;
+            case 6: d.FillPoly(x1, y1, x2, y1, x2, y2, x1 + rx, y2 + ry); break;
+            case 7: d.Write(x1, y1, "Clipped text"); break;
+            case 8: d.SetPixel(x1 / 2, y1 / 2, bgi::colors::White); break;
+            }
+        };
+        bgi::Drawer(expected).Clear(bgi::colors::Black);
+        bgi::Drawer(actual).Clear(bgi::colors::Black);
+
+        // Draw without clipping (just moved) and keep the viewport.
+        draw(bgi::Drawer(expected).Viewport(viewport.x, viewport.y, expected.w, expected.h));
+        for (int y = 0; y < expected.h; y++)
+        {
+            for (int x = 0; x < expected.w; x++)
+            {
+                if (x < viewport.x || x >= viewport.x + viewport.w || y < viewport.y || y >= viewport.y + viewport.h)
+                    expected.row(y)[x] = bgi::colors::Black;
+            }
+        }
+        draw(bgi::Drawer(actual).Viewport(viewport.x, viewport.y, viewport.w, viewport.h));
+        ASSERT_EQ(expected.pixels, actual.pixels) << "#" << i;
+    }
+}
+
+TEST(Bgi2Test, DamageListMerges)
+{
+    bgi::DamageList damage;
+    damage.Add(bgi::Rect(10, 10, 20, 20));
+    damage.Add(bgi::Rect(15, 15, 5, 5));
+    ASSERT_EQ(damage.rects().size(), 1u);
+    damage.Add(bgi::Rect(25, 25, 10, 10));
+    ASSERT_EQ(damage.rects().size(), 1u);
+    EXPECT_EQ(damage.rects()[0].x, 10);
+    EXPECT_EQ(damage.rects()[0].w, 25);
+    EXPECT_EQ(damage.rects()[0].h, 25);
+
+    damage.Clear();
+    for (int i = 0; i < 100; i++)
+    {
+        damage.Add(bgi::Rect(i * 10 % 300, i * 37 % 200, 3, 3));
+    }
+    ASSERT_LE(damage.rects().size(), size_t{bgi::DamageList::kMaxRects});
+    for (int i = 0; i < 100; i++)
+    {
+        const int x = i * 10 % 300;
+        const int y = i * 37 % 200;
+        EXPECT_TRUE(std::any_of(damage.rects().begin(), damage.rects().end(), [&](const bgi::Rect &r)
+                                { return r.x <= x && r.y <= y && r.x + r.w >= x + 3 && r.y + r.h >= y + 3; }))
+            << "rect #" << i;
+    }
+}
+
+TEST(Bgi2Test, DamageCoversChanges)
+{
+    std::mt19937 rng(42);
+    auto R = [&](int lo, int hi)
+    { return lo + int(rng() % (hi - lo + 1)); };
+    bgi::Surface surface(160, 120);
+    for (int i = 0; i < 2000; i++)
+    {
+        bgi::Drawer d = bgi::Drawer(surface).Viewport(R(-20, 60), R(-20, 40), R(0, 120), R(0, 100));
+        d.SetFillStyle(bgi::colors::Blue);
+        d.SetDrawStyle(bgi::colors::Red);
+        d.SetWriteStyle(bgi::colors::Green, 1 + i % 2, 1 + i % 3);
+        bgi::Drawer(surface).Clear(bgi::colors::Black);
+        const bgi::Surface::Pixels before = surface.pixels;
+        surface.damage.Clear();
+
+        const int x1 = R(-60, 160), y1 = R(-60, 140), x2 = R(-60, 160), y2 = R(-60, 140), rx = R(0, 60), ry = R(0, 60);
+        switch (i % 8)
+        {
+        case 0: d.FillRect(x1, y1, x2 - x1, y2 - y1); break;
+        case 1: d.DrawLine(x1, y1, x2, y2); break;
+        case 2: d.FillEllipse(x1, y1, rx, ry, x2, x2 + y2 % 360); break;
+        case 3: d.DrawEllipse(x1, y1, rx, ry); break;
+        case 4: d.FillRoundedRect(x1, y1, x2 - x1, y2 - y1, rx, ry); break;
+        case 5: d.FillPoly(x1, y1, x2, y1, x2, y2, x1 + rx, y2 + ry); break;
+        case 6: d.Write(x1, y1, "Damaged"); break;
+        case 7: d.DrawPoly(x1, y1, x2, y1, x2, y2); break;
+        }
+        for (int y = 0; y < surface.h; y++)
+        {
+            for (int x = 0; x < surface.w; x++)
+            {
+                if (surface.row(y)[x] == before[y * surface.stride + x])
+                    continue;
+                ASSERT_TRUE(std::any_of(surface.damage.rects().begin(), surface.damage.rects().end(), [&](const bgi::Rect &r)
+                                        { return x >= r.x && y >= r.y && x < r.x + r.w && y < r.y + r.h; }))
+                    << "#" << i << " x=" << x << " y=" << y;
+            }
+        }
+    }
+}
+
+TEST(Bgi2Test, DrawsIntoStridedView)
+{
+    constexpr int kStride = 173;
+    constexpr bgi::Color kPadding = 0x12345678;
+    bgi::Surface expected(160, 120);
+    std::vector<bgi::Color> memory(kStride * expected.h, kPadding);
+    bgi::SurfaceView view(memory.data(), expected.w, expected.h, kStride);
+    auto draw = [](bgi::Drawer d)
+    {
+        d.Clear(bgi::colors::Black);
+        d.SetFillStyle(bgi::fill_patterns::Hatch, bgi::colors::Blue, bgi::colors::Yellow);
+        d.SetDrawStyle(bgi::colors::Red);
+        d.FillRect(-10, 20, 200, 30);
+        d.FillEllipse(80, 60, 70, 40, 30, 300);
+        d.DrawEllipse(80, 60, 75, 45);
+        d.FillRoundedRect(10, 70, 100, 60, 12, 8);
+        d.FillPoly(0, 0, 159, 10, 40, 119);
+        d.DrawLine(-5, 3, 170, 118);
+        d.DrawLine(0, 100, 159, 100);
+        d.DrawLine(150, 0, 150, 119);
+        d.Write(20, 100, "Strided");
+    };
+    draw(bgi::Drawer(expected));
+    draw(bgi::Drawer(view));
+
+    for (int y = 0; y < expected.h; y++)
+    {
+        for (int x = 0; x < kStride; x++)
+        {
+            const bgi::Color want = x < expected.w ? expected.row(y)[x] : kPadding;
+            ASSERT_EQ(want, memory[y * kStride + x]) << x << "," << y;
+        }
+    }
+}
+
+TEST(Bgi2Test, SubViewMatchesViewport)
+{
+    bgi::Surface expected(100, 70);
+    bgi::Surface actual(100, 70);
+    ASSERT_EQ(112, actual.stride);
+    for (int y = 0; y < actual.h; y++)
+    {
+        ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(actual.row(y)) % bgi::Surface::kRowAlignment);
+    }
+
+    const bgi::Rect rect(13, 7, 60, 50);
+    auto draw = [](bgi::Drawer d)
+    {
+        d.SetFillStyle(bgi::fill_patterns::Slash, bgi::colors::Blue, bgi::colors::Yellow);
+        d.SetDrawStyle(bgi::colors::Red);
+        d.FillEllipse(30, 25, 40, 20);
+        d.DrawLine(-10, -10, 80, 60);
+        d.SetPixel(0, 0, bgi::colors::White);
+    };
+    draw(bgi::Drawer(expected).Viewport(rect.x, rect.y, rect.w, rect.h));
+    draw(bgi::Drawer(bgi::SurfaceView(actual).Sub(rect)));
+    ASSERT_EQ(expected.pixels, actual.pixels);
+
+    // The damage is in the coordinates of the surface.
+    ASSERT_EQ(1u, actual.damage.rects().size());
+    const bgi::Rect damage = actual.damage.rects()[0];
+    ASSERT_EQ(rect.x, damage.x);
+    ASSERT_EQ(rect.y, damage.y);
+    ASSERT_EQ(rect.w, damage.w);
+    ASSERT_EQ(rect.h, damage.h);
+}
+
+TEST(Bgi2Test, TileRendererMatchesImmediateMode)
+{
+    std::mt19937 rng(42);
+    auto R = [&](int lo, int hi)
+    { return lo + int(rng() % (hi - lo + 1)); };
+    bgi::Surface expected(400, 300);
+    bgi::Surface actual(400, 300);
+    bgi::TileRenderer renderer(actual, 4);
+    for (int frame = 0; frame < 10; frame++)
+    {
+        bgi::Drawer immediate(expected);
+        bgi::Drawer deferred(renderer);
+        immediate.Clear(bgi::colors::Black);
+        deferred.Clear(bgi::colors::Black);
+        for (int i = 0; i < 300; i++)
+        {
+            const bgi::Rect viewport(R(-50, 300), R(-50, 200), R(0, 300), R(0, 300));
+            const int args[] = {R(-100, 450), R(-100, 350), R(-100, 450), R(-100, 350), R(0, 150), R(0, 150), R(0, 360)};
+            const bgi::Color color = bgi::colors::AllColors[i % 16];
+            auto draw = [&](bgi::Drawer d)
+            {
+                if (i % 5 == 0)
+                    d = d.Viewport(viewport.x, viewport.y, viewport.w, viewport.h);
+                d.SetFillStyle(bgi::fill_patterns::Interleave, color, bgi::colors::White);
+                d.SetDrawStyle(color);
+                d.SetWriteStyle(color, 1 + i % 3, 1 + i % 2);
+                const auto [x1, y1, x2, y2, rx, ry, angle] = args;
+                switch (i % 10)
+                {
+                case 0: d.FillRect(x1, y1, x2 - x1, y2 - y1); break;
+                case 1: d.DrawLine(x1, y1, x2, y2); break;
+                case 2: d.DrawRect(x1, y1, x2 - x1, y2 - y1); break;
+                case 3: d.FillEllipse(x1, y1, rx, ry, angle, angle + 100); break;
+                case 4: d.DrawEllipse(x1, y1, rx, ry); break;
+                case 5: d.FillRoundedRect(x1, y1, x2 - x1, y2 - y1, rx / 4, ry / 4); break;
+                case 6: d.FillPoly(x1, y1, x2, y1, x2, y2, x1 + rx, y2 + ry); break;
+                case 7: d.Write(x1, y1, "Binned into tiles"); break;
+                case 8: d.WriteEx(x1, y1, "WriteEx", bgi::Padding{2, 2, 1, 1}, bgi::Margin{1, 1, 1, 1}, 3, 3); break;
+                case 9: d.SetPixel(x1, y1, bgi::colors::White); break;
+                }
+            };
+            draw(immediate);
+            draw(deferred);
+        }
+        renderer.Flush();
+        ASSERT_EQ(expected.pixels, actual.pixels) << "frame #" << frame;
+        ASSERT_EQ(expected.damage.rects().size(), actual.damage.rects().size());
+    }
+}
+
+TEST(Bgi2Test, ParallelFillsMatchSingleThreaded)
+{
+    bgi::ThreadPool pool(4);
+    // The larger sizes use non-temporal stores, with and without padding.
+    for (const bgi::Size size : {bgi::Size(1000, 700), bgi::Size(4096, 4096), bgi::Size(4100, 4100)})
+    {
+        bgi::Surface expected(size);
+        bgi::Surface actual(size);
+        bgi::Drawer single(expected);
+        bgi::Drawer parallel(actual);
+        parallel.SetThreadPool(&pool);
+        for (bgi::Drawer &d : {std::ref(single), std::ref(parallel)})
+        {
+            d.Clear(bgi::colors::Blue);
+            d.SetFillStyle(bgi::fill_patterns::Hatch, bgi::colors::Red, bgi::colors::Yellow);
+            d.FillRect(-10, 3, size.w - 5, size.h);
+            d.SetFillStyle(bgi::colors::Green);
+            d.FillRect(7, 5, size.w - 20, size.h - 9);
+            d.Viewport(1, 0, size.w / 3, size.h / 2).Clear(bgi::colors::Cyan);
+        }
+        ASSERT_EQ(expected.pixels, actual.pixels) << size.w << "x" << size.h;
+    }
+}
+
+TEST(Bgi2Test, FillRectWithPattern)
+{
+    std::mt19937 rng(42);
+    bgi::Surface surface(100, 40);
+    for (int i = 0; i < 200; i++)
+    {
+        const int vx = rng() % 20;
+        const int vy = rng() % 20;
+        bgi::Drawer d = bgi::Drawer(surface).Viewport(vx, vy, 80, 20);
+        d.Clear(bgi::colors::Black);
+        d.SetFillStyle(bgi::fill_patterns::CrossHatch, bgi::colors::Blue, bgi::colors::Yellow);
+        const bgi::Rect r(rng() % 20, rng() % 10, rng() % 70, rng() % 10);
+        d.FillRect(r);
+        for (int y = 0; y < d.height(); y++)
+        {
+            for (int x = 0; x < d.width(); x++)
+            {
+                bgi::Color expected = bgi::colors::Black;
+                if (x >= r.x && x < r.x + r.w && y >= r.y && y < r.y + r.h)
+                {
+                    expected = bgi::IsFg(bgi::fill_patterns::CrossHatch, x, y) ? bgi::colors::Yellow : bgi::colors::Blue;
+                }
+                ASSERT_EQ(d.GetPixel(x, y), expected) << "x=" << x << " y=" << y;
+            }
+        }
+    }
+}
+
+TEST(Bgi2Test, WriteScaledAndClipped)
+{
+    const std::string text = "Hello, World! x=123 y=-45 @#~";
+    bgi::Surface reference(8 * int(text.size()), 8);
+    bgi::Drawer reference_drawer(reference);
+    reference_drawer.Clear(bgi::colors::Black);
+    reference_drawer.SetWriteStyle(bgi::colors::White);
+    reference_drawer.Write(0, 0, text);
+
+    std::mt19937 rng(42);
+    bgi::Surface surface(120, 50);
+    for (int i = 0; i < 500; i++)
+    {
+        const int scale_x = 1 + rng() % 4;
+        const int scale_y = 1 + rng() % 4;
+        const int x0 = int(rng() % 200) - 150;
+        const int y0 = int(rng() % 80) - 30;
+        bgi::Drawer d(surface);
+        d.Clear(bgi::colors::Black);
+        d.SetWriteStyle(bgi::colors::White, scale_x, scale_y);
+        d.Write(x0, y0, text);
+        for (int y = 0; y < surface.h; y++)
+        {
+            for (int x = 0; x < surface.w; x++)
+            {
+                const int rx = x - x0;
+                const int ry = y - y0;
+                bgi::Color expected = bgi::colors::Black;
+                if (rx >= 0 && ry >= 0 && rx / scale_x < reference.w && ry / scale_y < reference.h)
+                {
+                    expected = reference.row(ry / scale_y)[rx / scale_x];
+                }
+                ASSERT_EQ(surface.row(y)[x], expected) << "x=" << x << " y=" << y << " #" << i;
+            }
+        }
+    }
+}
+
+TEST(Bgi2Test, StatsCountPrimitives)
+{
+    bgi::Surface surface(100, 100);
+    bgi::Drawer d(surface);
+    bgi::ResetStats();
+    d.FillRect(-10, 0, 20, 10);
+    d.FillRect(20, 20, 10, 10);
+    d.SetPixel(5, 5, bgi::colors::White);
+    d.SetPixel(500, 5, bgi::colors::White);
+    d.DrawLine(0, 50, 99, 50);
+    const bgi::Stats stats = bgi::GetStats();
+    if (!bgi::IsInstrumented())
+    {
+        EXPECT_EQ(stats[bgi::Primitive::kFillRect].calls, 0);
+        EXPECT_EQ(stats[bgi::Primitive::kSetPixel].calls, 0);
+        return;
+    }
+    EXPECT_EQ(stats[bgi::Primitive::kFillRect].calls, 2);
+    EXPECT_EQ(stats[bgi::Primitive::kFillRect].pixels_written, 200);
+    EXPECT_EQ(stats[bgi::Primitive::kFillRect].pixels_clipped, 100);
+    EXPECT_EQ(stats[bgi::Primitive::kSetPixel].calls, 2);
+    EXPECT_EQ(stats[bgi::Primitive::kSetPixel].pixels_written, 1);
+    EXPECT_EQ(stats[bgi::Primitive::kSetPixel].pixels_clipped, 1);
+    EXPECT_EQ(stats[bgi::Primitive::kDrawLine].calls, 1);
+    EXPECT_EQ(stats[bgi::Primitive::kDrawLine].pixels_written, 100);
+    EXPECT_EQ(stats[bgi::Primitive::kFillEllipse].calls, 0);
+
+    // Tiles drawn by a TileRenderer do not count as calls again.
+    bgi::TileRenderer renderer(surface, 2);
+    bgi::ResetStats();
+    bgi::Drawer deferred(renderer);
+    deferred.FillRect(0, 0, 200, 200);
+    renderer.Flush();
+    EXPECT_EQ(bgi::GetStats()[bgi::Primitive::kFillRect].calls, 1);
+    EXPECT_EQ(bgi::GetStats()[bgi::Primitive::kFillRect].pixels_written, 100 * 100);
+    EXPECT_EQ(bgi::GetStats()[bgi::Primitive::kFillRect].pixels_clipped, 200 * 200 - 100 * 100);
+
+    bgi::OffscreenWindow window(100, 100);
+    bgi::ResetStats();
+    window.Update(surface);
+    EXPECT_EQ(bgi::GetStats().frames, 1);
+}
+
+TEST(Bgi2Test, FrameLoopPacesFramesAndSteps)
+{
+    const auto step = std::chrono::milliseconds(1);
+    const auto start = bgi::FrameLoop::Clock::now();
+    bgi::FrameLoop loop(step, 250);
+    int steps = 0;
+    for (int i = 0; i < 20; i++)
+    {
+        steps += loop.BeginFrame();
+        loop.EndFrame();
+    }
+    const auto elapsed = bgi::FrameLoop::Clock::now() - start;
+    // The first frame is not waited for, the others are 4 ms apart.
+    EXPECT_GE(elapsed, 19 * std::chrono::milliseconds(4));
+    EXPECT_EQ(loop.frames(), 20);
+    EXPECT_EQ(loop.simulated_time(), steps * step);
+    EXPECT_LE(loop.simulated_time(), elapsed);
+    EXPECT_GT(steps, 0);
+    EXPECT_GE(loop.alpha(), 0);
+    EXPECT_LT(loop.alpha(), 1);
+    EXPECT_LE(loop.FrameTimePercentile(0), loop.FrameTimePercentile(50));
+    EXPECT_LE(loop.FrameTimePercentile(50), loop.FrameTimePercentile(99));
+    EXPECT_GE(loop.FrameTimePercentile(50), std::chrono::milliseconds(3));
+}
+
+TEST(Bgi2Test, SwapChainPresentsEveryFrame)
+{
+    bgi::OffscreenWindow window(64, 48);
+    bgi::Surface expected(64, 48);
+    {
+        bgi::SwapChain chain(window, 3);
+        EXPECT_EQ(chain.max_latency(), 2);
+        for (int frame = 0; frame < 20; frame++)
+        {
+            for (bgi::Surface *surface : {&chain.Acquire(), &expected})
+            {
+                bgi::Drawer d(*surface);
+                d.Clear(bgi::colors::Black);
+                d.SetFillStyle(bgi::colors::AllColors[frame % 16]);
+                d.FillRect(frame * 3, frame * 2, 10, 8);
+            }
+            chain.Submit();
+        }
+        chain.Wait();
+        EXPECT_EQ(chain.frames_presented(), 20);
+    }
+    EXPECT_EQ(window.frame_times().size(), 20u);
+    EXPECT_EQ(expected.pixels, window.frame().pixels);
+
+    // With 2 buffers, the next frame is drawn while the previous one is
+    // presented.
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    bgi::SwapChain chain(bgi::Size{8, 8}, [released](bgi::Surface &)
+                         { released.wait(); });
+    chain.Acquire();
+    chain.Submit();
+    chain.Acquire();
+    release.set_value();
+    chain.Submit();
+    chain.Wait();
+    EXPECT_EQ(chain.frames_presented(), 2);
+
+    // With a draw function, the frames are drawn on the chain's thread and
+    // presented on this one, also overlapping.
+    bgi::OffscreenWindow drawn_to(64, 48);
+    std::atomic<int> frames_drawn{0};
+    bool overlapped = false;
+    {
+        bgi::SwapChain drawing(
+            drawn_to.size(), [&](bgi::Surface &surface)
+            {
+                if (drawn_to.frame_times().empty())
+                {
+                    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+                    while (frames_drawn < 2 && std::chrono::steady_clock::now() < deadline)
+                    {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    }
+                    overlapped = frames_drawn >= 2;
+                }
+                drawn_to.Update(surface);
+            },
+            [&](bgi::Surface &surface)
+            {
+                const int frame = frames_drawn;
+                bgi::Drawer d(surface);
+                d.Clear(bgi::colors::Black);
+                d.SetFillStyle(bgi::colors::AllColors[frame % 16]);
+                d.FillRect(frame * 3, frame * 2, 10, 8);
+                frames_drawn++;
+            });
+        for (int frame = 0; frame < 20; frame++)
+        {
+            drawing.Present();
+        }
+        EXPECT_EQ(drawing.frames_presented(), 20);
+    }
+    EXPECT_TRUE(overlapped);
+    EXPECT_EQ(expected.pixels, drawn_to.frame().pixels);
+}
+
+TEST(Bgi2Test, PolygonBehavesLikeVector)
+{
+    std::vector<bgi::Point> reference;
+    bgi::Polygon polygon;
+    std::mt19937 rng(42);
+    for (int i = 0; i < 2000; i++)
+    {
+        const bgi::Point p(int(rng() % 100), int(rng() % 100));
+        switch (rng() % 6)
+        {
+        case 0:
+        case 1:
+        case 2:
+            reference.push_back(p);
+            polygon.push_back(p);
+            break;
+        case 3:
+        {
+            const size_t pos = reference.empty() ? 0 : rng() % reference.size();
+            reference.insert(reference.begin() + pos, p);
+            polygon.insert(polygon.begin() + pos, p);
+            break;
+        }
+        case 4:
+            if (!reference.empty())
+            {
+                const size_t pos = rng() % reference.size();
+                reference.erase(reference.begin() + pos);
+                polygon.erase(polygon.begin() + pos);
+            }
+            break;
+        case 5:
+        {
+            const bgi::Polygon copy = polygon;
+            bgi::Polygon moved = std::move(polygon);
+            polygon = moved;
+            ASSERT_TRUE(copy == polygon);
+            break;
+        }
+        }
+        ASSERT_EQ(polygon.size(), reference.size());
+        for (size_t j = 0; j < reference.size(); j++)
+        {
+            ASSERT_EQ(polygon[j].x, reference[j].x);
+            ASSERT_EQ(polygon[j].y, reference[j].y);
+        }
+    }
+
+    // Points of the polygon itself can be appended, also when it grows.
+    bgi::Polygon grown;
+    while (grown.size() < 2 * bgi::Polygon::kInlineSize)
+    {
+        grown.emplace_back(int(grown.size()), -int(grown.size()));
+    }
+    ASSERT_EQ(grown.size(), grown.capacity());
+    grown.push_back(grown[0]);
+    while (grown.size() < grown.capacity())
+    {
+        grown.emplace_back(0, 0);
+    }
+    grown.emplace_back(grown[1]);
+    EXPECT_EQ(grown[2 * bgi::Polygon::kInlineSize].x, 0);
+    EXPECT_EQ(grown.back().x, 1);
+    EXPECT_EQ(grown.back().y, -1);
+
+    // Code written for vectors keeps working.
+    const bgi::Polygon from_vector = reference;
+    EXPECT_TRUE(from_vector == polygon);
+    const std::vector<bgi::Point> to_vector = polygon;
+    EXPECT_EQ(to_vector.size(), reference.size());
+    const auto size_of = [](const std::vector<bgi::Point> &points)
+    { return points.size(); };
+    EXPECT_EQ(size_of(polygon), polygon.size());
+    EXPECT_TRUE(bgi::Transform(reference, 0, 1, 1, 2, 3) == bgi::Transform(polygon, 0, 1, 1, 2, 3));
+}
+
+TEST(Bgi2Test, PolygonArenaHoldsLargePolygons)
+{
+    bgi::PolygonArena arena;
+    const bgi::Polygon outside = bgi::MakeEllipticalArc(50, 50, 40, 30);
+    {
+        bgi::PolygonArena::Scope scope(arena);
+        EXPECT_EQ(bgi::PolygonArena::active(), &arena);
+        const bgi::Polygon small = bgi::MakePolygon(0, 0, 10, 0, 10, 10);
+        EXPECT_EQ(arena.bytes_allocated(), 0u);
+        const bgi::Polygon arc = bgi::MakeEllipticalArc(50, 50, 40, 30);
+        EXPECT_GT(arena.bytes_allocated(), 0u);
+        EXPECT_TRUE(arc == outside);
+    }
+    EXPECT_EQ(bgi::PolygonArena::active(), nullptr);
+    EXPECT_EQ(arena.bytes_allocated(), 0u);
+
+    // So are copies made in the scope, even of polygons from outside.
+    {
+        bgi::PolygonArena::Scope scope(arena);
+        const bgi::Polygon copy = outside;
+        EXPECT_GT(arena.bytes_allocated(), 0u);
+    }
+
+    // Assigning to a polygon from outside of the scope copies the points to
+    // its own storage.
+    bgi::Polygon kept;
+    {
+        bgi::PolygonArena::Scope scope(arena);
+        kept = bgi::Transform(outside, 0, 1, 1, 5, 5);
+    }
+    EXPECT_TRUE(kept == bgi::Transform(outside, 0, 1, 1, 5, 5));
+
+    // Deferred calls keep their polygons out of the arena, which may be
+    // reused before the flush.
+    bgi::Surface expected(100, 100);
+    bgi::Drawer(expected).FillPoly(outside);
+    bgi::Surface actual(100, 100);
+    bgi::TileRenderer renderer(actual, 2);
+    {
+        bgi::PolygonArena::Scope scope(arena);
+        bgi::Drawer(renderer).FillPoly(bgi::Transform(outside, 0, 1, 1, 0, 0));
+    }
+    {
+        bgi::PolygonArena::Scope scope(arena);
+        const bgi::Polygon reused(4000, bgi::Point(50, 50));
+        renderer.Flush();
+    }
+    EXPECT_EQ(expected.pixels, actual.pixels);
+}
+
+TEST(Bgi2Test, AffineComposesInvertsAndApplies)
+{
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> coefficient(-3, 3);
+    for (int i = 0; i < 200; i++)
+    {
+        const bgi::Affine m{coefficient(rng), coefficient(rng), coefficient(rng), coefficient(rng), 100 * coefficient(rng), 100 * coefficient(rng)};
+        bgi::Polygon points;
+        for (int j = 0; j < i % 13; j++)
+        {
+            points.emplace_back(int(rng() % 2001) - 1000, int(rng() % 2001) - 1000);
+        }
+        // The batch matches the formula, point by point.
+        bgi::Polygon transformed = points;
+        m.Apply(transformed);
+        for (size_t j = 0; j < points.size(); j++)
+        {
+            const float x = float(points[j].x);
+            const float y = float(points[j].y);
+            ASSERT_EQ(transformed[j].x, bgi::Round(m.a * x + m.b * y + m.tx)) << i;
+            ASSERT_EQ(transformed[j].y, bgi::Round(m.c * x + m.d * y + m.ty)) << i;
+        }
+
+        // Composing is applying one after the other, and the inverse undoes.
+        const bgi::Affine shift = bgi::Affine::Translate(3, -7) * bgi::Affine::MirrorHoriz(10);
+        const bgi::Affine composed = shift * m;
+        const bgi::Affine identity = m.Inverse() * m;
+        for (const bgi::Point &p : points)
+        {
+            const bgi::Point q = composed.Apply(p);
+            const bgi::Point r = m.Apply(p);
+            EXPECT_EQ(q.x, 20 - r.x + 3);
+            EXPECT_EQ(q.y, r.y - 7);
+            const bgi::Point back = identity.Apply(p);
+            EXPECT_NEAR(back.x, p.x, 1);
+            EXPECT_NEAR(back.y, p.y, 1);
+        }
+    }
+}
+
+TEST(Bgi2Test, TransformedPolyMatchesTransformedCopy)
+{
+    const bgi::Polygon star = bgi::MakePolygon(0, -40, 10, -10, 40, 0, 10, 10, 0, 40, -10, 10, -40, 0, -10, -10);
+    bgi::Surface expected(200, 150);
+    bgi::Surface actual(200, 150);
+    for (int turns = 0; turns < 4; turns++)
+    {
+        for (int scale = 1; scale <= 2; scale++)
+        {
+            const bgi::Affine m = bgi::Affine::Translate(100, 75) * bgi::Affine::Scale(float(scale), 1) * bgi::Affine::Rotate(90.0f * turns);
+            // The same transformation by hand: quarter turns clockwise, the
+            // scale, and then the move.
+            bgi::Polygon points;
+            for (bgi::Point p : star)
+            {
+                for (int i = 0; i < turns; i++)
+                {
+                    p = bgi::Point(-p.y, p.x);
+                }
+                points.emplace_back(100 + scale * p.x, 75 + p.y);
+            }
+            bgi::Drawer e = bgi::Drawer(expected).Viewport(5, 5, 180, 130);
+            bgi::Drawer a = bgi::Drawer(actual).Viewport(5, 5, 180, 130);
+            e.Clear(bgi::colors::Black);
+            a.Clear(bgi::colors::Black);
+            e.SetFillStyle(bgi::colors::Yellow);
+            a.SetFillStyle(bgi::colors::Yellow);
+            e.SetDrawStyle(bgi::colors::Red);
+            a.SetDrawStyle(bgi::colors::Red);
+            e.FillPoly(points);
+            a.FillPoly(star, m);
+            e.DrawPoly(points);
+            a.DrawPoly(star, m);
+            ASSERT_EQ(expected.pixels, actual.pixels) << "turns=" << turns << " scale=" << scale;
+        }
+    }
+}
+
+TEST(Bgi2Test, StaticPolygonsMatchPolygons)
+{
+    static constexpr bgi::TransformType transform = {0, 0.85f, 0.85f, 400, 200};
+    static constexpr auto shape = bgi::MakeStaticPolygon(-101, 33, -233, 33, -233, 10, -223, 2);
+    static constexpr auto transformed = bgi::Transform(shape, transform);
+    static constexpr auto mirrored = bgi::MirrorHoriz(transformed, 400);
+    static constexpr auto concat = bgi::MirrorHorizConcat(shape, 10);
+    static_assert(concat.size() == 8);
+    static_assert(concat[7].x == 20 + 101 && concat[7].y == 33);
+    static_assert(bgi::Round(2.5f) == 3 && bgi::Round(-2.5f) == -3 && bgi::Round(0.49999997f) == 0);
+
+    const bgi::Polygon polygon = bgi::MakePolygon(-101, 33, -233, 33, -233, 10, -223, 2);
+    EXPECT_TRUE(bgi::Polygon(transformed.begin(), transformed.end()) == bgi::Transform(polygon, transform));
+    EXPECT_TRUE(bgi::Polygon(mirrored.begin(), mirrored.end()) == bgi::MirrorHoriz(bgi::Transform(polygon, transform), 400));
+    EXPECT_TRUE(bgi::Polygon(concat.begin(), concat.end()) == bgi::MirrorHorizConcat(polygon, 10));
+
+    bgi::Surface expected(300, 100);
+    bgi::Surface actual(300, 100);
+    bgi::Drawer e = bgi::Drawer(expected).Viewport(-150, 0, 300, 100);
+    bgi::Drawer a = bgi::Drawer(actual).Viewport(-150, 0, 300, 100);
+    e.Clear(bgi::colors::Black);
+    a.Clear(bgi::colors::Black);
+    e.FillPoly(bgi::MirrorHorizConcat(polygon, 10));
+    a.FillPoly(concat);
+    e.DrawPoly(bgi::MakePolygon(-200, 10, -20, 90, 100, 20));
+    a.DrawPoly({{-200, 10}, {-20, 90}, {100, 20}});
+    e.DrawOpenPoly(polygon);
+    a.DrawOpenPoly(shape);
+    EXPECT_EQ(expected.pixels, actual.pixels);
+}
+
+TEST(Bgi2Test, FilledShapesMatchPrimitives)
+{
+    const bgi::Polygon star = bgi::MakePolygon(0, -40, 10, -10, 40, 0, 10, 10, 0, 40, -10, 10, -40, 0, -10, -10);
+    bgi::ShapeCache cache;
+    bgi::Surface expected(200, 150);
+    bgi::Surface actual(200, 150);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int angle = 0; angle < 360; angle += 30)
+        {
+            const bgi::Affine m = bgi::Affine::Translate(90, 60) * bgi::Affine::Rotate(float(angle));
+            // The viewport moves, and clips the shapes.
+            bgi::Drawer e = bgi::Drawer(expected).Viewport(angle / 10, 5, 120, 100);
+            bgi::Drawer a = bgi::Drawer(actual).Viewport(angle / 10, 5, 120, 100);
+            e.Clear(bgi::colors::Black);
+            a.Clear(bgi::colors::Black);
+            e.SetFillStyle(bgi::colors::Yellow);
+            a.SetFillStyle(bgi::colors::Yellow);
+            e.FillPoly(star, m);
+            a.FillShape(cache.GetPolygon(star, m));
+            e.SetFillStyle(bgi::fill_patterns::Line, bgi::colors::Black, bgi::colors::Green);
+            a.SetFillStyle(bgi::fill_patterns::Line, bgi::colors::Black, bgi::colors::Green);
+            e.FillEllipse(20, 80, 30, 20, angle, angle + 200);
+            a.FillShape(cache.GetEllipse(20, 80, 30, 20, angle, angle + 200));
+            e.FillRoundedRect(-10, -10, 60, 40, angle / 10, 30);
+            a.FillShape(cache.GetRoundedRect(-10, -10, 60, 40, angle / 10, 30));
+            ASSERT_EQ(expected.pixels, actual.pixels) << "angle=" << angle;
+        }
+    }
+    EXPECT_EQ(cache.misses(), 36);
+    EXPECT_EQ(cache.hits(), 36);
+    // -0 is the same transformation as 0.
+    cache.GetPolygon(star, bgi::Affine{1, 0, 0, 1, 0, 0});
+    cache.GetPolygon(star, bgi::Affine{1, -0.0f, -0.0f, 1, -0.0f, 0});
+    EXPECT_EQ(cache.misses(), 37);
+    EXPECT_EQ(cache.hits(), 37);
+    EXPECT_TRUE(bgi::RasterizedShape::FromPolygon(bgi::MakePolygon(0, 0, 1, 1)).empty());
+    EXPECT_TRUE(bgi::RasterizedShape::FromRoundedRect(5, 5, 0, 10, 2, 2).empty());
+}
+
+TEST(Bgi2Test, DisplayListReplaysLikeDrawer)
+{
+    std::mt19937 rng(7);
+    auto R = [&](int lo, int hi)
+    { return lo + int(rng() % (hi - lo + 1)); };
+    const bgi::Polygon star = bgi::MakePolygon(0, -40, 10, -10, 40, 0, 10, 10, 0, 40, -10, 10, -40, 0, -10, -10);
+    const bgi::RasterizedShape shape = bgi::RasterizedShape::FromEllipse(50, 50, 30, 20, 45, 300);
+    std::vector<std::function<void(bgi::Drawer)>> calls;
+    calls.push_back([](bgi::Drawer d)
+                    { d.Clear(bgi::colors::Blue); });
+    for (int i = 0; i < 200; i++)
+    {
+        const bgi::Rect viewport(R(-50, 250), R(-50, 150), R(0, 250), R(0, 250));
+        const int args[] = {R(-50, 350), R(-50, 250), R(-50, 350), R(-50, 250), R(0, 100), R(0, 100), R(0, 360)};
+        const bgi::Color color = bgi::colors::AllColors[i % 16];
+        calls.push_back([=](bgi::Drawer d)
+                        {
+            if (i % 7 == 0)
+                d = d.Viewport(viewport.x, viewport.y, viewport.w, viewport.h);
+            if (i % 3 == 0)
+                d.SetFillStyle(color);
+            else
+                d.SetFillStyle(bgi::fill_patterns::Interleave, color, bgi::colors::White);
+            d.SetDrawStyle(color);
+            d.SetWriteStyle(color, 1 + i % 3, 1 + i % 2);
+            const auto [x1, y1, x2, y2, rx, ry, angle] = args;
+            switch (i % 14)
+            {
+            case 0: d.FillRect(x1, y1, x2 - x1, y2 - y1); break;
+            case 1: d.DrawLine(x1, y1, x2, y2); break;
+            case 2: d.DrawRect(x1, y1, x2 - x1, y2 - y1); break;
+            case 3: d.FillEllipse(x1, y1, rx, ry, angle, angle + 100); break;
+            case 4: d.DrawEllipse(x1, y1, rx, ry); break;
+            case 5: d.FillRoundedRect(x1, y1, x2 - x1, y2 - y1, rx / 4, ry / 4); break;
+            case 6: d.FillPoly(x1, y1, x2, y1, x2, y2, x1 + rx, y2 + ry); break;
+            case 7: d.Write(x1, y1, "Recorded"); break;
+            case 8: d.WriteEx(x1, y1, "WriteEx", bgi::Padding{2, 2, 1, 1}, bgi::Margin{1, 1, 1, 1}, 3, 3); break;
+            case 9: d.SetPixel(x1, y1, bgi::colors::White); break;
+            case 10: d.FillPoly(star, bgi::Affine::Translate(float(x1), float(y1)) * bgi::Affine::Rotate(float(angle))); break;
+            case 11: d.DrawPoly(star, bgi::Affine::Translate(float(x1), float(y1))); break;
+            case 12: d.FillShape(shape); break;
+            case 13:
+                // Rows of rects that merge into one.
+                for (int k = 0; k < 4; k++)
+                    d.FillRect(x1 + k * rx, y1, rx, ry);
+                break;
+            } });
+    }
+
+    bgi::DisplayList list(300, 200);
+    bgi::Drawer recorder(list);
+    for (const auto &call : calls)
+    {
+        call(recorder);
+    }
+    EXPECT_EQ(recorder.GetPixel(10, 10), bgi::colors::Black);
+    const size_t recorded_calls = list.size();
+    const size_t recorded_bytes = list.bytes();
+
+    bgi::Surface expected(400, 300);
+    bgi::Surface actual(400, 300);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int dx : {0, 60})
+        {
+            const bgi::Rect clip(R(0, 100), R(0, 100), R(100, 300), R(100, 200));
+            bgi::Drawer e(expected);
+            bgi::Drawer a(actual);
+            e.Clear(bgi::colors::Black);
+            a.Clear(bgi::colors::Black);
+            const bgi::Drawer viewport = e.Viewport(clip.x, clip.y, clip.w, clip.h).Viewport(dx - clip.x, 40 - clip.y, 300, 200);
+            for (const auto &call : calls)
+            {
+                call(viewport);
+            }
+            list.Replay(a, dx, 40, clip);
+            ASSERT_EQ(expected.pixels, actual.pixels) << "pass " << pass << " dx=" << dx;
+        }
+        list.Optimize();
+    }
+    EXPECT_LT(list.size(), recorded_calls);
+    EXPECT_LT(list.bytes(), recorded_bytes);
+
+    list.Clear();
+    EXPECT_TRUE(list.empty());
+    recorder.SetFillStyle(bgi::colors::Green);
+    for (int x = 0; x < 100; x += 10)
+    {
+        recorder.FillRect(x, 20, 10, 30);
+    }
+    list.Optimize();
+    EXPECT_EQ(list.size(), 1u);
+    // Everything is covered by the last call.
+    recorder.DrawRect(10, 10, 50, 50);
+    recorder.FillEllipse(50, 50, 20, 10);
+    recorder.Write(10, 10, "Covered");
+    recorder.Clear(bgi::colors::Red);
+    list.Optimize();
+    EXPECT_EQ(list.size(), 1u);
+}
+
+namespace
+{
+    // Draws the straight color `src` over the premultiplied `dst`.
+    bgi::Color SourceOver(bgi::Color dst, bgi::Color src)
+    {
+        const unsigned a = src >> 24;
+        bgi::Color result = 0;
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            const unsigned s = shift == 24 ? a : (((src >> shift) & 0xff) * a + 127) / 255;
+            const unsigned d = (dst >> shift) & 0xff;
+            result |= (s + (d * (255 - a) + 127) / 255) << shift;
+        }
+        return result;
+    }
+
+    // Draws the premultiplied color `src` over the premultiplied `dst`.
+    bgi::Color BlendPremultiplied(bgi::Color dst, bgi::Color src)
+    {
+        const unsigned a = src >> 24;
+        bgi::Color result = 0;
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            const unsigned d = (dst >> shift) & 0xff;
+            result |= (((src >> shift) & 0xff) + (d * (255 - a) + 127) / 255) << shift;
+        }
+        return result;
+    }
+} // namespace
+
+TEST(Bgi2Test, SourceOverBlendsTranslucentColors)
+{
+    std::mt19937 rng(3);
+    const bgi::Color kUntouched = 0x00123456;
+    bgi::Surface background(120, 90);
+    for (bgi::Color &pixel : background.pixels)
+    {
+        pixel = rng() | 0xff000000;
+    }
+    const std::vector<std::function<void(bgi::Drawer &)>> draws = {
+        [](bgi::Drawer &d)
+        {
+            d.SetFillStyle(bgi::Argb(0x80, 0xff, 0x20, 0x00));
+            for (int i = 0; i < 40; i++)
+                d.FillRect(i % 7, i * 2, i + 1, 2);
+        },
+        [](bgi::Drawer &d)
+        {
+            d.SetFillStyle(bgi::fill_patterns::Interleave, bgi::Argb(0x40, 0, 0, 0xff), bgi::colors::Yellow);
+            d.FillEllipse(60, 45, 50, 30);
+        },
+        [](bgi::Drawer &d)
+        {
+            d.SetDrawStyle(bgi::Argb(0xc0, 0x10, 0xff, 0x10));
+            d.DrawLine(3, 80, 110, 80);
+            d.DrawLine(100, 5, 100, 75);
+            d.DrawLine(0, 0, 90, 60);
+            d.SetPixel(5, 50, bgi::Argb(0x20, 0xff, 0xff, 0xff));
+        },
+        [](bgi::Drawer &d)
+        {
+            d.SetDrawStyle(bgi::Argb(0x70, 0x10, 0xff, 0x10));
+            d.DrawEllipse(30, 30, 20, 10);
+            d.DrawEllipse(80, 50, 30, 30, 45, 270);
+        },
+        [](bgi::Drawer &d)
+        {
+            d.SetFillStyle(bgi::Argb(0x70, 0xff, 0x10, 0x10));
+            d.FillPoly(bgi::MakePolygon(0, 0, 100, 10, 20, 80, 110, 85, 60, 5));
+        },
+        [](bgi::Drawer &d)
+        {
+            d.SetFillStyle(bgi::Argb(0x70, 0xff, 0x10, 0x10));
+            d.FillEllipse(30, 30, 20, 10, 90, 350);
+        },
+        [](bgi::Drawer &d)
+        {
+            d.SetWriteStyle(bgi::Argb(0x99, 0xff, 0xff, 0xff), 2, 1);
+            d.Write(3, 40, "Blended text");
+        },
+        // The lines of outlines meet, but blend each pixel once.
+        [](bgi::Drawer &d)
+        {
+            d.SetDrawStyle(bgi::Argb(0x60, 0x10, 0x10, 0xff));
+            d.DrawRect(5, 5, 60, 40);
+        },
+        [](bgi::Drawer &d)
+        {
+            d.SetDrawStyle(bgi::Argb(0x60, 0x10, 0x10, 0xff));
+            d.DrawRoundedRect(10, 20, 90, 60, 15, 10);
+        },
+        [](bgi::Drawer &d)
+        {
+            d.SetDrawStyle(bgi::Argb(0x60, 0x10, 0x10, 0xff));
+            d = d.Viewport(20, 10, 80, 70);
+            d.DrawPoly(bgi::MakePolygon(-10, 0, 60, 10, 20, 80, 90, 65, 40, 5, 40, 5));
+        },
+        [](bgi::Drawer &d)
+        {
+            d.SetDrawStyle(bgi::Argb(0x60, 0x10, 0x10, 0xff));
+            d.DrawPoly(bgi::MakePolygon(0, 0, 10, 0, 10, 10), bgi::Affine::Translate(20, 30) * bgi::Affine::Scale(2, 3));
+            d.DrawOpenPoly(bgi::MakePolygon(50, 60, 75, 30, 100, 60, 75, 30));
+            d.DrawOpenPoly(bgi::MakePolygon(70, 5));
+        },
+    };
+    for (size_t i = 0; i < draws.size(); i++)
+    {
+        // The pixels and colors that the call draws.
+        bgi::Surface coverage(background.w, background.h);
+        std::fill(coverage.pixels.begin(), coverage.pixels.end(), kUntouched);
+        bgi::Drawer copy(coverage);
+        draws[i](copy);
+
+        bgi::Surface actual = background;
+        bgi::Drawer d(actual);
+        d.SetBlendMode(bgi::BlendMode::kSourceOver);
+        draws[i](d);
+        bgi::Surface expected = background;
+        for (size_t j = 0; j < expected.pixels.size(); j++)
+        {
+            if (coverage.pixels[j] != kUntouched)
+            {
+                expected.pixels[j] = SourceOver(background.pixels[j], coverage.pixels[j]);
+            }
+        }
+        ASSERT_EQ(expected.pixels, actual.pixels) << "draw #" << i;
+    }
+
+    // Opaque colors are stored, and transparent ones draw nothing.
+    bgi::Surface copied = background;
+    bgi::Surface blended = background;
+    for (bgi::Surface *surface : {&copied, &blended})
+    {
+        bgi::Drawer d(*surface);
+        if (surface == &blended)
+        {
+            d.SetBlendMode(bgi::BlendMode::kSourceOver);
+        }
+        d.SetFillStyle(bgi::fill_patterns::Interleave, bgi::colors::Red, bgi::colors::Blue);
+        d.FillRect(10, 10, 50, 30);
+        d.SetDrawStyle(bgi::colors::Green);
+        d.DrawLine(0, 0, 100, 70);
+        d.SetWriteStyle(bgi::colors::White);
+        d.Write(5, 60, "Opaque");
+        d.SetFillStyle(bgi::Argb(0, 0xff, 0xff, 0xff));
+        if (surface == &blended)
+        {
+            d.FillRect(0, 0, 120, 90);
+        }
+    }
+    EXPECT_EQ(copied.pixels, blended.pixels);
+
+    // Clear() does not blend.
+    bgi::Drawer d(blended);
+    d.SetBlendMode(bgi::BlendMode::kSourceOver);
+    d.Clear(bgi::Argb(0x80, 0x10, 0x20, 0x30));
+    EXPECT_EQ(blended.row(0)[0], bgi::Argb(0x80, 0x10, 0x20, 0x30));
+}
+
+TEST(Bgi2Test, BlitMatchesPerPixelCopy)
+{
+    std::mt19937 rng(4);
+    auto R = [&](int lo, int hi)
+    { return std::uniform_int_distribution<int>(lo, hi)(rng); };
+    const bgi::Color kKey = bgi::colors::Magenta;
+    // Runs of opaque, transparent, keyed and translucent premultiplied
+    // pixels.
+    bgi::Surface sprite(70, 50);
+    for (size_t i = 0; i < sprite.pixels.size(); i += 8)
+    {
+        const int kind = R(0, 3);
+        for (size_t j = i; j < i + 8 && j < sprite.pixels.size(); j++)
+        {
+            const bgi::Color color = rng();
+            sprite.pixels[j] = kind == 0 ? color | 0xff000000 : kind == 1 ? 0 : kind == 2 && R(0, 1) ? kKey : SourceOver(0, color);
+        }
+    }
+    bgi::Surface background(150, 110);
+    for (bgi::Color &pixel : background.pixels)
+    {
+        pixel = rng() | 0xff000000;
+    }
+
+    for (int i = 0; i < 600; i++)
+    {
+        const bgi::Rect src(R(-20, 60), R(-20, 40), R(0, 90), R(0, 70));
+        const bgi::Rect viewport(R(-10, 60), R(-10, 50), R(0, 120), R(0, 90));
+        const int x = R(-60, 130);
+        const int y = R(-60, 100);
+        const int mode = i % 3;
+
+        bgi::Surface expected = background;
+        for (int sy = std::max(src.y, 0); sy < std::min(src.y + src.h, sprite.h); sy++)
+        {
+            for (int sx = std::max(src.x, 0); sx < std::min(src.x + src.w, sprite.w); sx++)
+            {
+                const int vx = x + sx - src.x;
+                const int vy = y + sy - src.y;
+                const int dx = viewport.x + vx;
+                const int dy = viewport.y + vy;
+                if (vx < 0 || vy < 0 || vx >= viewport.w || vy >= viewport.h || dx < 0 || dy < 0 || dx >= expected.w || dy >= expected.h)
+                {
+                    continue;
+                }
+                const bgi::Color pixel = sprite.row(sy)[sx];
+                bgi::Color &dst = expected.row(dy)[dx];
+                dst = mode == 0 ? pixel : mode == 1 ? (pixel == kKey ? dst : pixel) : BlendPremultiplied(dst, pixel);
+            }
+        }
+
+        bgi::Surface actual = background;
+        bgi::Drawer d(actual, viewport);
+        if (mode == 0)
+        {
+            d.Blit(sprite, src, x, y);
+        }
+        else if (mode == 1)
+        {
+            d.BlitKeyed(sprite, src, x, y, kKey);
+        }
+        else
+        {
+            d.BlitBlended(sprite, src, x, y);
+        }
+        ASSERT_EQ(actual.pixels, expected.pixels) << "blit #" << i;
+    }
+
+    // Blitting a surface onto itself, where the rects overlap.
+    bgi::Surface expected = background;
+    for (int y = 0; y < 40; y++)
+    {
+        std::copy_n(background.row(10 + y) + 20, 60, expected.row(15 + y) + 25);
+    }
+    bgi::Surface actual = background;
+    bgi::Drawer(actual).Blit(actual, bgi::Rect(20, 10, 60, 40), 25, 15);
+    EXPECT_EQ(actual.pixels, expected.pixels);
+
+    // In deferred mode too, across tiles, after the calls queued before.
+    auto self_blit = [](bgi::Surface &surface, bgi::Drawer d)
+    {
+        d.SetFillStyle(bgi::colors::Blue);
+        d.FillRect(70, 20, 20, 10);
+        d.Blit(surface, bgi::Rect(60, 10, 80, 60), 70, 30);
+        d.SetFillStyle(bgi::colors::Red);
+        d.FillRect(120, 50, 20, 20);
+    };
+    expected = background;
+    self_blit(expected, bgi::Drawer(expected));
+    actual = background;
+    {
+        bgi::TileRenderer renderer(actual, 4);
+        self_blit(actual, bgi::Drawer(renderer));
+    }
+    EXPECT_EQ(actual.pixels, expected.pixels);
+
+    // Deferred and recorded blits draw the same.
+    auto draw = [&](bgi::Drawer d)
+    {
+        d.SetFillStyle(bgi::colors::Blue);
+        d.FillRect(10, 10, 40, 30);
+        d.Blit(sprite, bgi::Rect(0, 0, 70, 50), 5, 5);
+        d.BlitKeyed(sprite, bgi::Rect(10, 10, 40, 30), 100, 60, kKey);
+        d.BlitBlended(sprite, bgi::Rect(-5, -5, 80, 60), 60, 30);
+    };
+    actual = background;
+    draw(bgi::Drawer(actual));
+    for (int pass = 0; pass < 3; pass++)
+    {
+        bgi::Surface other = background;
+        if (pass == 0)
+        {
+            bgi::TileRenderer renderer(other, 4);
+            draw(bgi::Drawer(renderer));
+        }
+        else
+        {
+            bgi::DisplayList list(background.w, background.h);
+            draw(bgi::Drawer(list));
+            if (pass == 2)
+            {
+                list.Optimize();
+                // The blit covers the FillRect.
+                EXPECT_EQ(list.size(), 3u);
+            }
+            list.Replay(bgi::Drawer(other));
+        }
+        EXPECT_EQ(other.pixels, actual.pixels) << "pass " << pass;
+    }
 }
 
 // TODO more tests.
@@ -0,0 +1,97 @@
+#include "bgi2.h"
+
+#include <algorithm>
+
+namespace bgi
+{
+    ThreadPool::ThreadPool(int threads)
+    {
+        if (threads <= 0)
+        {
+            threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        }
+        for (int i = 1; i < threads; i++)
+        {
+            workers_.emplace_back([this]
+                                  { Work(); });
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            quit_ = true;
+        }
+        start_.notify_all();
+        for (std::thread &worker : workers_)
+        {
+            worker.join();
+        }
+    }
+
+    void ThreadPool::ParallelFor(int n, const std::function<void(int)> &f)
+    {
+        if (n <= 0)
+        {
+            return;
+        }
+        if (workers_.empty() || n == 1)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                f(i);
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = &f;
+            job_size_ = n;
+            next_ = 0;
+            running_ = static_cast<int>(workers_.size());
+            generation_++;
+        }
+        start_.notify_all();
+        RunJob();
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this]
+                   { return running_ == 0; });
+        job_ = nullptr;
+    }
+
+    void ThreadPool::Work()
+    {
+        int generation = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                start_.wait(lock, [&]
+                            { return quit_ || generation_ != generation; });
+                if (quit_)
+                {
+                    return;
+                }
+                generation = generation_;
+            }
+            RunJob();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                running_--;
+            }
+            done_.notify_one();
+        }
+    }
+
+    void ThreadPool::RunJob()
+    {
+        // job_ and job_size_ do not change until every thread is done.
+        for (int i = next_++; i < job_size_; i = next_++)
+        {
+            (*job_)(i);
+        }
+    }
+} // namespace bgi